@@ -1,29 +1,192 @@
 #include <app/Application.h>
+#include <app/ForkServer.h>
+#include <app/Input.h>
+#include <emu/audio/audio_sink.h>
+#include <emu/cpu/cpu.h>
 #include <cstdlib>
 #include <csignal>
+#include <cstring>
+#include <vector>
 
 bool Application::initialized = false;
-System* _sys = nullptr;
+System* Application::sys = nullptr;
 
+static const char* save_path = nullptr;
+static uint32_t checkpoint_frames = 0;
+static volatile sig_atomic_t quit_requested = 0;
+static volatile sig_atomic_t rewind_requested = 0;
+static InputSource* input = nullptr;
+
+// Only stops at the next frame boundary, so the state saved on exit is
+// never from the middle of an instruction
 void sig_handler(int)
 {
-	printf("Sigint handler\n");
-	exit(1);
+	quit_requested = 1;
+}
+
+// Each SIGUSR1 steps back a second
+void rewind_handler(int)
+{
+	rewind_requested = rewind_requested + 1;
 }
 
 bool Application::Init(int argc, char** argv)
 {
-	if (argc < 2)
+	std::vector<char*> args;
+	char* audio_path = nullptr;
+	uint32_t audio_rate = 44100;
+	uint32_t cpu_features = 0;
+	char* hle_spec = nullptr;
+	char* exe_path = nullptr;
+	bool fast_boot = false;
+	char* warm_dir = nullptr;
+	char* load_path = nullptr;
+	size_t rewind_mib = 0;
+	uint32_t run_ahead = 0;
+	int fork_server_frames = -1;
+	size_t fork_server_jobs = 0;
+	char* record_path = nullptr;
+	char* play_path = nullptr;
+	uint32_t keyframe_interval = 600;
+	uint32_t seek_frame = 0;
+	char* input_path = nullptr;
+	char* card_paths[2] = {};
+	bool analog = false;
+	bool dither = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-a") && i + 1 < argc)
+			audio_path = argv[++i];
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+			audio_rate = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-t"))
+			cpu_features |= CPU::FeatureTtyHook;
+		else if (!strcmp(argv[i], "-d"))
+			cpu_features |= CPU::FeatureTrace | CPU::FeatureAlignCheck;
+		else if (!strcmp(argv[i], "-s"))
+			cpu_features |= CPU::FeatureSingleStep;
+		else if (!strcmp(argv[i], "-hle") && i + 1 < argc)
+			hle_spec = argv[++i];
+		else if (!strcmp(argv[i], "-exe") && i + 1 < argc)
+			exe_path = argv[++i];
+		else if (!strcmp(argv[i], "-fast"))
+			fast_boot = true;
+		else if (!strcmp(argv[i], "-warm") && i + 1 < argc)
+			warm_dir = argv[++i];
+		else if (!strcmp(argv[i], "-load") && i + 1 < argc)
+			load_path = argv[++i];
+		else if (!strcmp(argv[i], "-save") && i + 1 < argc)
+			save_path = argv[++i];
+		else if (!strcmp(argv[i], "-checkpoint") && i + 1 < argc)
+			checkpoint_frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-rewind") && i + 1 < argc)
+			rewind_mib = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-runahead") && i + 1 < argc)
+			run_ahead = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-forkserver") && i + 1 < argc)
+			fork_server_frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-forkjobs") && i + 1 < argc)
+			fork_server_jobs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-record") && i + 1 < argc)
+			record_path = argv[++i];
+		else if (!strcmp(argv[i], "-keyframes") && i + 1 < argc)
+			keyframe_interval = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-play") && i + 1 < argc)
+			play_path = argv[++i];
+		else if (!strcmp(argv[i], "-seek") && i + 1 < argc)
+			seek_frame = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-input") && i + 1 < argc)
+			input_path = argv[++i];
+		else if (!strcmp(argv[i], "-card1") && i + 1 < argc)
+			card_paths[0] = argv[++i];
+		else if (!strcmp(argv[i], "-card2") && i + 1 < argc)
+			card_paths[1] = argv[++i];
+		else if (!strcmp(argv[i], "-analog"))
+			analog = true;
+		else if (!strcmp(argv[i], "-dither"))
+			dither = true;
+		else
+			args.push_back(argv[i]);
+	}
+
+	if (audio_rate < 8000 || audio_rate > 192000)
+	{
+		printf("Sample rate must be between 8000 and 192000 Hz\n");
+		exit(1);
+	}
+
+	if (args.size() < 1)
 	{
-		printf("Usage: %s [bios]\n", argv[0]);
+		printf("Usage: %s [-a audio.wav|audio.raw] [-r 44100|48000] [-t] [-d] [-s] [-hle all|none|group,-func,...] [-fast] [-exe file.exe] [-warm cache_dir] [-load state] [-save state [-checkpoint frames]] [-rewind MiB] [-runahead frames] [-forkserver frames [-forkjobs n]] [-record movie [-keyframes frames]] [-play movie [-seek frame]] [-input script] [-card1 file] [-card2 file] [-analog] [-dither] [bios] [disc]\n", argv[0]);
 		exit(1);
 	}
 
-    _sys = new System(argv[1]);
+    sys = new System(args[0]);
+	sys->SetCpuFeatures(cpu_features);
+
+	if (hle_spec && !sys->ConfigureHle(hle_spec))
+		exit(1);
+
+	if (args.size() >= 2)
+		sys->InsertDisc(args[1]);
+
+	for (int port = 0; port < 2; port++)
+	{
+		if (card_paths[port] && !sys->InsertCard(port, card_paths[port]))
+			exit(1);
+	}
+
+	sys->SetAnalogPad(0, analog);
+	sys->SetMdecDithering(dither);
+
+	if (input_path)
+	{
+		auto script = new ScriptInput();
+
+		if (!script->load(input_path))
+			exit(1);
+
+		input = script;
+	}
+	else
+		input = new KeyboardInput();
+
+	if (warm_dir)
+		sys->SetWarmBootCache(warm_dir);
+
+	sys->SetRunAhead(run_ahead);
+
+	// A movie brings its own start state
+	if (play_path)
+	{
+		if (!sys->PlayMovie(play_path) || (seek_frame && !sys->SeekMovie(seek_frame)))
+			exit(1);
+	}
+	else if (load_path)
+	{
+		if (!sys->LoadStateFile(load_path))
+			exit(1);
+	}
+	else if (exe_path)
+		sys->FastBoot(exe_path);
+	else if (fast_boot)
+		sys->FastBoot();
+
+	if (record_path)
+		sys->RecordMovie(record_path, keyframe_interval);
+
+	if (audio_path)
+	{
+		const char* ext = strrchr(audio_path, '.');
+		auto format = (ext && !strcmp(ext, ".wav")) ? FileAudioSink::Format::Wav : FileAudioSink::Format::Raw;
+
+		sys->SetAudioSink(new FileAudioSink(audio_path, format, audio_rate));
+	}
 
     std::atexit(Exit);
 
-    if (!_sys)
+    if (!sys)
     {
         printf("ERR: Could not initialize system\n");
         return false;
@@ -31,18 +194,56 @@ bool Application::Init(int argc, char** argv)
 
 	std::signal(SIGINT, sig_handler);
 
+	// Runs to the snapshot point, then only serves; see ForkServer
+	if (fork_server_frames >= 0)
+	{
+		for (int i = 0; i < fork_server_frames; i++)
+			sys->Clock();
+
+		ForkServer(sys, fork_server_jobs).serve();
+		exit(0);
+	}
+
+	if (rewind_mib)
+	{
+		sys->EnableRewind(rewind_mib << 20);
+		std::signal(SIGUSR1, rewind_handler);
+	}
+
     return true;
 }
 
 void Application::Run()
 {
-    while (1)
-        _sys->Clock();
+	uint32_t frames = 0;
+
+    while (!quit_requested)
+	{
+		input->poll(sys, frames);
+        sys->Clock();
+		frames++;
+
+		if (rewind_requested)
+		{
+			sys->Rewind(60 * rewind_requested);
+			rewind_requested = 0;
+		}
+
+		if (save_path && checkpoint_frames && frames % checkpoint_frames == 0)
+			sys->SaveStateFile(save_path);
+	}
+
+	printf("Sigint handler\n");
+	exit(1);
 }
 
 void Application::Exit()
 {
-    _sys->Dump();
+	if (save_path)
+		sys->SaveStateFile(save_path);
+
+    sys->Dump();
+    delete sys;
     printf("Exiting\n");
 }
 
@@ -5,12 +5,11 @@
 
 #include <emu/system.h>
 
-extern System* _sys;
-
 class Application
 {
 private:
     static bool initialized;
+    static System* sys;
 public:
     static bool Init(int, char**);
 
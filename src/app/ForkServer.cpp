@@ -0,0 +1,185 @@
+#include <app/ForkServer.h>
+#include <emu/system.h>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static bool read_all(int fd, void* data, size_t size)
+{
+	uint8_t* p = (uint8_t*)data;
+
+	while (size)
+	{
+		ssize_t n = read(fd, p, size);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+ForkServer::ForkServer(System* sys, size_t max_children)
+: sys(sys), max_children(max_children)
+{
+	if (!this->max_children)
+		this->max_children = std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+bool ForkServer::read_case(Case& c)
+{
+	if (!read_all(REQUEST_FD, &c.request, sizeof(c.request)))
+		return false;
+
+	if (c.request.magic != REQUEST_MAGIC)
+	{
+		printf("[app/ForkServer]: Bad request magic 0x%08x\n", c.request.magic);
+		return false;
+	}
+
+	// Grown as patches arrive, so a bogus count can't allocate up front
+	for (uint32_t i = 0; i < c.request.patch_count; i++)
+	{
+		uint32_t header[2];
+
+		if (!read_all(REQUEST_FD, header, sizeof(header)))
+			return false;
+
+		if (header[1] > MAX_PATCH_SIZE)
+		{
+			printf("[app/ForkServer]: Patch of %u bytes is larger than RAM\n", header[1]);
+			return false;
+		}
+
+		auto& patch = c.patches.emplace_back();
+		patch.addr = header[0];
+		patch.data.resize(header[1]);
+
+		if (!read_all(REQUEST_FD, patch.data.data(), patch.data.size()))
+			return false;
+	}
+
+	c.inputs.resize(c.request.input_frames);
+	return read_all(REQUEST_FD, c.inputs.data(), c.inputs.size() * sizeof(uint16_t));
+}
+
+void ForkServer::reply(const Reply& r)
+{
+	while (write(REPLY_FD, &r, sizeof(r)) < 0 && errno == EINTR)
+		;
+}
+
+// In the child. Leaves with _exit(), so nothing the parent set up (atexit
+// handlers, stdio buffers, the disc profile) is flushed a second time
+void ForkServer::run_case(const Case& c)
+{
+	close(REQUEST_FD);
+	sys->AfterFork();
+
+	Reply r = {};
+	r.type = Finished;
+	r.pid = getpid();
+
+	for (auto& patch : c.patches)
+	{
+		if (!sys->PatchMemory(patch.addr, patch.data.data(), patch.data.size()))
+			r.status++;
+	}
+
+	for (uint32_t frame = 0; frame < c.request.frames; frame++)
+	{
+		if (!c.inputs.empty())
+			sys->SetPad(0, true, c.inputs[std::min<size_t>(frame, c.inputs.size() - 1)]);
+
+		sys->Clock();
+	}
+
+	r.pc = sys->GetPc();
+
+	if (c.request.flags & FlagHashRam)
+		r.ram_hash = sys->RamHash();
+
+	reply(r);
+	_exit(0);
+}
+
+// Reports the children that have exited, waiting for more of them while
+// over max_running are left
+void ForkServer::reap(size_t max_running)
+{
+	while (running)
+	{
+		int status;
+		pid_t pid = waitpid(-1, &status, running > max_running ? 0 : WNOHANG);
+
+		if (pid < 0 && errno == EINTR)
+			continue;
+		if (pid <= 0)
+			return;
+
+		running--;
+
+		Reply r = {};
+		r.type = Exited;
+		r.pid = pid;
+		r.status = status;
+		reply(r);
+	}
+}
+
+void ForkServer::serve()
+{
+	printf("[app/ForkServer]: Serving on fds %d/%d\n", REQUEST_FD, REPLY_FD);
+
+	// Children inherit unflushed output otherwise
+	fflush(stdout);
+
+	for (;;)
+	{
+		pollfd pfd = {REQUEST_FD, POLLIN, 0};
+
+		// Wake up now and then to reap children even without new requests
+		int ready = poll(&pfd, 1, 10);
+		reap(max_children);
+
+		if (ready <= 0)
+			continue;
+
+		Case c;
+
+		if (!read_case(c))
+			break;
+
+		// Wait for a free slot
+		reap(max_children - 1);
+
+		pid_t pid = fork();
+
+		if (pid < 0)
+		{
+			printf("[app/ForkServer]: fork failed (%d)\n", errno);
+			break;
+		}
+
+		if (pid == 0)
+			run_case(c);
+
+		running++;
+
+		Reply r = {};
+		r.type = Started;
+		r.pid = pid;
+		reply(r);
+	}
+
+	reap(0);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+class System;
+
+// Boots once, then forks a child per test case: each child starts from the
+// machine as it is when serve() is called, sharing guest memory with the
+// server copy-on-write, so a case costs a fork plus its own emulation.
+//
+// Requests come in on REQUEST_FD, replies go out on REPLY_FD. A request is
+//
+//   Request, then patch_count x {uint32_t addr, uint32_t size, size bytes},
+//   then input_frames x uint16_t pad 1 buttons (active high, last one held)
+//
+// and produces three replies, tagged with the child's pid: Started from the
+// server, Finished from the child once it has run the requested frames, and
+// Exited from the server with the child's wait status, which tells crashes
+// and timeouts (signals) apart from finished runs. Cases run in parallel, so
+// replies of different cases interleave, and a child's Finished may even
+// arrive before its Started. Closing the request pipe ends the server once
+// all children have exited. At most max_children cases run at a time; a
+// case beyond that waits for one of them to exit before it is forked.
+class ForkServer
+{
+public:
+	static constexpr int REQUEST_FD = 198;
+	static constexpr int REPLY_FD = 199;
+
+	static constexpr uint32_t REQUEST_MAGIC = 0x46585350;	// "PSXF"
+
+	// Nothing bigger fits in RAM
+	static constexpr uint32_t MAX_PATCH_SIZE = 0x200000;
+
+	enum Flags : uint32_t
+	{
+		FlagHashRam = 1 << 0,	// Fill in Reply::ram_hash
+	};
+
+	struct Request
+	{
+		uint32_t magic;
+		uint32_t frames;
+		uint32_t flags;
+		uint32_t patch_count;
+		uint32_t input_frames;
+	};
+
+	enum ReplyType : uint32_t
+	{
+		Started,
+		Finished,
+		Exited,
+	};
+
+	// Small enough for pipe writes to be atomic, so children and the server
+	// can share the reply pipe
+	struct Reply
+	{
+		uint32_t type;
+		uint32_t pid;
+		int32_t status;		// Exited: wait status. Finished: patches that failed
+		uint32_t pc;		// Finished
+		uint64_t ram_hash;	// Finished, with FlagHashRam
+	};
+private:
+	struct Patch
+	{
+		uint32_t addr;
+		std::vector<uint8_t> data;
+	};
+
+	struct Case
+	{
+		Request request;
+		std::vector<Patch> patches;
+		std::vector<uint16_t> inputs;
+	};
+
+	System* sys;
+	size_t max_children;
+	size_t running = 0;
+
+	bool read_case(Case& c);
+	void run_case(const Case& c);
+	void reply(const Reply& r);
+	void reap(size_t max_running);
+public:
+	// 0 children means one per host core
+	ForkServer(System* sys, size_t max_children = 0);
+
+	// Returns once the request pipe is closed
+	void serve();
+};
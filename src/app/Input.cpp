@@ -0,0 +1,155 @@
+#include <app/Input.h>
+#include <emu/system.h>
+#include <SDL2/SDL.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// In wire order: bit 0 is select, bit 15 square
+static const char* const button_names[16] =
+{
+	"select", "l3", "r3", "start", "up", "right", "down", "left",
+	"l2", "r2", "l1", "r1", "triangle", "circle", "cross", "square",
+};
+
+uint16_t button_from_name(const std::string& name)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		if (name == button_names[i])
+			return 1 << i;
+	}
+
+	return 0;
+}
+
+void KeyboardInput::poll(System* sys, uint32_t)
+{
+	static constexpr struct
+	{
+		SDL_Scancode key;
+		const char* button;
+	} keymap[] =
+	{
+		{SDL_SCANCODE_UP, "up"},
+		{SDL_SCANCODE_DOWN, "down"},
+		{SDL_SCANCODE_LEFT, "left"},
+		{SDL_SCANCODE_RIGHT, "right"},
+		{SDL_SCANCODE_Z, "cross"},
+		{SDL_SCANCODE_X, "circle"},
+		{SDL_SCANCODE_A, "square"},
+		{SDL_SCANCODE_S, "triangle"},
+		{SDL_SCANCODE_Q, "l1"},
+		{SDL_SCANCODE_W, "r1"},
+		{SDL_SCANCODE_E, "l2"},
+		{SDL_SCANCODE_R, "r2"},
+		{SDL_SCANCODE_RETURN, "start"},
+		{SDL_SCANCODE_BACKSPACE, "select"},
+	};
+
+	SDL_PumpEvents();
+	const uint8_t* keys = SDL_GetKeyboardState(nullptr);
+
+	uint16_t buttons = 0;
+
+	for (auto& entry : keymap)
+	{
+		if (keys[entry.key])
+			buttons |= button_from_name(entry.button);
+	}
+
+	sys->SetPad(0, true, buttons);
+}
+
+bool ScriptInput::load(const std::string& path)
+{
+	std::ifstream file(path);
+
+	if (!file)
+	{
+		printf("[app/Input]: Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	changes.clear();
+	changes.push_back({0, 0, true, 0, false, {}});
+
+	std::string line;
+	int line_number = 0;
+
+	while (std::getline(file, line))
+	{
+		line_number++;
+		line = line.substr(0, line.find('#'));
+
+		std::istringstream in(line);
+		std::string frame, port, buttons;
+
+		if (!(in >> frame))
+			continue;
+
+		Change change = {};
+		in >> port >> buttons;
+
+		change.frame = strtoul(frame.c_str(), nullptr, 0);
+		change.port = atoi(port.c_str()) - 1;
+		change.connected = buttons != "unplugged";
+
+		if (change.port < 0 || change.port > 1 || buttons.empty())
+		{
+			printf("[app/Input]: %s:%d: expected <frame> <port> <buttons>\n", path.c_str(), line_number);
+			return false;
+		}
+
+		if (change.connected && buttons != "-")
+		{
+			std::istringstream names(buttons);
+			std::string name;
+
+			while (std::getline(names, name, '+'))
+			{
+				uint16_t bit = button_from_name(name);
+
+				if (!bit)
+				{
+					printf("[app/Input]: %s:%d: unknown button '%s'\n", path.c_str(), line_number, name.c_str());
+					return false;
+				}
+
+				change.buttons |= bit;
+			}
+		}
+
+		std::string axis;
+		for (int i = 0; i < 4 && in >> axis; i++)
+		{
+			change.axes[i] = strtoul(axis.c_str(), nullptr, 0);
+			change.has_axes = i == 3;
+		}
+
+		changes.push_back(change);
+	}
+
+	std::stable_sort(changes.begin(), changes.end(), [](const Change& a, const Change& b)
+	{
+		return a.frame < b.frame;
+	});
+
+	next = 0;
+	return true;
+}
+
+void ScriptInput::poll(System* sys, uint32_t frame)
+{
+	for (; next < changes.size() && changes[next].frame <= frame; next++)
+	{
+		const Change& change = changes[next];
+
+		sys->SetPad(change.port, change.connected, change.buttons);
+
+		if (change.has_axes)
+			sys->SetPadAxes(change.port, change.axes[2], change.axes[3], change.axes[0], change.axes[1]);
+	}
+}
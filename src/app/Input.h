@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class System;
+
+// Where pad input comes from; polled once before every frame
+class InputSource
+{
+public:
+	virtual ~InputSource() = default;
+	virtual void poll(System* sys, uint32_t frame) = 0;
+};
+
+// Pad 1 on the keyboard of the SDL window: arrows, Z/X/A/S for
+// cross/circle/square/triangle, Q/W/E/R for L1/R1/L2/R2, Enter and
+// Backspace for start and select
+class KeyboardInput : public InputSource
+{
+public:
+	void poll(System* sys, uint32_t frame) override;
+};
+
+// Input script for headless runs. One change per line, held until the next
+// change for that port:
+//
+//   <frame> <port 1|2> <buttons> [lx ly rx ry]
+//
+// where buttons is "-" for none, "unplugged", or names joined by '+'
+// (e.g. "cross+up"). Pad 1 is plugged in from frame 0; '#' starts a
+// comment.
+class ScriptInput : public InputSource
+{
+private:
+	struct Change
+	{
+		uint32_t frame;
+		int port;
+		bool connected;
+		uint16_t buttons;
+		bool has_axes;
+		uint8_t axes[4];	// Left X/Y, right X/Y
+	};
+
+	std::vector<Change> changes;
+	size_t next = 0;
+public:
+	bool load(const std::string& path);
+	void poll(System* sys, uint32_t frame) override;
+};
+
+// Button bit for a name as used in scripts, 0 if unknown
+uint16_t button_from_name(const std::string& name);
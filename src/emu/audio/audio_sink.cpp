@@ -0,0 +1,124 @@
+#include "audio_sink.h"
+#include "resampler.h"
+#include <emu/spu/spu.h>
+#include <vector>
+#include <chrono>
+
+struct WavHeader
+{
+	char riff[4] = {'R', 'I', 'F', 'F'};
+	uint32_t riff_size;
+	char wave[4] = {'W', 'A', 'V', 'E'};
+	char fmt[4] = {'f', 'm', 't', ' '};
+	uint32_t fmt_size = 16;
+	uint16_t audio_format = 1;		// PCM
+	uint16_t channels = 2;
+	uint32_t sample_rate;
+	uint32_t byte_rate;
+	uint16_t block_align = 4;
+	uint16_t bits_per_sample = 16;
+	char data[4] = {'d', 'a', 't', 'a'};
+	uint32_t data_size;
+};
+
+static_assert(sizeof(WavHeader) == 44);
+
+FileAudioSink::FileAudioSink(std::string path, Format format, uint32_t rate)
+: format(format), rate(rate)
+{
+	file = fopen(path.c_str(), "wb");
+
+	if (!file)
+	{
+		printf("[emu/Audio]: Couldn't open %s for writing\n", path.c_str());
+		return;
+	}
+
+	if (rate != SPU_SAMPLE_RATE)
+		resampler = new Resampler(SPU_SAMPLE_RATE, rate);
+
+	write_header();
+
+	writer = std::thread(&FileAudioSink::writer_loop, this);
+}
+
+FileAudioSink::~FileAudioSink()
+{
+	if (!file)
+		return;
+
+	stop.store(true, std::memory_order_release);
+	writer.join();
+
+	// Patch in the real sizes now that the stream is complete
+	write_header();
+	fclose(file);
+
+	if (dropped)
+		printf("[emu/Audio]: Writer fell behind, %llu frames dropped\n", (unsigned long long)dropped.load());
+
+	delete resampler;
+}
+
+void FileAudioSink::write_header()
+{
+	if (format != Format::Wav)
+		return;
+
+	// While streaming the sizes are unknown; 0xFFFFFFFF is what most tools
+	// expect from a WAV that is still being written
+	bool streaming = !stop.load(std::memory_order_acquire);
+
+	WavHeader header;
+	header.sample_rate = rate;
+	header.byte_rate = rate * 4;
+	header.data_size = streaming ? 0xFFFFFFFF : (uint32_t)std::min<uint64_t>(data_bytes, 0xFFFFFFFF - 36);
+	header.riff_size = streaming ? 0xFFFFFFFF : header.data_size + 36;
+
+	fseek(file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, file);
+	fseek(file, 0, SEEK_END);
+}
+
+void FileAudioSink::submit(const int16_t* samples, size_t frames)
+{
+	size_t written = ring.write(samples, frames * 2);
+
+	if (written < frames * 2)
+		dropped.fetch_add(frames - written / 2, std::memory_order_relaxed);
+}
+
+void FileAudioSink::write_out()
+{
+	int16_t chunk[4096];
+	std::vector<int16_t> resampled;
+
+	size_t count;
+	while ((count = ring.read(chunk, sizeof(chunk) / sizeof(chunk[0]))) > 0)
+	{
+		const int16_t* data = chunk;
+
+		if (resampler)
+		{
+			resampled.clear();
+			resampler->process(chunk, count / 2, resampled);
+			data = resampled.data();
+			count = resampled.size();
+		}
+
+		fwrite(data, sizeof(int16_t), count, file);
+		data_bytes += count * sizeof(int16_t);
+	}
+}
+
+void FileAudioSink::writer_loop()
+{
+	while (!stop.load(std::memory_order_acquire))
+	{
+		write_out();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// Whatever was submitted before the stop request
+	write_out();
+}
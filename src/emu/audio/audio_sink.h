@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <util/spsc_ring.h>
+
+class Resampler;
+
+// Receives the SPU mix: interleaved stereo int16 at 44.1 kHz, one block at a
+// time, on the emulation thread.
+class AudioSink
+{
+public:
+	virtual ~AudioSink() = default;
+
+	virtual void submit(const int16_t* samples, size_t frames) = 0;
+};
+
+// Streams the mix to a WAV or raw PCM file. The emulation thread only copies
+// into a lock-free ring; resampling and file I/O happen on a writer thread.
+// If the writer falls behind, samples are dropped (and counted) rather than
+// stalling emulation.
+class FileAudioSink : public AudioSink
+{
+public:
+	enum class Format
+	{
+		Wav,
+		Raw,
+	};
+private:
+	FILE* file = nullptr;
+	Format format;
+	uint32_t rate;
+	uint64_t data_bytes = 0;
+
+	Resampler* resampler = nullptr;
+
+	// About 1.5 seconds of stereo samples
+	SpscRing<int16_t, 1 << 17> ring;
+	std::atomic<uint64_t> dropped = 0;
+
+	std::thread writer;
+	std::atomic<bool> stop = false;
+
+	void write_header();
+	void write_out();
+	void writer_loop();
+public:
+	FileAudioSink(std::string path, Format format, uint32_t rate);
+	~FileAudioSink();
+
+	bool is_open() const {return file != nullptr;}
+
+	void submit(const int16_t* samples, size_t frames) override;
+};
@@ -0,0 +1,75 @@
+#include "resampler.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <cassert>
+
+Resampler::Resampler(uint32_t in_rate, uint32_t out_rate)
+{
+	assert(in_rate && out_rate);
+
+	uint32_t div = std::gcd(in_rate, out_rate);
+	up = out_rate / div;
+	down = in_rate / div;
+
+	// Cutoff a little under the lower of the two Nyquist rates, relative to
+	// the input rate
+	const double cutoff = 0.9 * std::min(1.0, (double)up / down);
+
+	coeffs.resize(up * TAPS);
+
+	for (uint32_t p = 0; p < up; p++)
+	{
+		double sum = 0;
+
+		for (int k = 0; k < TAPS; k++)
+		{
+			double d = k - (TAPS / 2 - 1) - (double)p / up;
+			double x = M_PI * cutoff * d;
+			double sinc = d == 0 ? 1.0 : std::sin(x) / x;
+			double window = 0.42 + 0.5 * std::cos(2 * M_PI * d / TAPS) + 0.08 * std::cos(4 * M_PI * d / TAPS);
+
+			coeffs[p * TAPS + k] = sinc * window;
+			sum += sinc * window;
+		}
+
+		// Unity gain on every phase
+		for (int k = 0; k < TAPS; k++)
+			coeffs[p * TAPS + k] /= sum;
+	}
+}
+
+void Resampler::process(const int16_t* in, size_t frames, std::vector<int16_t>& out)
+{
+	for (size_t i = 0; i < frames * 2; i++)
+		history.push_back(in[i]);
+
+	const size_t available = history.size() / 2;
+
+	for (;;)
+	{
+		size_t base = phase / up;
+		if (base + TAPS > available)
+			break;
+
+		const float* h = &coeffs[(phase % up) * TAPS];
+		const float* x = &history[base * 2];
+
+		float l = 0, r = 0;
+		for (int k = 0; k < TAPS; k++)
+		{
+			l += h[k] * x[k * 2 + 0];
+			r += h[k] * x[k * 2 + 1];
+		}
+
+		out.push_back((int16_t)std::clamp(std::lround(l), -0x8000l, 0x7FFFl));
+		out.push_back((int16_t)std::clamp(std::lround(r), -0x8000l, 0x7FFFl));
+
+		phase += down;
+	}
+
+	// Drop the frames no future output needs anymore
+	size_t consumed = std::min<size_t>(phase / up, available);
+	history.erase(history.begin(), history.begin() + consumed * 2);
+	phase -= consumed * up;
+}
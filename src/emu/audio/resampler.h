@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Polyphase windowed-sinc resampler for interleaved stereo int16 streams,
+// for rational ratios (44100 -> 48000 is 160/147). Not thread safe; meant to
+// run on the audio writer thread.
+class Resampler
+{
+private:
+	static constexpr int TAPS = 32;
+
+	uint32_t up, down;
+	std::vector<float> coeffs;		// up phases x TAPS
+
+	// Input history, TAPS - 1 frames carried over between calls
+	std::vector<float> history;
+	uint64_t phase = 0;				// Output position, in units of 1/up input frames
+public:
+	Resampler(uint32_t in_rate, uint32_t out_rate);
+
+	// Appends the resampled frames to out
+	void process(const int16_t* in, size_t frames, std::vector<int16_t>& out);
+};
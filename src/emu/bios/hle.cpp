@@ -0,0 +1,981 @@
+#include "hle.h"
+#include <emu/memory/Bus.h>
+#include <emu/cdvd/iso9660.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+const BiosHle::Function BiosHle::functions[] =
+{
+	{0xA0, 0x00, "open", "file", &BiosHle::fn_open},
+	{0xA0, 0x01, "lseek", "file", &BiosHle::fn_lseek},
+	{0xA0, 0x02, "read", "file", &BiosHle::fn_read},
+	{0xA0, 0x04, "close", "file", &BiosHle::fn_close},
+	{0xA0, 0x15, "strcat", "str", &BiosHle::fn_strcat},
+	{0xA0, 0x17, "strcmp", "str", &BiosHle::fn_strcmp},
+	{0xA0, 0x18, "strncmp", "str", &BiosHle::fn_strncmp},
+	{0xA0, 0x19, "strcpy", "str", &BiosHle::fn_strcpy},
+	{0xA0, 0x1B, "strlen", "str", &BiosHle::fn_strlen},
+	{0xA0, 0x1E, "strchr", "str", &BiosHle::fn_strchr},
+	{0xA0, 0x1F, "strrchr", "str", &BiosHle::fn_strrchr},
+	{0xA0, 0x27, "bcopy", "mem", &BiosHle::fn_bcopy},
+	{0xA0, 0x28, "bzero", "mem", &BiosHle::fn_bzero},
+	{0xA0, 0x29, "bcmp", "mem", &BiosHle::fn_bcmp},
+	{0xA0, 0x2A, "memcpy", "mem", &BiosHle::fn_memcpy},
+	{0xA0, 0x2B, "memset", "mem", &BiosHle::fn_memset},
+	{0xA0, 0x2C, "memmove", "mem", &BiosHle::fn_memmove},
+	{0xA0, 0x2D, "memcmp", "mem", &BiosHle::fn_memcmp},
+	{0xA0, 0x2E, "memchr", "mem", &BiosHle::fn_memchr},
+	{0xA0, 0x33, "malloc", "heap", &BiosHle::fn_malloc},
+	{0xA0, 0x34, "free", "heap", &BiosHle::fn_free},
+	{0xA0, 0x37, "calloc", "heap", &BiosHle::fn_calloc},
+	{0xA0, 0x38, "realloc", "heap", &BiosHle::fn_realloc},
+	{0xA0, 0x39, "InitHeap", "heap", &BiosHle::fn_init_heap},
+	{0xB0, 0x08, "OpenEvent", "event", &BiosHle::fn_open_event},
+	{0xB0, 0x09, "CloseEvent", "event", &BiosHle::fn_close_event},
+	{0xB0, 0x0A, "WaitEvent", "event", &BiosHle::fn_wait_event},
+	{0xB0, 0x0B, "TestEvent", "event", &BiosHle::fn_test_event},
+	{0xB0, 0x0C, "EnableEvent", "event", &BiosHle::fn_enable_event},
+	{0xB0, 0x0D, "DisableEvent", "event", &BiosHle::fn_disable_event},
+	{0xB0, 0x12, "InitPad", "pad", &BiosHle::fn_init_pad},
+	{0xB0, 0x13, "StartPad", "pad", &BiosHle::fn_start_pad},
+	{0xB0, 0x14, "StopPad", "pad", &BiosHle::fn_stop_pad},
+	{0xB0, 0x32, "open", "file", &BiosHle::fn_open},
+	{0xB0, 0x33, "lseek", "file", &BiosHle::fn_lseek},
+	{0xB0, 0x34, "read", "file", &BiosHle::fn_read},
+	{0xB0, 0x36, "close", "file", &BiosHle::fn_close},
+};
+
+const size_t BiosHle::function_count = sizeof(functions) / sizeof(functions[0]);
+
+// Groups that are safe to run natively without any setup
+static const char* const DEFAULT_GROUPS = "mem,str,event";
+
+enum Reg
+{
+	V0 = 2,
+	A0 = 4,
+	A1 = 5,
+	A2 = 6,
+	A3 = 7,
+};
+
+static int vector_index(uint32_t vector)
+{
+	switch (vector)
+	{
+	case 0xA0: return 0;
+	case 0xB0: return 1;
+	case 0xC0: return 2;
+	default: return -1;
+	}
+}
+
+BiosHle::BiosHle(Bus* bus)
+: bus(bus)
+{
+	for (size_t f = 0; f < function_count; f++)
+		entries[vector_index(functions[f].vector)][functions[f].number].handler = functions[f].handler;
+
+	configure(DEFAULT_GROUPS);
+}
+
+BiosHle::~BiosHle() = default;
+
+bool BiosHle::call(uint32_t vector, uint32_t number, uint32_t* regs)
+{
+	int table = vector_index(vector);
+
+	if (table < 0 || number >= 0x100)
+		return false;
+
+	auto& entry = entries[table][number];
+	if (!entry.enabled)
+		return false;
+
+	return (this->*entry.handler)(regs);
+}
+
+// Functions of these groups share state only one side knows about (the
+// heap bounds, the open files), so they can't be split between HLE and BIOS
+static bool whole_group_only(const char* group)
+{
+	return !strcmp(group, "heap") || !strcmp(group, "file");
+}
+
+bool BiosHle::set_enabled(const std::string& name, bool enabled)
+{
+	bool found = false;
+
+	for (size_t f = 0; f < function_count; f++)
+	{
+		auto& func = functions[f];
+
+		if (name == func.name && whole_group_only(func.group))
+		{
+			printf("[emu/HLE]: \"%s\" can only be toggled with the rest of \"%s\"\n", func.name, func.group);
+			return false;
+		}
+
+		if (name == "all" || name == func.name || name == func.group)
+		{
+			entries[vector_index(func.vector)][func.number].enabled = enabled;
+			found = true;
+		}
+	}
+
+	if (!found)
+		printf("[emu/HLE]: Unknown BIOS function or group \"%s\"\n", name.c_str());
+
+	return found;
+}
+
+uint64_t BiosHle::enabled_mask() const
+{
+	static_assert(sizeof(functions) / sizeof(functions[0]) <= 64, "Too many functions for the mask");
+
+	uint64_t mask = 0;
+
+	for (size_t f = 0; f < function_count; f++)
+	{
+		if (entries[vector_index(functions[f].vector)][functions[f].number].enabled)
+			mask |= 1ull << f;
+	}
+
+	return mask;
+}
+
+bool BiosHle::configure(const std::string& spec)
+{
+	size_t start = 0;
+
+	while (start <= spec.size())
+	{
+		size_t end = spec.find(',', start);
+		if (end == std::string::npos)
+			end = spec.size();
+
+		std::string name = spec.substr(start, end - start);
+		bool enabled = true;
+
+		if (!name.empty() && name[0] == '-')
+		{
+			enabled = false;
+			name.erase(0, 1);
+		}
+
+		if (name == "none")
+			set_enabled("all", false);
+		else if (!name.empty() && !set_enabled(name, enabled))
+			return false;
+
+		start = end + 1;
+	}
+
+	return true;
+}
+
+uint8_t BiosHle::read8(uint32_t addr)
+{
+	return bus->read<uint8_t>(addr);
+}
+
+uint32_t BiosHle::read32(uint32_t addr)
+{
+	return bus->read<uint32_t>(addr);
+}
+
+void BiosHle::write8(uint32_t addr, uint8_t data)
+{
+	bus->write<uint8_t>(addr, data);
+}
+
+void BiosHle::write32(uint32_t addr, uint32_t data)
+{
+	bus->write<uint32_t>(addr, data);
+}
+
+std::string BiosHle::read_string(uint32_t addr, size_t max)
+{
+	std::string str;
+
+	for (uint8_t c; str.size() < max && (c = read8(addr + str.size())) != 0;)
+		str.push_back(c);
+
+	return str;
+}
+
+// Forward, byte by byte as the BIOS does, which matters when the ranges
+// overlap with dst above src
+void BiosHle::copy(uint32_t dst, uint32_t src, uint32_t len)
+{
+	uint8_t* host_dst = bus->get_host_pointer(dst, len);
+	uint8_t* host_src = bus->get_host_pointer(src, len);
+
+	if (host_dst && host_src && (host_dst <= host_src || host_dst >= host_src + len))
+	{
+		std::memmove(host_dst, host_src, len);
+		return;
+	}
+
+	for (uint32_t i = 0; i < len; i++)
+		write8(dst + i, read8(src + i));
+}
+
+void BiosHle::fill(uint32_t dst, uint8_t value, uint32_t len)
+{
+	if (uint8_t* host = bus->get_host_pointer(dst, len))
+	{
+		std::memset(host, value, len);
+		return;
+	}
+
+	for (uint32_t i = 0; i < len; i++)
+		write8(dst + i, value);
+}
+
+// mem
+
+bool BiosHle::fn_bcopy(uint32_t* regs)
+{
+	if ((int32_t)regs[A2] > 0)
+		copy(regs[A1], regs[A0], regs[A2]);
+	return true;
+}
+
+bool BiosHle::fn_bzero(uint32_t* regs)
+{
+	uint32_t dst = regs[A0];
+	int32_t len = regs[A1];
+
+	if (!dst || len <= 0)
+	{
+		regs[V0] = 0;
+		return true;
+	}
+
+	fill(dst, 0, len);
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_bcmp(uint32_t* regs)
+{
+	return fn_memcmp(regs);
+}
+
+bool BiosHle::fn_memcpy(uint32_t* regs)
+{
+	uint32_t dst = regs[A0];
+	int32_t len = regs[A2];
+
+	if (dst && len > 0)
+		copy(dst, regs[A1], len);
+
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_memset(uint32_t* regs)
+{
+	uint32_t dst = regs[A0];
+	int32_t len = regs[A2];
+
+	if (dst && len > 0)
+		fill(dst, regs[A1], len);
+
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_memmove(uint32_t* regs)
+{
+	uint32_t dst = regs[A0], src = regs[A1];
+	int32_t len = regs[A2];
+
+	if (dst && len > 0)
+	{
+		uint8_t* host_dst = bus->get_host_pointer(dst, len);
+		uint8_t* host_src = bus->get_host_pointer(src, len);
+
+		if (host_dst && host_src)
+			std::memmove(host_dst, host_src, len);
+		else
+			bus->move(dst, src, len);
+	}
+
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_memcmp(uint32_t* regs)
+{
+	uint32_t a = regs[A0], b = regs[A1];
+	int32_t len = regs[A2];
+
+	regs[V0] = 0;
+
+	for (int32_t i = 0; i < len; i++)
+	{
+		int diff = read8(a + i) - read8(b + i);
+
+		if (diff)
+		{
+			regs[V0] = diff;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_memchr(uint32_t* regs)
+{
+	uint32_t src = regs[A0];
+	uint8_t value = regs[A1];
+	int32_t len = regs[A2];
+
+	regs[V0] = 0;
+
+	for (int32_t i = 0; src && i < len; i++)
+	{
+		if (read8(src + i) == value)
+		{
+			regs[V0] = src + i;
+			break;
+		}
+	}
+
+	return true;
+}
+
+// str
+
+bool BiosHle::fn_strcat(uint32_t* regs)
+{
+	uint32_t dst = regs[A0], src = regs[A1];
+
+	if (dst && src)
+	{
+		uint32_t end = dst;
+		while (read8(end))
+			end++;
+
+		uint8_t c;
+		do
+		{
+			c = read8(src++);
+			write8(end++, c);
+		} while (c);
+	}
+
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_strcmp(uint32_t* regs)
+{
+	uint32_t a = regs[A0], b = regs[A1];
+
+	// NULL sorts before any string
+	if (!a || !b)
+	{
+		regs[V0] = a == b ? 0 : (a ? 1 : -1);
+		return true;
+	}
+
+	for (;; a++, b++)
+	{
+		uint8_t ca = read8(a), cb = read8(b);
+
+		if (ca != cb || !ca)
+		{
+			regs[V0] = ca - cb;
+			return true;
+		}
+	}
+}
+
+bool BiosHle::fn_strncmp(uint32_t* regs)
+{
+	uint32_t a = regs[A0], b = regs[A1];
+	int32_t len = regs[A2];
+
+	if (!a || !b)
+	{
+		regs[V0] = a == b ? 0 : (a ? 1 : -1);
+		return true;
+	}
+
+	regs[V0] = 0;
+
+	for (int32_t i = 0; i < len; i++)
+	{
+		uint8_t ca = read8(a + i), cb = read8(b + i);
+
+		if (ca != cb || !ca)
+		{
+			regs[V0] = ca - cb;
+			break;
+		}
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_strcpy(uint32_t* regs)
+{
+	uint32_t dst = regs[A0], src = regs[A1];
+
+	if (!dst || !src)
+	{
+		regs[V0] = 0;
+		return true;
+	}
+
+	uint8_t c;
+	for (uint32_t i = 0; (c = read8(src + i), write8(dst + i, c), c); i++);
+
+	regs[V0] = dst;
+	return true;
+}
+
+bool BiosHle::fn_strlen(uint32_t* regs)
+{
+	uint32_t src = regs[A0];
+	uint32_t len = 0;
+
+	if (src)
+	{
+		while (read8(src + len))
+			len++;
+	}
+
+	regs[V0] = len;
+	return true;
+}
+
+bool BiosHle::fn_strchr(uint32_t* regs)
+{
+	uint32_t src = regs[A0];
+	uint8_t value = regs[A1];
+
+	regs[V0] = 0;
+
+	for (uint8_t c; src; src++)
+	{
+		c = read8(src);
+
+		if (c == value)
+		{
+			regs[V0] = src;
+			break;
+		}
+		if (!c)
+			break;
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_strrchr(uint32_t* regs)
+{
+	uint32_t src = regs[A0];
+	uint8_t value = regs[A1];
+
+	regs[V0] = 0;
+
+	for (uint8_t c; src; src++)
+	{
+		c = read8(src);
+
+		if (c == value)
+			regs[V0] = src;
+		if (!c)
+			break;
+	}
+
+	return true;
+}
+
+// heap
+//
+// First fit over blocks laid out back to back from heap_start, each with a
+// one word header: block size in bytes (header included) with bit 0 set when
+// in use. Free neighbours are merged as the list is walked.
+
+bool BiosHle::fn_init_heap(uint32_t* regs)
+{
+	heap_start = (regs[A0] + 3) & ~3;
+	heap_end = (regs[A0] + regs[A1]) & ~3;
+
+	if (heap_end > heap_start + 4)
+		write32(heap_start, heap_end - heap_start);
+	else
+		heap_start = heap_end = 0;
+
+	return true;
+}
+
+uint32_t BiosHle::heap_alloc(uint32_t size)
+{
+	if (!heap_start || size > heap_end - heap_start)
+		return 0;
+
+	uint32_t need = ((size + 3) & ~3) + 4;
+
+	for (uint32_t block = heap_start; block < heap_end;)
+	{
+		uint32_t header = read32(block);
+		uint32_t block_size = header & ~3;
+
+		if (!block_size)
+			break;
+
+		if (header & 1)
+		{
+			block += block_size;
+			continue;
+		}
+
+		for (uint32_t next = block + block_size; next < heap_end; next = block + block_size)
+		{
+			uint32_t next_header = read32(next);
+			if (next_header & 1 || !(next_header & ~3))
+				break;
+
+			block_size += next_header & ~3;
+		}
+
+		if (block_size >= need)
+		{
+			if (block_size - need >= 8)
+			{
+				write32(block + need, block_size - need);
+				block_size = need;
+			}
+
+			write32(block, block_size | 1);
+			return block + 4;
+		}
+
+		write32(block, block_size);
+		block += block_size;
+	}
+
+	return 0;
+}
+
+void BiosHle::heap_free(uint32_t ptr)
+{
+	if (ptr < heap_start + 4 || ptr >= heap_end)
+		return;
+
+	write32(ptr - 4, read32(ptr - 4) & ~1);
+}
+
+bool BiosHle::fn_malloc(uint32_t* regs)
+{
+	regs[V0] = heap_alloc(regs[A0]);
+	return true;
+}
+
+bool BiosHle::fn_free(uint32_t* regs)
+{
+	heap_free(regs[A0]);
+	return true;
+}
+
+bool BiosHle::fn_calloc(uint32_t* regs)
+{
+	uint64_t size = (uint64_t)regs[A0] * regs[A1];
+	uint32_t ptr = size <= UINT32_MAX ? heap_alloc(size) : 0;
+
+	if (ptr)
+		fill(ptr, 0, size);
+
+	regs[V0] = ptr;
+	return true;
+}
+
+bool BiosHle::fn_realloc(uint32_t* regs)
+{
+	uint32_t old_ptr = regs[A0];
+	uint32_t size = regs[A1];
+
+	if (!old_ptr)
+	{
+		regs[V0] = heap_alloc(size);
+		return true;
+	}
+
+	if (!size)
+	{
+		heap_free(old_ptr);
+		regs[V0] = 0;
+		return true;
+	}
+
+	uint32_t ptr = heap_alloc(size);
+
+	if (ptr)
+	{
+		uint32_t old_size = (read32(old_ptr - 4) & ~3) - 4;
+		copy(ptr, old_ptr, std::min(old_size, size));
+		heap_free(old_ptr);
+	}
+
+	regs[V0] = ptr;
+	return true;
+}
+
+// event
+//
+// Operates directly on the kernel's EvCB table (pointer at 0x120, size in
+// bytes at 0x124), so events opened here are delivered by the BIOS's own
+// interrupt handlers and vice versa.
+
+static constexpr uint32_t EVCB_SIZE = 0x1C;
+static constexpr uint32_t EVENT_HANDLE = 0xF1000000;
+
+enum EventStatus : uint32_t
+{
+	EventFree = 0x0000,
+	EventDisabled = 0x1000,
+	EventBusy = 0x2000,
+	EventReady = 0x4000,
+};
+
+// Address of the control block for a handle, 0 if it isn't valid
+uint32_t BiosHle::evcb(uint32_t event)
+{
+	uint32_t table = read32(0x120);
+	uint32_t count = read32(0x124) / EVCB_SIZE;
+	uint32_t index = event - EVENT_HANDLE;
+
+	if ((event & 0xFFFF0000) != EVENT_HANDLE || index >= count)
+		return 0;
+
+	return table + index * EVCB_SIZE;
+}
+
+bool BiosHle::fn_open_event(uint32_t* regs)
+{
+	uint32_t table = read32(0x120);
+	uint32_t count = read32(0x124) / EVCB_SIZE;
+
+	regs[V0] = 0xFFFFFFFF;
+
+	for (uint32_t index = 0; index < count; index++)
+	{
+		uint32_t ev = table + index * EVCB_SIZE;
+
+		if (read32(ev + 4) != EventFree)
+			continue;
+
+		write32(ev + 0x00, regs[A0]);		// class
+		write32(ev + 0x04, EventDisabled);
+		write32(ev + 0x08, regs[A1]);		// spec
+		write32(ev + 0x0C, regs[A2]);		// mode
+		write32(ev + 0x10, regs[A3]);		// handler
+
+		regs[V0] = EVENT_HANDLE | index;
+		break;
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_close_event(uint32_t* regs)
+{
+	uint32_t ev = evcb(regs[A0]);
+
+	if (ev)
+		write32(ev + 4, EventFree);
+
+	regs[V0] = 1;
+	return true;
+}
+
+bool BiosHle::fn_wait_event(uint32_t* regs)
+{
+	uint32_t ev = evcb(regs[A0]);
+	uint32_t status = ev ? read32(ev + 4) : EventFree;
+
+	switch (status)
+	{
+	case EventReady:
+		write32(ev + 4, EventBusy);
+		regs[V0] = 1;
+		return true;
+	case EventBusy:
+		// Has to wait for an interrupt; leave that to the BIOS
+		return false;
+	default:
+		regs[V0] = 0;
+		return true;
+	}
+}
+
+bool BiosHle::fn_test_event(uint32_t* regs)
+{
+	uint32_t ev = evcb(regs[A0]);
+
+	regs[V0] = 0;
+
+	if (ev && read32(ev + 4) == EventReady)
+	{
+		write32(ev + 4, EventBusy);
+		regs[V0] = 1;
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_enable_event(uint32_t* regs)
+{
+	uint32_t ev = evcb(regs[A0]);
+
+	if (ev && read32(ev + 4) != EventFree)
+		write32(ev + 4, EventBusy);
+
+	regs[V0] = 1;
+	return true;
+}
+
+bool BiosHle::fn_disable_event(uint32_t* regs)
+{
+	uint32_t ev = evcb(regs[A0]);
+
+	if (ev && read32(ev + 4) != EventFree)
+		write32(ev + 4, EventDisabled);
+
+	regs[V0] = 1;
+	return true;
+}
+
+// pad
+//
+// Replaces the BIOS pad driver: rather than talking to the controllers over
+// SIO from the VBlank handler, vblank() writes the state set through
+// set_pad() into the buffers.
+
+bool BiosHle::fn_init_pad(uint32_t* regs)
+{
+	pad_buf[0] = regs[A0];
+	pad_size[0] = regs[A1];
+	pad_buf[1] = regs[A2];
+	pad_size[1] = regs[A3];
+
+	for (int port = 0; port < 2; port++)
+	{
+		if (pad_buf[port] && pad_size[port])
+			fill(pad_buf[port], 0xFF, pad_size[port]);
+	}
+
+	regs[V0] = 2;
+	return true;
+}
+
+bool BiosHle::fn_start_pad(uint32_t* regs)
+{
+	pad_started = true;
+
+	bus->I_MASK |= 1;
+	bus->update_irq();
+
+	regs[V0] = 1;
+	return true;
+}
+
+bool BiosHle::fn_stop_pad(uint32_t* regs)
+{
+	pad_started = false;
+	regs[V0] = 1;
+	return true;
+}
+
+void BiosHle::set_pad(int port, bool connected, uint16_t buttons)
+{
+	pads[port].connected = connected;
+	pads[port].buttons = buttons;
+}
+
+void BiosHle::vblank()
+{
+	if (!pad_started)
+		return;
+
+	for (int port = 0; port < 2; port++)
+	{
+		if (!pad_buf[port] || pad_size[port] < 4)
+			continue;
+
+		// Status, ID (digital pad), then the buttons active low
+		uint16_t buttons = ~pads[port].buttons;
+
+		write8(pad_buf[port] + 0, pads[port].connected ? 0x00 : 0xFF);
+		write8(pad_buf[port] + 1, 0x41);
+		write8(pad_buf[port] + 2, buttons & 0xFF);
+		write8(pad_buf[port] + 3, buttons >> 8);
+	}
+}
+
+// file
+//
+// Read-only access to files on the disc, served straight from the image.
+// Other devices (memory cards) are left to the BIOS.
+
+Iso9660* BiosHle::get_iso()
+{
+	CdImage* disc = bus->get_cdvd()->get_disc();
+
+	if (disc != iso_disc)
+	{
+		iso_disc = disc;
+		iso.reset(disc ? new Iso9660(disc) : nullptr);
+
+		// Anything open was on the old disc
+		for (auto& file : files)
+			file.used = false;
+	}
+
+	return iso.get();
+}
+
+BiosHle::OpenFile* BiosHle::get_file(uint32_t fd)
+{
+	if (fd < FD_BASE || fd >= FD_BASE + MAX_FILES || !files[fd - FD_BASE].used)
+		return nullptr;
+
+	return &files[fd - FD_BASE];
+}
+
+bool BiosHle::fn_open(uint32_t* regs)
+{
+	std::string path = read_string(regs[A0]);
+
+	if (path.compare(0, 6, "cdrom:") != 0)
+		return false;
+
+	regs[V0] = 0xFFFFFFFF;
+
+	Iso9660* disc = get_iso();
+	Iso9660::File found;
+
+	if (!disc || !disc->find(path, found))
+		return true;
+
+	for (uint32_t slot = 0; slot < MAX_FILES; slot++)
+	{
+		if (files[slot].used)
+			continue;
+
+		files[slot] = {true, found.lba, found.size, 0};
+		regs[V0] = FD_BASE + slot;
+		break;
+	}
+
+	return true;
+}
+
+bool BiosHle::fn_lseek(uint32_t* regs)
+{
+	OpenFile* file = get_file(regs[A0]);
+
+	if (!file)
+		return false;
+
+	int32_t offset = regs[A1];
+
+	switch (regs[A2])
+	{
+	case 0:
+		file->pos = offset;
+		break;
+	case 1:
+		file->pos += offset;
+		break;
+	default:
+		regs[V0] = 0xFFFFFFFF;
+		return true;
+	}
+
+	regs[V0] = file->pos;
+	return true;
+}
+
+bool BiosHle::fn_read(uint32_t* regs)
+{
+	OpenFile* file = get_file(regs[A0]);
+
+	if (!file)
+		return false;
+
+	uint32_t dst = regs[A1];
+	int32_t len = regs[A2];
+	Iso9660* disc = get_iso();
+
+	if (len <= 0 || !disc)
+	{
+		regs[V0] = len < 0 ? 0xFFFFFFFF : 0;
+		return true;
+	}
+
+	Iso9660::File f = {file->lba, file->size};
+	uint32_t done;
+
+	if (uint8_t* host = bus->get_host_pointer(dst, len))
+	{
+		done = disc->read(f, file->pos, host, len);
+	}
+	else
+	{
+		// A piece at a time, the length is the guest's to choose
+		uint8_t buf[2048];
+		done = 0;
+
+		while (done < (uint32_t)len)
+		{
+			uint32_t want = std::min<uint32_t>(len - done, sizeof(buf));
+			uint32_t got = disc->read(f, file->pos + done, buf, want);
+
+			for (uint32_t i = 0; i < got; i++)
+				write8(dst + done + i, buf[i]);
+
+			done += got;
+
+			if (got < want)
+				break;
+		}
+	}
+
+	file->pos += done;
+	regs[V0] = done;
+	return true;
+}
+
+bool BiosHle::fn_close(uint32_t* regs)
+{
+	OpenFile* file = get_file(regs[A0]);
+
+	if (!file)
+		return false;
+
+	file->used = false;
+	regs[V0] = regs[A0];
+	return true;
+}
+
+void BiosHle::do_state(StateStream& s)
+{
+	s.section("HLE ", 1);
+
+	s.value(files);
+	s.value(heap_start);
+	s.value(heap_end);
+	s.value(pads);
+	s.value(pad_buf);
+	s.value(pad_size);
+	s.value(pad_started);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <util/state.h>
+
+class Bus;
+class CdImage;
+class Iso9660;
+
+// High-level emulation of BIOS kernel calls. Calls through the A0/B0/C0
+// vectors land here before any BIOS code runs; functions that are enabled
+// and can complete natively do so and return straight to the caller, the
+// rest fall through to the real BIOS.
+//
+// Functions are grouped ("mem", "str", "heap", "event", "file", "pad") and
+// can be toggled per function or per group. Most kernel-visible state stays
+// where the BIOS keeps it (events in the kernel's EvCB table), so enabled and
+// disabled functions can be mixed. The heap's bounds and the open file
+// handles are only known here, so "heap" and "file" can only be toggled as
+// whole groups.
+class BiosHle
+{
+private:
+	using Handler = bool (BiosHle::*)(uint32_t* regs);
+
+	struct Function
+	{
+		uint32_t vector;	// 0xA0, 0xB0 or 0xC0
+		uint8_t number;		// t1
+		const char* name;
+		const char* group;
+		Handler handler;
+	};
+
+	static const Function functions[];
+	static const size_t function_count;
+
+	struct Entry
+	{
+		Handler handler = nullptr;
+		bool enabled = false;
+	};
+
+	Entry entries[3][0x100];
+
+	// HLE file handles start above the BIOS's own 16, so a handle opened
+	// by the BIOS (e.g. on a memory card) still goes to the BIOS
+	static constexpr uint32_t MAX_FILES = 16;
+	static constexpr uint32_t FD_BASE = 16;
+
+	struct OpenFile
+	{
+		bool used;
+		uint32_t lba;
+		uint32_t size;
+		uint32_t pos;
+	} files[MAX_FILES] = {};
+
+	CdImage* iso_disc = nullptr;
+	std::unique_ptr<Iso9660> iso;
+
+	uint32_t heap_start = 0, heap_end = 0;
+
+	struct PadPort
+	{
+		bool connected;
+		uint16_t buttons;	// Active high, bit order as on the wire
+	} pads[2] = {};
+
+	uint32_t pad_buf[2] = {}, pad_size[2] = {};
+	bool pad_started = false;
+
+	Bus* bus;
+
+	// Emulated memory access
+	uint8_t read8(uint32_t addr);
+	uint32_t read32(uint32_t addr);
+	void write8(uint32_t addr, uint8_t data);
+	void write32(uint32_t addr, uint32_t data);
+	std::string read_string(uint32_t addr, size_t max = 256);
+	void copy(uint32_t dst, uint32_t src, uint32_t len);
+	void fill(uint32_t dst, uint8_t value, uint32_t len);
+
+	Iso9660* get_iso();
+	OpenFile* get_file(uint32_t fd);
+
+	uint32_t evcb(uint32_t event);
+
+	// mem
+	bool fn_bcopy(uint32_t* regs);
+	bool fn_bzero(uint32_t* regs);
+	bool fn_bcmp(uint32_t* regs);
+	bool fn_memcpy(uint32_t* regs);
+	bool fn_memset(uint32_t* regs);
+	bool fn_memmove(uint32_t* regs);
+	bool fn_memcmp(uint32_t* regs);
+	bool fn_memchr(uint32_t* regs);
+
+	// str
+	bool fn_strcat(uint32_t* regs);
+	bool fn_strcmp(uint32_t* regs);
+	bool fn_strncmp(uint32_t* regs);
+	bool fn_strcpy(uint32_t* regs);
+	bool fn_strlen(uint32_t* regs);
+	bool fn_strchr(uint32_t* regs);
+	bool fn_strrchr(uint32_t* regs);
+
+	// heap
+	bool fn_malloc(uint32_t* regs);
+	bool fn_free(uint32_t* regs);
+	bool fn_calloc(uint32_t* regs);
+	bool fn_realloc(uint32_t* regs);
+	bool fn_init_heap(uint32_t* regs);
+	uint32_t heap_alloc(uint32_t size);
+	void heap_free(uint32_t ptr);
+
+	// event
+	bool fn_open_event(uint32_t* regs);
+	bool fn_close_event(uint32_t* regs);
+	bool fn_wait_event(uint32_t* regs);
+	bool fn_test_event(uint32_t* regs);
+	bool fn_enable_event(uint32_t* regs);
+	bool fn_disable_event(uint32_t* regs);
+
+	// pad
+	bool fn_init_pad(uint32_t* regs);
+	bool fn_start_pad(uint32_t* regs);
+	bool fn_stop_pad(uint32_t* regs);
+
+	// file
+	bool fn_open(uint32_t* regs);
+	bool fn_lseek(uint32_t* regs);
+	bool fn_read(uint32_t* regs);
+	bool fn_close(uint32_t* regs);
+public:
+	BiosHle(Bus* bus);
+	~BiosHle();
+
+	// Runs kernel function t1 of the given vector if it is enabled and can
+	// be done natively; v0 is set and true returned if so
+	bool call(uint32_t vector, uint32_t number, uint32_t* regs);
+
+	// Comma separated function or group names, "all" or "none"; a leading
+	// '-' disables. Returns false on an unknown name, or a single function of
+	// a group that can only be toggled as a whole
+	bool configure(const std::string& spec);
+	bool set_enabled(const std::string& name, bool enabled);
+
+	// One bit per known function, set if it is enabled
+	uint64_t enabled_mask() const;
+
+	// Pad state for the HLE pad driver, written to the InitPad buffers on
+	// every VBlank once StartPad has been called
+	void set_pad(int port, bool connected, uint16_t buttons);
+	void vblank();
+
+	// Open files, heap bounds and pad driver state; which functions are
+	// enabled is configuration, not state
+	void do_state(StateStream& s);
+};
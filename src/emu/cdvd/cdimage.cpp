@@ -0,0 +1,227 @@
+#include "cdimage.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Starts every raw sector
+static const uint8_t SECTOR_SYNC[12] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+
+CdImage::CdImage(std::string path)
+{
+	fd = open(path.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		printf("[emu/CdImage]: Could not open disc image %s\n", path.c_str());
+		return;
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+
+	// A size that divides by both sector sizes says nothing, the sync
+	// pattern of the first sector does
+	uint8_t head[sizeof(SECTOR_SYNC)];
+	if (pread(fd, head, sizeof(head), 0) == sizeof(head) && !memcmp(head, SECTOR_SYNC, sizeof(SECTOR_SYNC)))
+		is_raw = true;
+	else
+		is_raw = st.st_size % ISO_SECTOR_SIZE != 0 && st.st_size % CD_SECTOR_SIZE == 0;
+	sector_count = st.st_size / (is_raw ? CD_SECTOR_SIZE : ISO_SECTOR_SIZE);
+
+	printf("[emu/CdImage]: Opened %s (%d sectors, %s)\n", path.c_str(), sector_count, is_raw ? "raw" : "iso");
+
+	open_time = std::chrono::steady_clock::now();
+	profile_path = path + ".prof";
+
+	load_profile();
+}
+
+CdImage::~CdImage()
+{
+	stop_prefetch = true;
+	if (prefetcher.joinable())
+		prefetcher.join();
+
+	if (fd < 0)
+		return;
+
+	if (!cache_lbas.empty())
+		printf("[emu/CdImage]: Warm-start cache served %zu of %zu sector reads\n", cache_hits, cache_hits + cache_misses);
+
+	save_profile();
+	close(fd);
+}
+
+bool CdImage::read_from_file(uint32_t lba, uint32_t count, uint8_t* out)
+{
+	if (is_raw)
+	{
+		size_t size = (size_t)count * CD_SECTOR_SIZE;
+		return pread(fd, out, size, (off_t)lba * CD_SECTOR_SIZE) == (ssize_t)size;
+	}
+
+	// Plain ISOs only store the user data, so read one sector at a time into
+	// the data area of a raw sector and synthesize the rest
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t* sector = out + i * CD_SECTOR_SIZE;
+
+		if (pread(fd, sector + 24, ISO_SECTOR_SIZE, (off_t)(lba + i) * ISO_SECTOR_SIZE) != ISO_SECTOR_SIZE)
+			return false;
+		fix_up_iso_sector(lba + i, sector);
+	}
+
+	return true;
+}
+
+static uint8_t to_bcd(uint8_t value)
+{
+	return ((value / 10) << 4) | (value % 10);
+}
+
+void CdImage::fix_up_iso_sector(uint32_t lba, uint8_t* sector)
+{
+	uint32_t pos = lba + 150;
+
+	std::memcpy(sector, SECTOR_SYNC, sizeof(SECTOR_SYNC));
+	sector[12] = to_bcd(pos / (60 * 75));
+	sector[13] = to_bcd((pos / 75) % 60);
+	sector[14] = to_bcd(pos % 75);
+	sector[15] = 2;	// Mode 2
+
+	// Form 1 subheader, duplicated
+	std::memset(sector + 16, 0, 8);
+	sector[18] = sector[22] = 0x08;
+
+	std::memset(sector + 24 + ISO_SECTOR_SIZE, 0, CD_SECTOR_SIZE - 24 - ISO_SECTOR_SIZE);
+}
+
+bool CdImage::read_sector(uint32_t lba, uint8_t* out)
+{
+	if (lba >= sector_count)
+		return false;
+
+	if (profiling && profile.size() < MAX_PROFILE_ENTRIES)
+	{
+		auto elapsed = std::chrono::steady_clock::now() - open_time;
+		profile.push_back({lba, (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()});
+	}
+
+	if (!cache_slots.empty())
+	{
+		auto it = cache_slots.find(lba);
+
+		if (it != cache_slots.end() && cache_ready[it->second].load(std::memory_order_acquire))
+		{
+			std::memcpy(out, &cache[(size_t)it->second * CD_SECTOR_SIZE], CD_SECTOR_SIZE);
+			cache_hits++;
+			return true;
+		}
+
+		cache_misses++;
+	}
+
+	return read_from_file(lba, 1, out);
+}
+
+void CdImage::load_profile()
+{
+	std::ifstream file(profile_path, std::ios::binary);
+
+	if (!file.is_open())
+		return;
+
+	char magic[8];
+	uint32_t count = 0;
+
+	file.read(magic, sizeof(magic));
+	file.read((char*)&count, sizeof(count));
+
+	if (!file || std::memcmp(magic, PROFILE_MAGIC, sizeof(magic)) || count > MAX_PROFILE_ENTRIES)
+	{
+		printf("[emu/CdImage]: Ignoring invalid profile %s\n", profile_path.c_str());
+		return;
+	}
+
+	std::vector<ProfileEntry> entries(count);
+	file.read((char*)entries.data(), count * sizeof(ProfileEntry));
+	entries.resize(file.gcount() / sizeof(ProfileEntry));
+
+	// Keep the first touch of every sector; that's the order the game wants them in
+	for (auto& entry : entries)
+	{
+		if (entry.lba >= sector_count || cache_slots.count(entry.lba))
+			continue;
+
+		cache_slots[entry.lba] = cache_lbas.size();
+		cache_lbas.push_back(entry.lba);
+	}
+
+	if (cache_lbas.empty())
+		return;
+
+	cache = std::make_unique<uint8_t[]>(cache_lbas.size() * CD_SECTOR_SIZE);
+	cache_ready = std::make_unique<std::atomic<bool>[]>(cache_lbas.size());
+
+	printf("[emu/CdImage]: Prefetching %zu sectors from %s\n", cache_lbas.size(), profile_path.c_str());
+
+	prefetcher = std::thread(&CdImage::prefetch, this);
+}
+
+void CdImage::save_profile()
+{
+	if (profile.empty())
+		return;
+
+	// Written under a temporary name and renamed, so a crash mid-write
+	// can't leave a truncated profile behind
+	std::string tmp = profile_path + "." + std::to_string(getpid());
+	std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open())
+	{
+		printf("[emu/CdImage]: Could not write profile %s\n", profile_path.c_str());
+		return;
+	}
+
+	uint32_t count = profile.size();
+
+	file.write(PROFILE_MAGIC, sizeof(PROFILE_MAGIC));
+	file.write((const char*)&count, sizeof(count));
+	file.write((const char*)profile.data(), count * sizeof(ProfileEntry));
+	file.close();
+
+	if (!file || rename(tmp.c_str(), profile_path.c_str()))
+	{
+		printf("[emu/CdImage]: Could not write profile %s\n", profile_path.c_str());
+		remove(tmp.c_str());
+	}
+}
+
+void CdImage::prefetch()
+{
+	constexpr uint32_t MAX_RUN = 64;
+
+	uint32_t slot = 0;
+
+	while (slot < cache_lbas.size() && !stop_prefetch)
+	{
+		// Sequential runs land in consecutive slots, so they can be read
+		// straight into the cache with a single pread
+		uint32_t run = 1;
+		while (slot + run < cache_lbas.size() && run < MAX_RUN
+			&& cache_lbas[slot + run] == cache_lbas[slot] + run)
+			run++;
+
+		if (!read_from_file(cache_lbas[slot], run, &cache[(size_t)slot * CD_SECTOR_SIZE]))
+			break;
+
+		for (uint32_t i = 0; i < run; i++)
+			cache_ready[slot + i].store(true, std::memory_order_release);
+
+		slot += run;
+	}
+}
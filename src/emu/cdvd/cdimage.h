@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <chrono>
+
+constexpr uint32_t CD_SECTOR_SIZE = 2352;
+constexpr uint32_t ISO_SECTOR_SIZE = 2048;
+
+// Disc image backed by a raw .bin (2352 byte sectors) or a plain .iso
+// (2048 byte sectors).
+//
+// Every sector read is recorded to "<image>.prof" when the image is closed.
+// If such a profile already exists on open, the sectors it lists are
+// prefetched into memory on a background thread, in the order the previous
+// session first touched them, so later reads are served from RAM.
+class CdImage
+{
+private:
+	struct ProfileEntry
+	{
+		uint32_t lba;
+		uint32_t time_ms;	// Time since the image was opened
+	};
+
+	static constexpr char PROFILE_MAGIC[8] = {'P', 'S', 'X', 'P', 'R', 'O', 'F', '1'};
+	static constexpr size_t MAX_PROFILE_ENTRIES = 1 << 18;
+
+	int fd = -1;
+	bool is_raw = true;
+	uint32_t sector_count = 0;
+
+	std::string profile_path;
+	std::vector<ProfileEntry> profile;
+	bool profiling = true;
+	std::chrono::steady_clock::time_point open_time;
+
+	// Warm-start cache, laid out in slot order and filled by the prefetcher.
+	// The LBA -> slot map is built before the thread starts and never modified
+	// afterwards, so lookups don't need a lock
+	std::unordered_map<uint32_t, uint32_t> cache_slots;
+	std::vector<uint32_t> cache_lbas;
+	std::unique_ptr<uint8_t[]> cache;
+	std::unique_ptr<std::atomic<bool>[]> cache_ready;
+	std::atomic<bool> stop_prefetch = false;
+	std::thread prefetcher;
+
+	size_t cache_hits = 0, cache_misses = 0;
+
+	bool read_from_file(uint32_t lba, uint32_t count, uint8_t* out);
+	void fix_up_iso_sector(uint32_t lba, uint8_t* sector);
+
+	void load_profile();
+	void save_profile();
+	void prefetch();
+public:
+	CdImage(std::string path);
+	~CdImage();
+
+	bool is_open() const {return fd >= 0;}
+	uint32_t get_sector_count() const {return sector_count;}
+
+	// Reads a full 2352 byte raw sector. Returns false past the end of the disc
+	bool read_sector(uint32_t lba, uint8_t* out);
+
+	// Reads made while off don't go into the access profile
+	void set_profiling(bool on) {profiling = on;}
+};
@@ -1,5 +1,61 @@
 #include "cdvd.h"
 #include <emu/memory/Bus.h>
+#include <emu/scheduler/scheduler.h>
+#include <algorithm>
+
+CDVD::CDVD(Bus* bus)
+: bus(bus)
+{
+	auto scheduler = bus->get_scheduler();
+
+	scheduler->set_callback(Event::CdromCommand, [this]()
+	{
+		execute_command(pending_command);
+	});
+	scheduler->set_callback(Event::CdromSecondResponse, [this]()
+	{
+		queue_response(second_response);
+	});
+	scheduler->set_callback(Event::CdromIrq, [this]()
+	{
+		deliver_response();
+	});
+	scheduler->set_callback(Event::CdromRead, [this]()
+	{
+		read_sector();
+	});
+}
+
+void CDVD::insert_disc(std::string path)
+{
+	eject_disc();
+
+	disc = new CdImage(path);
+
+	if (!disc->is_open())
+	{
+		eject_disc();
+		return;
+	}
+
+	stat_code.shell_open = false;
+}
+
+void CDVD::eject_disc()
+{
+	// Any read in flight has nothing left to read from
+	bus->get_scheduler()->cancel(Event::CdromRead);
+	stat_code.set_state(CdromReadState::Stopped);
+
+	delete disc;
+	disc = nullptr;
+	stat_code.shell_open = true;
+}
+
+static uint8_t from_bcd(uint8_t value)
+{
+	return (value >> 4) * 10 + (value & 0xf);
+}
 
 void CDVD::write_reg2(uint8_t data)
 {
@@ -7,13 +63,14 @@ void CDVD::write_reg2(uint8_t data)
 	{
 	case 0:
 	{
-		param_fifo.push_back(data);
+		param_fifo.push(data);
 		cdrom_status.param_fifo_empty = false;
-		cdrom_status.param_fifo_write_ready = (param_fifo.size() < 16);
+		cdrom_status.param_fifo_write_ready = !param_fifo.full();
 		break;
 	}
 	case 1:
 		reg_int_enabled = data;
+		update_irq();
 		break;
 	default:
 		printf("[emu/CDVD]: Write to unknown address 0x1f801802.%d\n", cdrom_status.index);
@@ -23,18 +80,86 @@ void CDVD::write_reg2(uint8_t data)
 
 void CDVD::execute_command(uint8_t cmd)
 {
-	irq_fifo.clear();
-	resp_fifo.clear();
+	cdrom_status.transmit_busy = false;
 
 	switch (cmd)
 	{
 	case 0x01:
 		push_response(FirstInt3, {stat_code.byte});
 		break;
+	case 0x02:
+	{
+		if (param_fifo.size() != 3)
+		{
+			push_response(ErrorInt5, {(uint8_t)(stat_code.byte | 1), 0x20});
+			break;
+		}
+
+		uint8_t mm = from_bcd(param_fifo.pop());
+		uint8_t ss = from_bcd(param_fifo.pop());
+		uint8_t ff = from_bcd(param_fifo.pop());
+
+		seek_lba = (mm * 60 + ss) * 75 + ff - 150;
+		push_response(FirstInt3, {stat_code.byte});
+		break;
+	}
+	case 0x06:
+	case 0x1B:
+		if (!disc)
+		{
+			push_response(ErrorInt5, {(uint8_t)(stat_code.byte | 1), 0x80});
+			break;
+		}
+
+		read_lba = seek_lba;
+		stat_code.set_state(CdromReadState::Reading);
+		push_response(FirstInt3, {stat_code.byte});
+		bus->get_scheduler()->schedule(Event::CdromRead, (mode & 0x80) ? READ_DELAY / 2 : READ_DELAY);
+		break;
+	case 0x08:
+	case 0x09:
+		bus->get_scheduler()->cancel(Event::CdromRead);
+		push_response(FirstInt3, {stat_code.byte});
+		stat_code.set_state(CdromReadState::Stopped);
+		if (cmd == 0x08)
+			stat_code.spindle_motor_on = false;
+		schedule_second_response(SecondInt2, {stat_code.byte}, SEEK_DELAY);
+		break;
+	case 0x0A:
+		bus->get_scheduler()->cancel(Event::CdromRead);
+		mode = 0;
+		stat_code.set_state(CdromReadState::Stopped);
+		push_response(FirstInt3, {stat_code.byte});
+		schedule_second_response(SecondInt2, {stat_code.byte}, 0x13cce);
+		break;
+	case 0x0E:
+		if (param_fifo.size() != 1)
+		{
+			push_response(ErrorInt5, {(uint8_t)(stat_code.byte | 1), 0x20});
+			break;
+		}
+
+		mode = param_fifo.pop();
+		push_response(FirstInt3, {stat_code.byte});
+		break;
+	case 0x15:
+	case 0x16:
+		bus->get_scheduler()->cancel(Event::CdromRead);
+		stat_code.set_state(CdromReadState::Seeking);
+		push_response(FirstInt3, {stat_code.byte});
+		read_lba = seek_lba;
+		stat_code.set_state(CdromReadState::Stopped);
+		schedule_second_response(SecondInt2, {stat_code.byte}, SEEK_DELAY);
+		break;
 	case 0x19:
 	{
-		const auto subfunc = param_fifo.front();
-		param_fifo.pop_front();
+		if (param_fifo.empty())
+		{
+			push_response(ErrorInt5, {(uint8_t)(stat_code.byte | 1), 0x20});
+			break;
+		}
+
+		const auto subfunc = param_fifo.pop();
 
 		switch (subfunc)
 		{
@@ -47,24 +172,121 @@ void CDVD::execute_command(uint8_t cmd)
 		}
 		break;
 	}
+	case 0x1A:
+		push_response(FirstInt3, {stat_code.byte});
+		if (stat_code.shell_open)
+			schedule_second_response(ErrorInt5, {0x08, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, 0x4a00);
+		else
+			schedule_second_response(SecondInt2, {0x02, 0x00, 0x20, 0x00, 'S', 'C', 'E', 'A'}, 0x4a00);
+		break;
 	default:
 		printf("[emu/CDVD]: Unknown command 0x%x\n", cmd);
 		exit(1);
 	}
+
+	param_fifo.clear();
+	cdrom_status.param_fifo_empty = true;
+	cdrom_status.param_fifo_write_ready = true;
 }
 
-void CDVD::push_response(CdromResponseType type, std::initializer_list<uint8_t> bytes)
+CDVD::CdromResponse CDVD::make_response(CdromResponseType type, std::initializer_list<uint8_t> bytes)
 {
-	irq_fifo.push_back(type);
+	CdromResponse response = {};
+	response.type = type;
 
 	for (auto response_byte : bytes)
 	{
-		if (resp_fifo.size() < 16)
-		{
-			resp_fifo.push_back(response_byte);
-			cdrom_status.response_fifo_not_empty = true;
-		}
+		if (response.size < sizeof(response.bytes))
+			response.bytes[response.size++] = response_byte;
+	}
+
+	return response;
+}
+
+void CDVD::schedule_second_response(CdromResponseType type, std::initializer_list<uint8_t> bytes, uint64_t delay)
+{
+	second_response = make_response(type, bytes);
+	bus->get_scheduler()->schedule(Event::CdromSecondResponse, delay);
+}
+
+void CDVD::push_response(CdromResponseType type, std::initializer_list<uint8_t> bytes)
+{
+	queue_response(make_response(type, bytes));
+}
+
+void CDVD::queue_response(const CdromResponse& response)
+{
+	if (!irq_fifo.push(response))
+	{
+		printf("[emu/CDVD]: Response queue overflow, dropping INT%d\n", response.type);
+		return;
+	}
+
+	// Only one interrupt can be raised at a time; anything else waits for the ack
+	if (!irq_flags)
+		deliver_response();
+}
+
+void CDVD::deliver_response()
+{
+	if (irq_flags || irq_fifo.empty())
+		return;
+
+	const auto response = irq_fifo.pop();
+
+	resp_fifo.clear();
+	for (int i = 0; i < response.size; i++)
+		resp_fifo.push(response.bytes[i]);
+	cdrom_status.response_fifo_not_empty = !resp_fifo.empty();
+
+	irq_flags = response.type;
+	update_irq();
+}
+
+void CDVD::read_sector()
+{
+	if (!disc || !disc->read_sector(read_lba, sector_buffer))
+	{
+		stat_code.set_state(CdromReadState::Stopped);
+		push_response(ErrorInt5, {(uint8_t)(stat_code.byte | 1), 0x04});
+		return;
+	}
+
+	read_lba++;
+	push_response(SecondInt1, {stat_code.byte});
+
+	bus->get_scheduler()->schedule(Event::CdromRead, (mode & 0x80) ? READ_DELAY / 2 : READ_DELAY);
+}
+
+void CDVD::load_data_fifo()
+{
+	// Mode bit 5 selects whole sectors (minus sync) over the 0x800 byte data area
+	uint32_t offset = (mode & 0x20) ? 12 : 24;
+	data_size = (mode & 0x20) ? 0x924 : 0x800;
+	data_pos = 0;
+
+	std::copy(sector_buffer + offset, sector_buffer + offset + data_size, data_buffer);
+	cdrom_status.data_fifo_not_empty = true;
+}
+
+uint32_t CDVD::read_data_word()
+{
+	uint32_t word = 0;
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (data_pos < data_size)
+			word |= data_buffer[data_pos++] << (i * 8);
 	}
+
+	cdrom_status.data_fifo_not_empty = data_pos < data_size;
+	return word;
+}
+
+void CDVD::update_irq()
+{
+	if (irq_flags & reg_int_enabled & 0b11111)
+		bus->TriggerInterrupt(2);
 }
 
 void CDVD::write_reg1(uint8_t data)
@@ -72,15 +294,26 @@ void CDVD::write_reg1(uint8_t data)
 	switch (cdrom_status.index)
 	{
 	case 0:
-		execute_command(data);
+	{
+		// The drive ignores commands written while it is still busy with the last one
+		if (cdrom_status.transmit_busy)
+		{
+			printf("[emu/CDVD]: Command 0x%x written while busy, ignoring\n", data);
+			break;
+		}
+
+		pending_command = data;
+		cdrom_status.transmit_busy = true;
+		bus->get_scheduler()->schedule(Event::CdromCommand, data == 0x0A ? ACK_DELAY_INIT : ACK_DELAY);
 		break;
+	}
 	case 1:
 	case 2:
 	case 3:
 	{
-		param_fifo.push_back(data);
+		param_fifo.push(data);
 		cdrom_status.param_fifo_empty = false;
-		cdrom_status.param_fifo_write_ready = (param_fifo.size() < 16);
+		cdrom_status.param_fifo_write_ready = !param_fifo.full();
 		break;
 	}
 	default:
@@ -93,6 +326,15 @@ void CDVD::write_reg3(uint8_t data)
 {
 	switch (cdrom_status.index)
 	{
+	case 0:
+		if (data & 0x80)
+			load_data_fifo();
+		else
+		{
+			data_pos = data_size = 0;
+			cdrom_status.data_fifo_not_empty = false;
+		}
+		break;
 	case 1:
 		if (data & 0x40)
 		{
@@ -101,8 +343,10 @@ void CDVD::write_reg3(uint8_t data)
 			cdrom_status.param_fifo_write_ready = true;
 		}
 
-		if (!irq_fifo.empty())
-			irq_fifo.pop_front();
+		irq_flags &= ~(data & 0b11111);
+
+		if (!irq_flags && !irq_fifo.empty())
+			bus->get_scheduler()->schedule(Event::CdromIrq, IRQ_DELAY);
 		break;
 	default:
 		printf("[emu/CDVD]: Write to unknown address 0x1f801803.%d\n", cdrom_status.index);
@@ -114,35 +358,18 @@ uint8_t CDVD::read_reg3()
 {
 	switch (cdrom_status.index)
 	{
+	case 0:
+	case 2:
+		return 0b11100000 | reg_int_enabled;
 	case 1:
 	case 3:
-	{
-		uint8_t ret = 0b11100000;
-
-		if (!irq_fifo.empty())
-			ret |= irq_fifo.front() & 0b111;
-		return ret;
-	}
+		return 0b11100000 | (irq_flags & 0b111);
 	default:
 		printf("[emu/CDVD]: Read from unknown address 0x1f801803.%d\n", cdrom_status.index);
 		exit(1);
 	}
 }
 
-void CDVD::step()
-{
-	cdrom_status.transmit_busy = false;
-
-	if (!irq_fifo.empty())
-	{
-		auto irq_triggered = irq_fifo.front() & 0b111;
-		auto irq_mask = reg_int_enabled & 0b111;
-
-		if (irq_triggered & irq_mask)
-			bus->TriggerInterrupt(2);
-	}
-}
-
 void CDVD::write(uint32_t addr, uint32_t data)
 {
 	switch (addr)
@@ -175,8 +402,7 @@ uint32_t CDVD::read(uint32_t addr)
 	{
 		if (!resp_fifo.empty())
 		{
-			uint8_t ret = resp_fifo.front();
-			resp_fifo.pop_front();
+			uint8_t ret = resp_fifo.pop();
 
 			if (resp_fifo.empty())
 				cdrom_status.response_fifo_not_empty = false;
@@ -184,6 +410,16 @@ uint32_t CDVD::read(uint32_t addr)
 		}
 		return 0;
 	}
+	case 0x1f801802:
+	{
+		if (data_pos < data_size)
+		{
+			uint8_t ret = data_buffer[data_pos++];
+			cdrom_status.data_fifo_not_empty = data_pos < data_size;
+			return ret;
+		}
+		return 0;
+	}
 	case 0x1f801803:
 		return read_reg3();
 	default:
@@ -191,3 +427,34 @@ uint32_t CDVD::read(uint32_t addr)
 		exit(1);
 	}
 }
+
+void CDVD::do_state(StateStream& s)
+{
+	s.section("CDVD", 1);
+
+	s.value(cdrom_status);
+	s.value(param_fifo);
+	s.value(resp_fifo);
+	s.value(irq_fifo);
+	s.value(stat_code);
+
+	s.value(pending_command);
+	s.value(second_response);
+
+	s.value(mode);
+	s.value(seek_lba);
+	s.value(read_lba);
+
+	s.value(sector_buffer);
+	s.value(data_buffer);
+	s.value(data_size);
+	s.value(data_pos);
+
+	s.value(irq_flags);
+	s.value(reg_int_enabled);
+
+	s.check(param_fifo.size() <= param_fifo.capacity());
+	s.check(resp_fifo.size() <= resp_fifo.capacity());
+	s.check(irq_fifo.size() <= irq_fifo.capacity());
+	s.check(data_size <= sizeof(data_buffer) && data_pos <= data_size);
+}
@@ -3,7 +3,11 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
-#include <deque>
+#include <initializer_list>
+#include <string>
+#include <util/fifo.h>
+#include <util/state.h>
+#include <emu/cdvd/cdimage.h>
 
 class Bus;
 
@@ -83,9 +87,35 @@ private:
 		}
 	} cdrom_status;
 
+	struct CdromResponse
+	{
+		CdromResponseType type;
+		uint8_t size;
+		uint8_t bytes[16];
+	};
+
+	// Delay (in CPU cycles) between the command write and its first response
+	static constexpr uint64_t ACK_DELAY = 25000;
+	static constexpr uint64_t ACK_DELAY_INIT = 80000;
+	// Delay before a queued response is delivered after the previous one was acked
+	static constexpr uint64_t IRQ_DELAY = 1000;
+
+	// Sector period at single speed (75 sectors per second); halved in double speed mode
+	static constexpr uint64_t READ_DELAY = 33868800 / 75;
+	static constexpr uint64_t SEEK_DELAY = 0x4a00;
+
+	static CdromResponse make_response(CdromResponseType type, std::initializer_list<uint8_t> bytes);
+
 	void execute_command(uint8_t cmd);
+	void schedule_second_response(CdromResponseType type, std::initializer_list<uint8_t> bytes, uint64_t delay);
 
 	void push_response(CdromResponseType type, std::initializer_list<uint8_t> bytes);
+	void queue_response(const CdromResponse& response);
+	void deliver_response();
+	void update_irq();
+
+	void read_sector();
+	void load_data_fifo();
 
 	void write_reg1(uint8_t data);
 	void write_reg2(uint8_t data);
@@ -93,20 +123,43 @@ private:
 
 	uint8_t read_reg3();
 
-	std::deque<uint8_t> param_fifo;
-	std::deque<uint8_t> resp_fifo;
-	std::deque<CdromResponseType> irq_fifo;
+	Fifo<uint8_t, 16> param_fifo;
+	Fifo<uint8_t, 16> resp_fifo;
+	Fifo<CdromResponse, 4> irq_fifo;	// Responses waiting for the current IRQ to be acked
 
 	CdromStatusCode stat_code;
 
-	uint8_t reg_int_enabled;
+	uint8_t pending_command = 0;
+	CdromResponse second_response = {};
+
+	CdImage* disc = nullptr;
+
+	uint8_t mode = 0;
+	uint32_t seek_lba = 0;
+	uint32_t read_lba = 0;
+
+	uint8_t sector_buffer[CD_SECTOR_SIZE] = {};	// Last sector read off the disc
+	uint8_t data_buffer[CD_SECTOR_SIZE] = {};	// Sector currently exposed through the data FIFO
+	uint32_t data_size = 0, data_pos = 0;
+
+	uint8_t irq_flags = 0;				// Currently raised INT1-INT5, 0 once acked
+	uint8_t reg_int_enabled = 0;
 
 	Bus* bus;
 public:
-	CDVD(Bus* bus) : bus(bus) {}
+	CDVD(Bus* bus);
 
-	void step();
+	void insert_disc(std::string path);
+	void eject_disc();
+
+	CdImage* get_disc() {return disc;}
+
+	// DMA channel 3: drains the data FIFO one word at a time
+	uint32_t read_data_word();
 
 	void write(uint32_t addr, uint32_t data);
 	uint32_t read(uint32_t addr);
+
+	// Controller state only; the disc itself isn't part of it
+	void do_state(StateStream& s);
 };
\ No newline at end of file
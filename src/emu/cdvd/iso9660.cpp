@@ -0,0 +1,151 @@
+#include "iso9660.h"
+#include "cdimage.h"
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+// Primary volume descriptor
+static constexpr uint32_t PVD_LBA = 16;
+static constexpr uint32_t PVD_ROOT_RECORD = 156;
+
+static uint32_t read32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Case-insensitive, and "FILE" matches "FILE;1"
+static bool name_matches(const std::string& want, const char* name, size_t len)
+{
+	std::string have(name, len);
+
+	if (want.find(';') == std::string::npos)
+	{
+		size_t semi = have.find(';');
+		if (semi != std::string::npos)
+			have.resize(semi);
+	}
+
+	if (have.size() != want.size())
+		return false;
+
+	for (size_t i = 0; i < have.size(); i++)
+	{
+		if (toupper((unsigned char)have[i]) != toupper((unsigned char)want[i]))
+			return false;
+	}
+
+	return true;
+}
+
+bool Iso9660::read_data(uint32_t lba, uint8_t* out)
+{
+	uint8_t sector[CD_SECTOR_SIZE];
+
+	if (!disc->read_sector(lba, sector))
+		return false;
+
+	// Mode 2 form 1: 12 sync, 4 header, 8 subheader bytes
+	std::memcpy(out, sector + 24, ISO_SECTOR_SIZE);
+	return true;
+}
+
+bool Iso9660::find_in_dir(const File& dir, const std::string& name, File& out, bool& is_dir)
+{
+	uint8_t data[ISO_SECTOR_SIZE];
+
+	for (uint32_t pos = 0; pos < dir.size; pos += ISO_SECTOR_SIZE)
+	{
+		if (!read_data(dir.lba + pos / ISO_SECTOR_SIZE, data))
+			return false;
+
+		// Records never cross a sector boundary; a zero length pads out the
+		// rest of the sector
+		for (uint32_t off = 0; off < ISO_SECTOR_SIZE && data[off]; off += data[off])
+		{
+			if (off + 33 > ISO_SECTOR_SIZE)
+				break;
+
+			const uint8_t* rec = &data[off];
+			uint8_t name_len = rec[32];
+
+			if (rec[0] < 33 + name_len || off + rec[0] > ISO_SECTOR_SIZE)
+				break;
+
+			if (name_matches(name, (const char*)rec + 33, name_len))
+			{
+				out.lba = read32(rec + 2);
+				out.size = read32(rec + 10);
+				is_dir = rec[25] & 2;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool Iso9660::find(std::string path, File& out)
+{
+	if (!disc)
+		return false;
+
+	if (path.compare(0, 6, "cdrom:") == 0)
+		path.erase(0, 6);
+
+	std::replace(path.begin(), path.end(), '/', '\\');
+
+	uint8_t pvd[ISO_SECTOR_SIZE];
+	if (!read_data(PVD_LBA, pvd) || std::memcmp(pvd + 1, "CD001", 5))
+		return false;
+
+	File cur = {read32(pvd + PVD_ROOT_RECORD + 2), read32(pvd + PVD_ROOT_RECORD + 10)};
+	bool is_dir = true;
+
+	size_t start = 0;
+	while (start < path.size())
+	{
+		size_t end = path.find('\\', start);
+		if (end == std::string::npos)
+			end = path.size();
+
+		if (end > start)
+		{
+			if (!is_dir || !find_in_dir(cur, path.substr(start, end - start), cur, is_dir))
+				return false;
+		}
+
+		start = end + 1;
+	}
+
+	if (is_dir)
+		return false;
+
+	out = cur;
+	return true;
+}
+
+uint32_t Iso9660::read(const File& file, uint32_t offset, uint8_t* out, uint32_t size)
+{
+	if (offset >= file.size)
+		return 0;
+
+	size = std::min(size, file.size - offset);
+
+	uint8_t data[ISO_SECTOR_SIZE];
+	uint32_t done = 0;
+
+	while (done < size)
+	{
+		uint32_t pos = offset + done;
+		uint32_t in_sector = pos % ISO_SECTOR_SIZE;
+		uint32_t chunk = std::min(size - done, ISO_SECTOR_SIZE - in_sector);
+
+		if (!read_data(file.lba + pos / ISO_SECTOR_SIZE, data))
+			break;
+
+		std::memcpy(out + done, data + in_sector, chunk);
+		done += chunk;
+	}
+
+	return done;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class CdImage;
+
+// Just enough ISO 9660 to find a file by path and read it, for the parts of
+// the emulator that go around the CD-ROM controller (BIOS HLE file I/O and
+// fast boot). Paths may carry a "cdrom:" prefix, use either slash, and leave
+// out the ";1" version.
+class Iso9660
+{
+public:
+	struct File
+	{
+		uint32_t lba;
+		uint32_t size;
+	};
+private:
+	CdImage* disc;
+
+	bool read_data(uint32_t lba, uint8_t* out);
+	bool find_in_dir(const File& dir, const std::string& name, File& out, bool& is_dir);
+public:
+	Iso9660(CdImage* disc) : disc(disc) {}
+
+	bool find(std::string path, File& out);
+
+	// Returns the number of bytes actually read, short at the end of the file
+	uint32_t read(const File& file, uint32_t offset, uint8_t* out, uint32_t size);
+};
@@ -1,9 +1,182 @@
 #include <emu/memory/Bus.h>
+#include <emu/bios/hle.h>
 #include <app/Application.h>
 #include <cstring>
+#include <array>
 #include "cpu.h"
 
-uint32_t exception_addr[2] = { 0x80000080, 0xBFC00180 };
+// Primary opcode space, listed in full so the same list can build both the
+// handler table and the computed goto labels in Clock()
+#define PRIMARY_OPCODES(X) \
+	X(0x00, op_special) \
+	X(0x01, op_bcond) \
+	X(0x02, op_j) \
+	X(0x03, op_jal) \
+	X(0x04, op_beq) \
+	X(0x05, op_bne) \
+	X(0x06, op_blez) \
+	X(0x07, op_bgtz) \
+	X(0x08, op_addi) \
+	X(0x09, op_addiu) \
+	X(0x0A, op_slti) \
+	X(0x0B, op_sltiu) \
+	X(0x0C, op_andi) \
+	X(0x0D, op_ori) \
+	X(0x0E, op_xori) \
+	X(0x0F, op_lui) \
+	X(0x10, op_cop0) \
+	X(0x11, op_cop_unusable) \
+	X(0x12, op_cop2) \
+	X(0x13, op_cop_unusable) \
+	X(0x14, op_illegal) \
+	X(0x15, op_illegal) \
+	X(0x16, op_illegal) \
+	X(0x17, op_illegal) \
+	X(0x18, op_illegal) \
+	X(0x19, op_illegal) \
+	X(0x1A, op_illegal) \
+	X(0x1B, op_illegal) \
+	X(0x1C, op_illegal) \
+	X(0x1D, op_illegal) \
+	X(0x1E, op_illegal) \
+	X(0x1F, op_illegal) \
+	X(0x20, op_lb) \
+	X(0x21, op_lh) \
+	X(0x22, op_lwl) \
+	X(0x23, op_lw) \
+	X(0x24, op_lbu) \
+	X(0x25, op_lhu) \
+	X(0x26, op_lwr) \
+	X(0x27, op_illegal) \
+	X(0x28, op_sb) \
+	X(0x29, op_sh) \
+	X(0x2A, op_swl) \
+	X(0x2B, op_sw) \
+	X(0x2C, op_illegal) \
+	X(0x2D, op_illegal) \
+	X(0x2E, op_swr) \
+	X(0x2F, op_illegal) \
+	X(0x30, op_cop_unusable) \
+	X(0x31, op_cop_unusable) \
+	X(0x32, op_lwc2) \
+	X(0x33, op_cop_unusable) \
+	X(0x34, op_illegal) \
+	X(0x35, op_illegal) \
+	X(0x36, op_illegal) \
+	X(0x37, op_illegal) \
+	X(0x38, op_cop_unusable) \
+	X(0x39, op_cop_unusable) \
+	X(0x3A, op_swc2) \
+	X(0x3B, op_cop_unusable) \
+	X(0x3C, op_illegal) \
+	X(0x3D, op_illegal) \
+	X(0x3E, op_illegal) \
+	X(0x3F, op_illegal)
+
+constexpr std::array<CPU::Handler, 64> CPU::make_primary_table()
+{
+	std::array<Handler, 64> table = {};
+#define X(op, handler) table[op] = &CPU::handler;
+	PRIMARY_OPCODES(X)
+#undef X
+	return table;
+}
+
+constexpr std::array<CPU::Handler, 64> CPU::make_special_table()
+{
+	std::array<Handler, 64> table = {};
+	table.fill(&CPU::op_illegal);
+
+	table[0x00] = &CPU::op_sll;
+	table[0x02] = &CPU::op_srl;
+	table[0x03] = &CPU::op_sra;
+	table[0x04] = &CPU::op_sllv;
+	table[0x06] = &CPU::op_srlv;
+	table[0x07] = &CPU::op_srav;
+	table[0x08] = &CPU::op_jr;
+	table[0x09] = &CPU::op_jalr;
+	table[0x0C] = &CPU::op_syscall;
+	table[0x0D] = &CPU::op_break;
+	table[0x10] = &CPU::op_mfhi;
+	table[0x11] = &CPU::op_mthi;
+	table[0x12] = &CPU::op_mflo;
+	table[0x13] = &CPU::op_mtlo;
+	table[0x18] = &CPU::op_mult;
+	table[0x19] = &CPU::op_multu;
+	table[0x1A] = &CPU::op_div;
+	table[0x1B] = &CPU::op_divu;
+	table[0x20] = &CPU::op_add;
+	table[0x21] = &CPU::op_addu;
+	table[0x22] = &CPU::op_sub;
+	table[0x23] = &CPU::op_subu;
+	table[0x24] = &CPU::op_and;
+	table[0x25] = &CPU::op_or;
+	table[0x26] = &CPU::op_xor;
+	table[0x27] = &CPU::op_nor;
+	table[0x2A] = &CPU::op_slt;
+	table[0x2B] = &CPU::op_sltu;
+
+	return table;
+}
+
+constexpr std::array<CPU::Handler, 32> CPU::make_bcond_table()
+{
+	std::array<Handler, 32> table = {};
+
+	// The R3000A only looks at bit 0 (ge/lt) and whether bits 1-4 are 0x10
+	// (link); all 32 encodings decode to something
+	for (size_t rt = 0; rt < 32; rt++)
+	{
+		bool ge = rt & 1;
+		bool link = (rt & 0x1E) == 0x10;
+
+		if (link)
+			table[rt] = ge ? &CPU::op_bgezal : &CPU::op_bltzal;
+		else
+			table[rt] = ge ? &CPU::op_bgez : &CPU::op_bltz;
+	}
+
+	return table;
+}
+
+constexpr std::array<CPU::Handler, 32> CPU::make_cop0_table()
+{
+	std::array<Handler, 32> table = {};
+	table.fill(&CPU::op_illegal);
+
+	table[0x00] = &CPU::op_mfc0;
+	table[0x04] = &CPU::op_mtc0;
+
+	// COP0 commands; rfe is the only one the PSX has
+	for (size_t rs = 0x10; rs < 0x20; rs++)
+		table[rs] = &CPU::op_rfe;
+
+	return table;
+}
+
+constexpr std::array<CPU::Handler, 32> CPU::make_cop2_table()
+{
+	std::array<Handler, 32> table = {};
+	table.fill(&CPU::op_illegal);
+
+	table[0x00] = &CPU::mfc2;
+	table[0x02] = &CPU::cfc2;
+	table[0x04] = &CPU::mtc2;
+	table[0x06] = &CPU::ctc2;
+
+	for (size_t rs = 0x10; rs < 0x20; rs++)
+		table[rs] = &CPU::op_gte;
+
+	return table;
+}
+
+constinit const std::array<CPU::Handler, 64> CPU::primary_table = make_primary_table();
+constinit const std::array<CPU::Handler, 64> CPU::special_table = make_special_table();
+constinit const std::array<CPU::Handler, 32> CPU::bcond_table = make_bcond_table();
+constinit const std::array<CPU::Handler, 32> CPU::cop0_table = make_cop0_table();
+constinit const std::array<CPU::Handler, 32> CPU::cop2_table = make_cop2_table();
+
+static constexpr uint32_t exception_addr[2] = { 0x80000080, 0xBFC00180 };
 
 void CPU::exception(Exception cause, uint32_t cop)
 {
@@ -46,6 +219,8 @@ void CPU::exception(Exception cause, uint32_t cop)
 	pc = exception_addr[Cop0.status.BEV];
 
 	direct_jump();
+
+	update_int_enabled();
 }
 
 CPU::CPU(Bus *bus)
@@ -58,9 +233,11 @@ CPU::CPU(Bus *bus)
 
     pc = 0xbfc00000;
 
+	FlushICache();
+
 	direct_jump();
 
-	console.open("console.txt");
+	SetFeatures(0);
 }
 
 CPU::~CPU()
@@ -69,10 +246,67 @@ CPU::~CPU()
 	console.close();
 }
 
+void CPU::FlushICache()
+{
+	// The code a detected loop was made of may be gone
+	idle_loop.branch_pc = 0xFFFFFFFF;
+
+	for (auto& line : icache)
+	{
+		for (int w = 0; w < 4; w++)
+			line.tags[w] = INVALID_TAG;
+	}
+}
+
+uint32_t CPU::fetch(uint32_t addr)
+{
+	// KSEG1 and up is uncached, as is everything while the cache is disabled
+	// in the cache control register
+	if (addr < 0xA0000000 && (bus->cache_control & (1 << 11)))
+	{
+		auto& line = icache[(addr >> 4) & 0xFF];
+		uint32_t word = (addr >> 2) & 3;
+
+		if (line.tags[word] == (addr & 0x1FFFF000))
+			return line.data[word];
+
+		return icache_miss(addr);
+	}
+
+	return bus->read<uint32_t>(addr);
+}
+
+uint32_t CPU::icache_miss(uint32_t addr)
+{
+	auto& line = icache[(addr >> 4) & 0xFF];
+	uint32_t word = (addr >> 2) & 3;
+	uint32_t tag = addr & 0x1FFFF000;
+
+	// A refill loads from the missed word to the end of the line
+	for (uint32_t w = word; w < 4; w++)
+	{
+		line.data[w] = bus->read<uint32_t>((addr & ~0xF) + w * 4);
+		line.tags[w] = tag;
+	}
+
+	stall_cycles += ICACHE_MISS_CYCLES + (4 - word);
+	return line.data[word];
+}
+
+void CPU::icache_store(uint32_t addr)
+{
+	// With the cache isolated, stores land in the cache instead of memory.
+	// The BIOS only does this to flush it, so treat it as invalidating the line
+	auto& line = icache[(addr >> 4) & 0xFF];
+
+	for (int w = 0; w < 4; w++)
+		line.tags[w] = INVALID_TAG;
+}
+
 void CPU::direct_jump()
 {
 	next_instr = {};
-	next_instr.full = bus->read<uint32_t>(pc);
+	next_instr.full = fetch(pc);
 	next_instr.pc = pc;
 	pc += 4;
 }
@@ -92,22 +326,33 @@ void CPU::handle_load_delay()
 	regs[0] = 0;
 }
 
-void CPU::branch(std::string op)
+void CPU::branch()
 {
 	int32_t imm = (int16_t)i.i_type.imm;
 
 	next_instr.branch_taken = true;
 	pc = next_instr.pc + (imm << 2);
 
-	if (can_disassemble) printf("%s, 0x%08x\n", op.c_str(), pc);
+	// Short backward branches are where polling loops live
+	if (imm < 0 && imm >= -16)
+		idle_check_branch(pc);
 }
 
-void CPU::branch()
+// Kernel calls are "jr" to 0xA0/0xB0/0xC0 with the function number in t1,
+// so the vector is always reached as a block's target
+void CPU::hle_call()
 {
-	int32_t imm = (int16_t)i.i_type.imm;
+	uint32_t vector = next_instr.pc & 0x1FFFFFFF;
 
-	next_instr.branch_taken = true;
-	pc = next_instr.pc + (imm << 2);
+	if (vector != 0xA0 && vector != 0xB0 && vector != 0xC0)
+		return;
+
+	if (!hle->call(vector, regs[9], regs))
+		return;
+
+	// Return to the caller, as the BIOS function's own "jr ra" would
+	pc = regs[31];
+	direct_jump();
 }
 
 void CPU::load(uint32_t regN, uint32_t value)
@@ -116,80 +361,119 @@ void CPU::load(uint32_t regN, uint32_t value)
 	delayed_memory_load.data = value;
 }
 
-void CPU::Clock(int cycles)
+template<uint32_t features>
+void CPU::run(int cycles)
 {
     for (int cycle = cycles; cycle > 0; cycle--)
     {
-        if (singleStep)
+        if constexpr (features & FeatureSingleStep)
 		{
         	getc(stdin);
 		}
         
 		i = next_instr;
 
-		if (i.pc == 0xA0 && regs[9] == 0x3C)
-		{
-			console << (char)regs[4];
-			console.flush();
-		}
-		
-		if (i.pc == 0xB0 && regs[9] == 0x3D)
+		if constexpr (features & FeatureTtyHook)
 		{
-			console << (char)regs[4];
-			console.flush();
+			if (!speculative && ((i.pc == 0xA0 && regs[9] == 0x3C) || (i.pc == 0xB0 && regs[9] == 0x3D)))
+			{
+				// Opened on first use, so only machines that print claim the file
+				if (!console.is_open())
+					console.open("console.txt");
+
+				console << (char)regs[4];
+				console.flush();
+			}
 		}
 		
-		if (pc & 0x3)
+		if constexpr (features & FeatureAlignCheck)
 		{
-			printf("Error: Unaligned address at 0x%08x\n", pc);
-			exit(1);
+			if (pc & 0x3)
+			{
+				printf("Error: Unaligned address at 0x%08x\n", pc);
+				exit(1);
+			}
 		}
 
-		if (can_disassemble)
+		if constexpr (features & FeatureTrace)
 			printf("0x%08x: ", i.pc);
 
 		direct_jump();
 
-		switch (i.opcode)
-        {
-        case 0b000000: op_special(); break;
-        case 0b000001: op_bcond(); break;
-        case 0b001111: op_lui(); break;
-        case 0b001101: op_ori(); break;
-		case 0b001110: op_xori(); break;
-        case 0b101011: op_sw(); break;
-        case 0b001001: op_addiu(); break;
-        case 0b001000: op_addi(); break;
-        case 0b000010: op_j(); break;
-        case 0b010000: op_cop0(); break;
-        case 0b100011: op_lw(); break;
-        case 0b000101: op_bne(); break;
-        case 0b101001: op_sh(); break;
-        case 0b000011: op_jal(); break;
-        case 0b001100: op_andi(); break;
-        case 0b101000: op_sb(); break;
-        case 0b100000: op_lb(); break;
-        case 0b000100: op_beq(); break;
-        case 0b000111: op_bgtz(); break;
-        case 0b000110: op_blez(); break;
-        case 0b100100: op_lbu(); break;
-        case 0b001010: op_slti(); break;
-        case 0b001011: op_sltiu(); break;
-        case 0b100101: op_lhu(); break;
-        case 0b100001: op_lh(); break;
-		case 0b100010: op_lwl(); break;
-		case 0b100110: op_lwr(); break;
-		case 0b101010: op_swl(); break;
-		case 0b101110: op_swr(); break;
-		case 0x12: op_cop2(); break;
-        default:
-			printf("[emu/IOP]: Unknown instruction 0x%02x\n", i.opcode);
-			exit(1);
-        }
+#ifdef __GNUC__
+		// One indirect jump straight to the handler call, instead of a
+		// call through the member pointer table
+#define X(op, handler) &&primary_##op,
+		static void* const dispatch[64] = {PRIMARY_OPCODES(X)};
+#undef X
+
+		goto *dispatch[i.opcode];
+
+#define X(op, handler) primary_##op: handler(); goto dispatched;
+		PRIMARY_OPCODES(X)
+#undef X
+
+dispatched:
+#else
+		(this->*primary_table[i.opcode])();
+#endif
 
         /* Apply pending load delays. */
         handle_load_delay();
+
+		// Take interrupts at the end of each block, where the next
+		// instruction is never a delay slot
+		if (i.is_delay_slot)
+		{
+			if (IntPending())
+				exception(Exception::Interrupt);
+			else if (idle)
+				break;
+			else if (next_instr.pc == stop_pc)
+			{
+				stopped = true;
+				stop_pc = 0xFFFFFFFF;
+				break;
+			}
+			else if (hle)
+				hle_call();
+		}
+
+		cycle -= stall_cycles;
+		stall_cycles = 0;
     }
+}
+
+template<size_t... I>
+constexpr std::array<CPU::RunLoop, sizeof...(I)> CPU::make_run_table(std::index_sequence<I...>)
+{
+	return {&CPU::run<I>...};
+}
+
+constinit const std::array<CPU::RunLoop, 16> CPU::run_table = make_run_table(std::make_index_sequence<16>());
+
+void CPU::SetFeatures(uint32_t features)
+{
+	this->features = features & 0xF;
+	run_loop = run_table[this->features];
+
+	// Handlers print their own disassembly
+	can_disassemble = features & FeatureTrace;
+}
+
+void CPU::Clock(int cycles)
+{
+	if (stopped)
+		return;
+
+	if (idle)
+	{
+		if (!idle_should_wake())
+			return;
+		idle = false;
+	}
+
+	(this->*run_loop)(cycles);
 
 	if (i.opcode != 0b100010)
 	{
@@ -213,11 +497,56 @@ void CPU::Dump()
     printf("[emu/IOP]: %s: pc\t->\t0x%08x\n", __FUNCTION__, pc - 4);
 }
 
+void CPU::update_int_enabled()
+{
+	// Software interrupts (IP bits 0-1) only count alongside a hardware one
+	int_enabled = Cop0.status.IEc && (Cop0.status.Im & (0x4 | (Cop0.cause.IP & 0x3)));
+}
+
 bool CPU::IntPending()
-{	
-	bool pending = bus->I_STAT & bus->I_MASK;
-	Cop0.cause.IP = (Cop0.cause.IP & ~0x4) | (pending << 2);
+{
+	if (!bus->irq_pending || !int_enabled)
+		return false;
+
+	Cop0.cause.IP |= 0x4;
+	return true;
+}
+
+void CPU::do_state(StateStream& s)
+{
+	s.section("CPU ", 2);
+
+	s.value(pc);
+	s.value(regs);
+	s.value(hi);
+	s.value(lo);
+	s.value(last_instruction_was_lwl);
+	s.value(last_instruction_was_lwr);
+	s.value(Cop0);
+	gte.do_state(s);
+
+	s.value(write_back);
+	s.value(memory_load);
+	s.value(delayed_memory_load);
+
+	// Field by field, the struct's padding is never initialized
+	for (Opcode* op : {&i, &next_instr})
+	{
+		s.value(op->full);
+		s.value(op->pc);
+		s.value(op->is_delay_slot);
+		s.value(op->branch_taken);
+	}
+
+	s.value(icache);
+	s.value(stall_cycles);
 
-	bool enabled = Cop0.status.IEc && (Cop0.status.Im & Cop0.cause.IP);
-	return pending && enabled;
+	if (s.is_loading())
+	{
+		update_int_enabled();
+
+		// Whatever loop was being watched belongs to the old state
+		idle = false;
+		idle_loop.branch_pc = 0xFFFFFFFF;
+	}
 }
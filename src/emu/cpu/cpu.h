@@ -5,15 +5,18 @@
 #include <emu/cpu/gte.h>
 #include <string>
 #include <fstream>
+#include <array>
+#include <utility>
 
 class Bus;
+class BiosHle;
 
 class CPU
 {
 private:
     uint32_t pc;
     uint32_t regs[32];
-    uint32_t hi, lo;
+    uint32_t hi = 0, lo = 0;
 
 	bool last_instruction_was_lwl = false;
 	bool last_instruction_was_lwr = false;
@@ -84,6 +87,9 @@ private:
     } Cop0;
 
 	GTE gte;
+	void mfc2();
+	void cfc2();
+	void mtc2();
 	void ctc2();
 
     Bus* bus;
@@ -167,8 +173,6 @@ private:
         uint32_t data = 0;
 	} write_back, memory_load, delayed_memory_load;
 
-    bool singleStep = false;
-
     void set_reg(uint32_t regN, uint32_t value)
     {
         write_back.reg = regN;
@@ -193,6 +197,7 @@ private:
     void op_lui(); // 0x0F
     void op_cop0(); // 0x10
     void op_cop2(); // 0x12
+	void op_cop_unusable(); // 0x11, 0x13, 0x30, 0x31, 0x33, 0x38, 0x39, 0x3B
     void op_lb(); // 0x20
     void op_lh(); // 0x21
 	void op_lwl(); // 0x22
@@ -205,6 +210,17 @@ private:
 	void op_swl(); // 0x2A
     void op_sw(); // 0x2B
 	void op_swr(); // 0x2E
+	void op_lwc2(); // 0x32
+	void op_swc2(); // 0x3A
+	void op_illegal();
+
+    // bcond
+
+	void bcond(bool ge, bool link);
+	void op_bltz(); // 0x00
+	void op_bgez(); // 0x01
+	void op_bltzal(); // 0x10
+	void op_bgezal(); // 0x11
 
     // special
 
@@ -217,6 +233,7 @@ private:
     void op_jr(); // 0x08
     void op_jalr(); // 0x09
     void op_syscall(); // 0x0C
+	void op_break(); // 0x0D
     void op_mfhi(); // 0x10
     void op_mthi(); // 0x11
     void op_mflo(); // 0x12
@@ -242,9 +259,45 @@ private:
     void op_mtc0(); // 0x04
 	void op_rfe(); // 0x10
 
+	// cop2
+
+	void op_gte(); // 0x10-0x1F
+
+	// Decode tables, filled at compile time. Holes go to op_illegal
+	using Handler = void (CPU::*)();
+
+	static constexpr std::array<Handler, 64> make_primary_table();
+	static constexpr std::array<Handler, 64> make_special_table();
+	static constexpr std::array<Handler, 32> make_bcond_table();
+	static constexpr std::array<Handler, 32> make_cop0_table();
+	static constexpr std::array<Handler, 32> make_cop2_table();
+
+	static const std::array<Handler, 64> primary_table;
+	static const std::array<Handler, 64> special_table;
+	static const std::array<Handler, 32> bcond_table;
+	static const std::array<Handler, 32> cop0_table;
+	static const std::array<Handler, 32> cop2_table;
+
+	// 4 KiB instruction cache: 256 lines of 4 words. Every word carries its
+	// line's tag (or INVALID_TAG), so a hit is one compare
+	struct ICacheLine
+	{
+		uint32_t tags[4];
+		uint32_t data[4];
+	};
+
+	static constexpr uint32_t INVALID_TAG = 0xFFFFFFFF;
+	static constexpr int ICACHE_MISS_CYCLES = 4;
+
+	ICacheLine icache[256] = {};
+	int stall_cycles = 0;
+
+	uint32_t fetch(uint32_t addr);
+	uint32_t icache_miss(uint32_t addr);
+	void icache_store(uint32_t addr);
+
 	void direct_jump();
 	void handle_load_delay();
-	void branch(std::string op);
 	void branch();
 	void load(uint32_t regN, uint32_t value);
 
@@ -252,6 +305,7 @@ private:
 
 	bool can_disassemble = false;
 	std::ofstream console;
+	bool speculative = false;
 
 	enum class Exception 
     {
@@ -268,20 +322,103 @@ private:
 
 	void exception(Exception cause, uint32_t cop = 0);
 
+	// SR.IEc set and the hardware interrupt line unmasked in SR.Im. Only
+	// changes on SR/Cause writes, rfe and exceptions, so it is cached there;
+	// together with Bus::irq_pending this is everything IntPending() needs
+	bool int_enabled = false;
+	void update_int_enabled();
+
 	Opcode i, next_instr;
+
+	// Idle loop detection (idle.cpp). While idle, Clock() returns without
+	// executing anything until something the loop reads may have changed
+	struct IdleLoop
+	{
+		uint32_t branch_pc = 0xFFFFFFFF;
+		uint32_t target = 0;
+		bool pure = false;			// Body is loads and ALU ops only
+		int matches = 0;
+		uint32_t regs[32];
+		uint32_t hi, lo;
+
+		bool wake_on_step = false;	// Polls a timer
+		uint32_t i_stat = 0;
+		uint64_t events = 0;
+	} idle_loop;
+
+	bool idle = false;
+
+	// Kernel calls are intercepted at the A0/B0/C0 vectors when set
+	BiosHle* hle = nullptr;
+	void hle_call();
+
+	uint32_t stop_pc = 0xFFFFFFFF;
+	bool stopped = false;
+
+	void idle_check_branch(uint32_t target);
+	bool idle_scan();
+	bool idle_classify();
+	void idle_enter();
+	bool idle_should_wake();
+
+	// One copy of the run loop per feature combination, so the checks a
+	// variant doesn't need aren't compiled into it at all
+	using RunLoop = void (CPU::*)(int);
+
+	template<uint32_t features> void run(int cycles);
+	template<size_t... I> static constexpr std::array<RunLoop, sizeof...(I)> make_run_table(std::index_sequence<I...>);
+
+	static const std::array<RunLoop, 16> run_table;
+
+	uint32_t features = 0;
+	RunLoop run_loop;
 public:
+	// Debug features, off in the normal run loop
+	enum Feature : uint32_t
+	{
+		FeatureTrace = 1 << 0,			// Disassemble every instruction to stdout
+		FeatureSingleStep = 1 << 1,		// Wait for a key press before each instruction
+		FeatureTtyHook = 1 << 2,		// Log BIOS putchar calls to console.txt
+		FeatureAlignCheck = 1 << 3,		// Die on a misaligned pc
+	};
+
     CPU(Bus* bus);
 	~CPU();
 
-	void JumpToExe(uint32_t pc, uint32_t sp)
+	void JumpToExe(uint32_t pc, uint32_t gp, uint32_t sp)
 	{
+		// The code was written behind the cache's back
+		FlushICache();
+
 		this->pc = pc;
+		regs[28] = gp;
 		regs[29] = sp;
+		regs[30] = sp;
+
+		direct_jump();
 		//can_disassemble = true;
 	}
 
+	// Stops execution when a block ends with a jump to pc, e.g. the BIOS
+	// entering the shell. Clock() does nothing while stopped
+	void SetStopPc(uint32_t pc) {stop_pc = pc; stopped = false;}
+	bool Stopped() const {return stopped;}
+	void Resume() {stopped = false;}
+	uint32_t GetPc() const {return pc;}
+
     void Clock(int cycles);
+	void FlushICache();
+
+	void SetFeatures(uint32_t features);
+	void SetBiosHle(BiosHle* hle) {this->hle = hle;}
+
+	// Set while System runs frames that aren't happening for real (run-ahead,
+	// replaying up to a movie seek), which mustn't print to the console
+	void SetSpeculative(bool on) {speculative = on;}
+	uint32_t GetFeatures() const {return features;}
     void Dump();
 
     bool IntPending();
+
+	void do_state(StateStream& s);
 };
\ No newline at end of file
@@ -1,34 +1,179 @@
 #include "gte.h"
 #include <cstdio>
 #include <cstdlib>
+#include <bit>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint32_t GTE::read_reg(uint32_t reg)
+{
+	switch (reg)
+	{
+	case 0:
+	case 2:
+	case 4:
+		return (uint16_t)v[reg / 2][0] | ((uint16_t)v[reg / 2][1] << 16);
+	case 1:
+	case 3:
+	case 5:
+		return (int32_t)v[reg / 2][2];
+	case 6:
+		return rgbc[0] | (rgbc[1] << 8) | (rgbc[2] << 16) | (rgbc[3] << 24);
+	case 7:
+		return otz;
+	case 8 ... 11:
+		return (int32_t)ir[reg - 8];
+	case 12 ... 14:
+		return (uint16_t)sxy[reg - 12][0] | ((uint16_t)sxy[reg - 12][1] << 16);
+	case 15:
+		return (uint16_t)sxy[2][0] | ((uint16_t)sxy[2][1] << 16);
+	case 16 ... 19:
+		return sz[reg - 16];
+	case 20 ... 22:
+		return rgb[reg - 20];
+	case 23:
+		return res1;
+	case 24 ... 27:
+		return mac[reg - 24];
+	case 28:
+	case 29:
+	{
+		// IRGB/ORGB both read back the IR registers packed as 5:5:5
+		uint32_t ret = 0;
+		for (int i = 0; i < 3; i++)
+			ret |= std::clamp(ir[i + 1] >> 7, 0, 0x1f) << (i * 5);
+		return ret;
+	}
+	case 30:
+		return lzcs;
+	case 31:
+		return (lzcs & 0x80000000) ? std::countl_one(lzcs) : std::countl_zero(lzcs);
+	case 32 ... 36:
+	case 40 ... 44:
+	case 48 ... 52:
+	{
+		auto& m = matrix[(reg - 32) / 8];
+		int e = ((reg - 32) % 8) * 2;
+
+		// The last element is alone in its register and gets sign extended
+		if (e == 8)
+			return (int32_t)m[2][2];
+		return (uint16_t)m[e / 3][e % 3] | ((uint16_t)m[(e + 1) / 3][(e + 1) % 3] << 16);
+	}
+	case 37 ... 39:
+		return tr[reg - 37];
+	case 45 ... 47:
+		return bk[reg - 45];
+	case 53 ... 55:
+		return fc[reg - 53];
+	case 56:
+		return ofx;
+	case 57:
+		return ofy;
+	case 58:
+		return (int32_t)(int16_t)h;	// Hardware bug: H is sign extended on read
+	case 59:
+		return (int32_t)dqa;
+	case 60:
+		return dqb;
+	case 61:
+		return (int32_t)zsf3;
+	case 62:
+		return (int32_t)zsf4;
+	case 63:
+		return flag;
+	default:
+		printf("[emu/GTE]: Read from unknown register %d\n", reg);
+		exit(1);
+	}
+}
 
 void GTE::write_reg(uint32_t reg, uint32_t data)
 {
 	switch (reg)
 	{
-	case 45:
-		rgb_bg.r = data;
+	case 0:
+	case 2:
+	case 4:
+		v[reg / 2][0] = (int16_t)data;
+		v[reg / 2][1] = (int16_t)(data >> 16);
+		break;
+	case 1:
+	case 3:
+	case 5:
+		v[reg / 2][2] = (int16_t)data;
+		break;
+	case 6:
+		for (int i = 0; i < 4; i++)
+			rgbc[i] = data >> (i * 8);
+		break;
+	case 7:
+		otz = (uint16_t)data;
+		break;
+	case 8 ... 11:
+		ir[reg - 8] = (int16_t)data;
+		break;
+	case 12 ... 14:
+		sxy[reg - 12][0] = (int16_t)data;
+		sxy[reg - 12][1] = (int16_t)(data >> 16);
+		break;
+	case 15:
+		// Writing SXYP pushes onto the fifo
+		sxy[0][0] = sxy[1][0]; sxy[0][1] = sxy[1][1];
+		sxy[1][0] = sxy[2][0]; sxy[1][1] = sxy[2][1];
+		sxy[2][0] = (int16_t)data;
+		sxy[2][1] = (int16_t)(data >> 16);
 		break;
-	case 46:
-		rgb_bg.g = data;
+	case 16 ... 19:
+		sz[reg - 16] = (uint16_t)data;
 		break;
-	case 47:
-		rgb_bg.b = data;
+	case 20 ... 22:
+		rgb[reg - 20] = data;
 		break;
-	case 53:
-		rgb_fc.r = data;
+	case 23:
+		res1 = data;
 		break;
-	case 54:
-		rgb_fc.g = data;
+	case 24 ... 27:
+		mac[reg - 24] = data;
 		break;
-	case 55:
-		rgb_fc.b = data;
+	case 28:
+		for (int i = 0; i < 3; i++)
+			ir[i + 1] = ((data >> (i * 5)) & 0x1f) << 7;
+		break;
+	case 29:
+	case 31:
+		break;
+	case 30:
+		lzcs = data;
+		break;
+	case 32 ... 36:
+	case 40 ... 44:
+	case 48 ... 52:
+	{
+		auto& m = matrix[(reg - 32) / 8];
+		int e = ((reg - 32) % 8) * 2;
+
+		m[e / 3][e % 3] = (int16_t)data;
+		if (e != 8)
+			m[(e + 1) / 3][(e + 1) % 3] = (int16_t)(data >> 16);
+		break;
+	}
+	case 37 ... 39:
+		tr[reg - 37] = data;
+		break;
+	case 45 ... 47:
+		bk[reg - 45] = data;
+		break;
+	case 53 ... 55:
+		fc[reg - 53] = data;
 		break;
 	case 56:
-		screen_offset.x = (int32_t)data;
+		ofx = data;
 		break;
 	case 57:
-		screen_offset.y = (int32_t)data;
+		ofy = data;
 		break;
 	case 58:
 		h = (uint16_t)data;
@@ -45,8 +190,635 @@ void GTE::write_reg(uint32_t reg, uint32_t data)
 	case 62:
 		zsf4 = (int16_t)data;
 		break;
+	case 63:
+		flag = data & 0x7FFFF000;
+		if (flag & FLAG_ERROR_MASK)
+			flag |= 0x80000000;
+		break;
 	default:
 		printf("[emu/GTE]: Write to unknown register %d\n", reg);
 		exit(1);
 	}
-}
\ No newline at end of file
+}
+
+template<int i>
+int64_t GTE::check_mac(int64_t value)
+{
+	if (value > 0x7FFFFFFFFFFLL)
+		flag |= flag_mac_pos(i);
+	else if (value < -0x80000000000LL)
+		flag |= flag_mac_neg(i);
+
+	// The accumulator is 44 bits wide
+	return (value << 20) >> 20;
+}
+
+template<int i, int shift>
+void GTE::set_mac(int64_t value)
+{
+	check_mac<i>(value);
+	mac[i] = (int32_t)(value >> shift);
+}
+
+template<int i, bool lm>
+void GTE::set_ir(int32_t value)
+{
+	constexpr int32_t min = lm ? 0 : -0x8000;
+
+	if (value < min || value > 0x7FFF)
+	{
+		flag |= flag_ir_sat(i);
+		value = std::clamp(value, min, 0x7FFF);
+	}
+
+	ir[i] = value;
+}
+
+template<int i, int shift, bool lm>
+void GTE::set_mac_ir(int64_t value)
+{
+	set_mac<i, shift>(value);
+	set_ir<i, lm>(mac[i]);
+}
+
+void GTE::set_mac0(int64_t value)
+{
+	if (value > 0x7FFFFFFFLL)
+		flag |= FLAG_MAC0_POS;
+	else if (value < -0x80000000LL)
+		flag |= FLAG_MAC0_NEG;
+
+	mac[0] = (int32_t)value;
+}
+
+void GTE::set_ir0(int32_t value)
+{
+	if (value < 0 || value > 0x1000)
+	{
+		flag |= FLAG_IR0_SAT;
+		value = std::clamp(value, 0, 0x1000);
+	}
+
+	ir[0] = value;
+}
+
+template<int i>
+uint8_t GTE::saturate_color(int32_t value)
+{
+	if (value < 0 || value > 0xFF)
+	{
+		flag |= flag_color_sat(i);
+		value = std::clamp(value, 0, 0xFF);
+	}
+
+	return value;
+}
+
+void GTE::push_sxy(int32_t x, int32_t y)
+{
+	if (x < -0x400 || x > 0x3FF)
+	{
+		flag |= FLAG_SX2_SAT;
+		x = std::clamp(x, -0x400, 0x3FF);
+	}
+	if (y < -0x400 || y > 0x3FF)
+	{
+		flag |= FLAG_SY2_SAT;
+		y = std::clamp(y, -0x400, 0x3FF);
+	}
+
+	sxy[0][0] = sxy[1][0]; sxy[0][1] = sxy[1][1];
+	sxy[1][0] = sxy[2][0]; sxy[1][1] = sxy[2][1];
+	sxy[2][0] = x;
+	sxy[2][1] = y;
+}
+
+void GTE::push_sz(int32_t z)
+{
+	if (z < 0 || z > 0xFFFF)
+	{
+		flag |= FLAG_SZ3_OTZ_SAT;
+		z = std::clamp(z, 0, 0xFFFF);
+	}
+
+	sz[0] = sz[1];
+	sz[1] = sz[2];
+	sz[2] = sz[3];
+	sz[3] = z;
+}
+
+void GTE::push_rgb_from_mac()
+{
+	uint8_t r = saturate_color<0>(mac[1] >> 4);
+	uint8_t g = saturate_color<1>(mac[2] >> 4);
+	uint8_t b = saturate_color<2>(mac[3] >> 4);
+
+	rgb[0] = rgb[1];
+	rgb[1] = rgb[2];
+	rgb[2] = r | (g << 8) | (b << 16) | (rgbc[3] << 24);
+}
+
+// Newton-Raphson reciprocal using the UNR table, as done by the hardware
+uint32_t GTE::divide(uint32_t lhs, uint32_t rhs)
+{
+	if (rhs * 2 <= lhs)
+	{
+		flag |= FLAG_DIV_OVERFLOW;
+		return 0x1FFFF;
+	}
+
+	int shift = std::countl_zero((uint16_t)rhs);
+	lhs <<= shift;
+	rhs <<= shift;
+
+	const uint32_t divisor = rhs | 0x8000;
+	const int32_t x = 0x101 + unr_table[((divisor & 0x7FFF) + 0x40) >> 7];
+	const int32_t d = (((int32_t)divisor * -x) + 0x80) >> 8;
+	const uint32_t recip = ((x * (0x20000 + d)) + 0x80) >> 8;
+	const uint32_t result = ((uint64_t)lhs * recip + 0x8000) >> 16;
+
+	return std::min<uint32_t>(0x1FFFF, result);
+}
+
+// All nine 16x16 products of a matrix-vector multiply. The accumulation
+// itself has to stay sequential per row for the overflow flags.
+void GTE::matrix_products(const int16_t m[3][4], int16_t vx, int16_t vy, int16_t vz, int32_t out[3][4])
+{
+#if defined(__SSE2__)
+	const __m128i vec = _mm_setr_epi16(vx, vy, vz, 0, vx, vy, vz, 0);
+	const __m128i rows01 = _mm_loadu_si128((const __m128i*)m[0]);
+	const __m128i row2 = _mm_loadl_epi64((const __m128i*)m[2]);
+
+	__m128i lo = _mm_mullo_epi16(rows01, vec);
+	__m128i hi = _mm_mulhi_epi16(rows01, vec);
+	_mm_storeu_si128((__m128i*)out[0], _mm_unpacklo_epi16(lo, hi));
+	_mm_storeu_si128((__m128i*)out[1], _mm_unpackhi_epi16(lo, hi));
+
+	lo = _mm_mullo_epi16(row2, vec);
+	hi = _mm_mulhi_epi16(row2, vec);
+	_mm_storeu_si128((__m128i*)out[2], _mm_unpacklo_epi16(lo, hi));
+#else
+	for (int i = 0; i < 3; i++)
+	{
+		out[i][0] = m[i][0] * vx;
+		out[i][1] = m[i][1] * vy;
+		out[i][2] = m[i][2] * vz;
+	}
+#endif
+}
+
+static constexpr int32_t no_translation[3] = {};
+
+// (T << 12) + row * V, flagging overflow of the partial sums; the caller
+// checks the final sum when it stores MAC
+template<int i>
+int64_t GTE::dot_row(const int32_t p[3][4], const int32_t* t)
+{
+	int64_t acc = (int64_t)t[i - 1] << 12;
+	acc = check_mac<i>(acc + p[i - 1][0]);
+	acc = check_mac<i>(acc + p[i - 1][1]);
+	return acc + p[i - 1][2];
+}
+
+template<int shift, bool lm>
+void GTE::mul_mat_vec(const int16_t m[3][4], const int32_t* t, int16_t vx, int16_t vy, int16_t vz)
+{
+	int32_t p[3][4];
+	matrix_products(m, vx, vy, vz, p);
+
+	set_mac_ir<1, shift, lm>(dot_row<1>(p, t));
+	set_mac_ir<2, shift, lm>(dot_row<2>(p, t));
+	set_mac_ir<3, shift, lm>(dot_row<3>(p, t));
+}
+
+// MVMVA with cv=2: the far color and first column only contribute to the flags
+template<int shift, bool lm>
+void GTE::mul_mat_vec_buggy(const int16_t m[3][4], const int32_t* t, int16_t vx, int16_t vy, int16_t vz)
+{
+	int32_t p[3][4];
+	matrix_products(m, vx, vy, vz, p);
+
+	set_ir<1, false>((int32_t)(check_mac<1>(((int64_t)t[0] << 12) + p[0][0]) >> shift));
+	set_mac_ir<1, shift, lm>(check_mac<1>(p[0][1]) + p[0][2]);
+	set_ir<2, false>((int32_t)(check_mac<2>(((int64_t)t[1] << 12) + p[1][0]) >> shift));
+	set_mac_ir<2, shift, lm>(check_mac<2>(p[1][1]) + p[1][2]);
+	set_ir<3, false>((int32_t)(check_mac<3>(((int64_t)t[2] << 12) + p[2][0]) >> shift));
+	set_mac_ir<3, shift, lm>(check_mac<3>(p[2][1]) + p[2][2]);
+}
+
+template<int shift, bool lm>
+void GTE::interpolate_color(int64_t in_mac1, int64_t in_mac2, int64_t in_mac3)
+{
+	// [IR1,IR2,IR3] = (([RFC,GFC,BFC] SHL 12) - [MAC1,MAC2,MAC3]) SAR (sf*12)
+	set_mac_ir<1, shift, false>(((int64_t)fc[0] << 12) - in_mac1);
+	set_mac_ir<2, shift, false>(((int64_t)fc[1] << 12) - in_mac2);
+	set_mac_ir<3, shift, false>(((int64_t)fc[2] << 12) - in_mac3);
+
+	// [MAC1,MAC2,MAC3] = (([IR1,IR2,IR3] * IR0) + [MAC1,MAC2,MAC3]) SAR (sf*12)
+	set_mac_ir<1, shift, lm>((int64_t)ir[1] * ir[0] + in_mac1);
+	set_mac_ir<2, shift, lm>((int64_t)ir[2] * ir[0] + in_mac2);
+	set_mac_ir<3, shift, lm>((int64_t)ir[3] * ir[0] + in_mac3);
+}
+
+template<int shift, bool lm, bool last>
+void GTE::rtps(int n)
+{
+	int32_t p[3][4];
+	matrix_products(matrix[Rotation], v[n][0], v[n][1], v[n][2], p);
+
+	set_mac_ir<1, shift, lm>(dot_row<1>(p, tr));
+	set_mac_ir<2, shift, lm>(dot_row<2>(p, tr));
+
+	const int64_t acc = dot_row<3>(p, tr);
+	set_mac<3, shift>(acc);
+
+	// IR3's saturation flag is always checked against MAC3 SAR 12, no
+	// matter what sf says
+	const int32_t z = (int32_t)(acc >> 12);
+	if (z < -0x8000 || z > 0x7FFF)
+		flag |= flag_ir_sat(3);
+	ir[3] = std::clamp(mac[3], lm ? 0 : -0x8000, 0x7FFF);
+
+	push_sz(z);
+
+	const int64_t h_div = divide(h, sz[3]);
+
+	const int64_t x = h_div * ir[1] + ofx;
+	const int64_t y = h_div * ir[2] + ofy;
+	set_mac0(x);
+	set_mac0(y);
+	push_sxy(x >> 16, y >> 16);
+
+	if constexpr (last)
+	{
+		const int64_t depth = h_div * dqa + dqb;
+		set_mac0(depth);
+		set_ir0(depth >> 12);
+	}
+}
+
+template<int shift, bool lm>
+void GTE::ncds(int n)
+{
+	mul_mat_vec<shift, lm>(matrix[Light], no_translation, v[n][0], v[n][1], v[n][2]);
+	mul_mat_vec<shift, lm>(matrix[Color], bk, ir[1], ir[2], ir[3]);
+
+	interpolate_color<shift, lm>(((int64_t)rgbc[0] * ir[1]) << 4, ((int64_t)rgbc[1] * ir[2]) << 4, ((int64_t)rgbc[2] * ir[3]) << 4);
+	push_rgb_from_mac();
+}
+
+template<int shift, bool lm>
+void GTE::nccs(int n)
+{
+	mul_mat_vec<shift, lm>(matrix[Light], no_translation, v[n][0], v[n][1], v[n][2]);
+	mul_mat_vec<shift, lm>(matrix[Color], bk, ir[1], ir[2], ir[3]);
+
+	set_mac_ir<1, shift, lm>(((int64_t)rgbc[0] * ir[1]) << 4);
+	set_mac_ir<2, shift, lm>(((int64_t)rgbc[1] * ir[2]) << 4);
+	set_mac_ir<3, shift, lm>(((int64_t)rgbc[2] * ir[3]) << 4);
+	push_rgb_from_mac();
+}
+
+template<int shift, bool lm>
+void GTE::ncs(int n)
+{
+	mul_mat_vec<shift, lm>(matrix[Light], no_translation, v[n][0], v[n][1], v[n][2]);
+	mul_mat_vec<shift, lm>(matrix[Color], bk, ir[1], ir[2], ir[3]);
+	push_rgb_from_mac();
+}
+
+template<int shift, bool lm>
+void GTE::dpcs(const uint8_t* color)
+{
+	interpolate_color<shift, lm>((int64_t)color[0] << 16, (int64_t)color[1] << 16, (int64_t)color[2] << 16);
+	push_rgb_from_mac();
+}
+
+template<bool sf, bool lm>
+void GTE::op_rtps()
+{
+	rtps<sf * 12, lm, true>(0);
+}
+
+template<bool sf, bool lm>
+void GTE::op_rtpt()
+{
+	rtps<sf * 12, lm, false>(0);
+	rtps<sf * 12, lm, false>(1);
+	rtps<sf * 12, lm, true>(2);
+}
+
+void GTE::op_nclip()
+{
+	set_mac0((int64_t)sxy[0][0] * sxy[1][1] + (int64_t)sxy[1][0] * sxy[2][1] + (int64_t)sxy[2][0] * sxy[0][1]
+		- (int64_t)sxy[0][0] * sxy[2][1] - (int64_t)sxy[1][0] * sxy[0][1] - (int64_t)sxy[2][0] * sxy[1][1]);
+}
+
+template<bool sf, bool lm>
+void GTE::op_op()
+{
+	const int64_t d1 = matrix[Rotation][0][0];
+	const int64_t d2 = matrix[Rotation][1][1];
+	const int64_t d3 = matrix[Rotation][2][2];
+
+	set_mac_ir<1, sf * 12, lm>(ir[3] * d2 - ir[2] * d3);
+	set_mac_ir<2, sf * 12, lm>(ir[1] * d3 - ir[3] * d1);
+	set_mac_ir<3, sf * 12, lm>(ir[2] * d1 - ir[1] * d2);
+}
+
+template<bool sf, bool lm>
+void GTE::op_dpcs()
+{
+	dpcs<sf * 12, lm>(rgbc);
+}
+
+template<bool sf, bool lm>
+void GTE::op_dpct()
+{
+	// Always works on RGB0, which is refilled by every push
+	for (int n = 0; n < 3; n++)
+	{
+		const uint8_t color[3] = {(uint8_t)rgb[0], (uint8_t)(rgb[0] >> 8), (uint8_t)(rgb[0] >> 16)};
+		dpcs<sf * 12, lm>(color);
+	}
+}
+
+template<bool sf, bool lm>
+void GTE::op_intpl()
+{
+	interpolate_color<sf * 12, lm>((int64_t)ir[1] << 12, (int64_t)ir[2] << 12, (int64_t)ir[3] << 12);
+	push_rgb_from_mac();
+}
+
+template<bool sf, bool lm, int mx, int vsel, int cv>
+void GTE::op_mvmva()
+{
+	int16_t vx, vy, vz;
+	if constexpr (vsel == 3)
+	{
+		vx = ir[1];
+		vy = ir[2];
+		vz = ir[3];
+	}
+	else
+	{
+		vx = v[vsel][0];
+		vy = v[vsel][1];
+		vz = v[vsel][2];
+	}
+
+	if constexpr (mx == Garbage)
+	{
+		// mx=3 selects a matrix made out of whatever is on the internal bus
+		auto& m = matrix[Garbage];
+		m[0][0] = -(int16_t)(rgbc[0] << 4);
+		m[0][1] = rgbc[0] << 4;
+		m[0][2] = ir[0];
+		m[1][0] = m[1][1] = m[1][2] = matrix[Rotation][0][2];
+		m[2][0] = m[2][1] = m[2][2] = matrix[Rotation][1][1];
+	}
+
+	if constexpr (cv == 0)
+		mul_mat_vec<sf * 12, lm>(matrix[mx], tr, vx, vy, vz);
+	else if constexpr (cv == 1)
+		mul_mat_vec<sf * 12, lm>(matrix[mx], bk, vx, vy, vz);
+	else if constexpr (cv == 2)
+		mul_mat_vec_buggy<sf * 12, lm>(matrix[mx], fc, vx, vy, vz);
+	else
+		mul_mat_vec<sf * 12, lm>(matrix[mx], no_translation, vx, vy, vz);
+}
+
+template<bool sf, bool lm>
+void GTE::op_ncds()
+{
+	ncds<sf * 12, lm>(0);
+}
+
+template<bool sf, bool lm>
+void GTE::op_ncdt()
+{
+	ncds<sf * 12, lm>(0);
+	ncds<sf * 12, lm>(1);
+	ncds<sf * 12, lm>(2);
+}
+
+template<bool sf, bool lm>
+void GTE::op_cdp()
+{
+	mul_mat_vec<sf * 12, lm>(matrix[Color], bk, ir[1], ir[2], ir[3]);
+	interpolate_color<sf * 12, lm>(((int64_t)rgbc[0] * ir[1]) << 4, ((int64_t)rgbc[1] * ir[2]) << 4, ((int64_t)rgbc[2] * ir[3]) << 4);
+	push_rgb_from_mac();
+}
+
+template<bool sf, bool lm>
+void GTE::op_nccs()
+{
+	nccs<sf * 12, lm>(0);
+}
+
+template<bool sf, bool lm>
+void GTE::op_ncct()
+{
+	nccs<sf * 12, lm>(0);
+	nccs<sf * 12, lm>(1);
+	nccs<sf * 12, lm>(2);
+}
+
+template<bool sf, bool lm>
+void GTE::op_cc()
+{
+	mul_mat_vec<sf * 12, lm>(matrix[Color], bk, ir[1], ir[2], ir[3]);
+	set_mac_ir<1, sf * 12, lm>(((int64_t)rgbc[0] * ir[1]) << 4);
+	set_mac_ir<2, sf * 12, lm>(((int64_t)rgbc[1] * ir[2]) << 4);
+	set_mac_ir<3, sf * 12, lm>(((int64_t)rgbc[2] * ir[3]) << 4);
+	push_rgb_from_mac();
+}
+
+template<bool sf, bool lm>
+void GTE::op_ncs()
+{
+	ncs<sf * 12, lm>(0);
+}
+
+template<bool sf, bool lm>
+void GTE::op_nct()
+{
+	ncs<sf * 12, lm>(0);
+	ncs<sf * 12, lm>(1);
+	ncs<sf * 12, lm>(2);
+}
+
+template<bool sf, bool lm>
+void GTE::op_sqr()
+{
+	set_mac_ir<1, sf * 12, lm>((int64_t)ir[1] * ir[1]);
+	set_mac_ir<2, sf * 12, lm>((int64_t)ir[2] * ir[2]);
+	set_mac_ir<3, sf * 12, lm>((int64_t)ir[3] * ir[3]);
+}
+
+template<bool sf, bool lm>
+void GTE::op_dcpl()
+{
+	interpolate_color<sf * 12, lm>(((int64_t)rgbc[0] * ir[1]) << 4, ((int64_t)rgbc[1] * ir[2]) << 4, ((int64_t)rgbc[2] * ir[3]) << 4);
+	push_rgb_from_mac();
+}
+
+void GTE::op_avsz3()
+{
+	const int64_t result = (int64_t)zsf3 * (sz[1] + sz[2] + sz[3]);
+	set_mac0(result);
+
+	int32_t z = result >> 12;
+	if (z < 0 || z > 0xFFFF)
+	{
+		flag |= FLAG_SZ3_OTZ_SAT;
+		z = std::clamp(z, 0, 0xFFFF);
+	}
+	otz = z;
+}
+
+void GTE::op_avsz4()
+{
+	const int64_t result = (int64_t)zsf4 * (sz[0] + sz[1] + sz[2] + sz[3]);
+	set_mac0(result);
+
+	int32_t z = result >> 12;
+	if (z < 0 || z > 0xFFFF)
+	{
+		flag |= FLAG_SZ3_OTZ_SAT;
+		z = std::clamp(z, 0, 0xFFFF);
+	}
+	otz = z;
+}
+
+template<bool sf, bool lm>
+void GTE::op_gpf()
+{
+	set_mac_ir<1, sf * 12, lm>((int64_t)ir[1] * ir[0]);
+	set_mac_ir<2, sf * 12, lm>((int64_t)ir[2] * ir[0]);
+	set_mac_ir<3, sf * 12, lm>((int64_t)ir[3] * ir[0]);
+	push_rgb_from_mac();
+}
+
+template<bool sf, bool lm>
+void GTE::op_gpl()
+{
+	set_mac_ir<1, sf * 12, lm>(((int64_t)mac[1] << (sf * 12)) + (int64_t)ir[1] * ir[0]);
+	set_mac_ir<2, sf * 12, lm>(((int64_t)mac[2] << (sf * 12)) + (int64_t)ir[2] * ir[0]);
+	set_mac_ir<3, sf * 12, lm>(((int64_t)mac[3] << (sf * 12)) + (int64_t)ir[3] * ir[0]);
+	push_rgb_from_mac();
+}
+
+void GTE::op_unknown()
+{
+	printf("[emu/GTE]: Unknown command 0x%02x (0x%08x)\n", cur_instr & 0x3F, cur_instr);
+	exit(1);
+}
+
+// Command table index: funct << 2 | sf << 1 | lm
+template<size_t index>
+constexpr GTE::Command GTE::command_for()
+{
+	constexpr uint32_t funct = index >> 2;
+	constexpr bool sf = index & 2;
+	constexpr bool lm = index & 1;
+
+	switch (funct)
+	{
+	case 0x01: return &GTE::op_rtps<sf, lm>;
+	case 0x06: return &GTE::op_nclip;
+	case 0x0C: return &GTE::op_op<sf, lm>;
+	case 0x10: return &GTE::op_dpcs<sf, lm>;
+	case 0x11: return &GTE::op_intpl<sf, lm>;
+	case 0x13: return &GTE::op_ncds<sf, lm>;
+	case 0x14: return &GTE::op_cdp<sf, lm>;
+	case 0x16: return &GTE::op_ncdt<sf, lm>;
+	case 0x1B: return &GTE::op_nccs<sf, lm>;
+	case 0x1C: return &GTE::op_cc<sf, lm>;
+	case 0x1E: return &GTE::op_ncs<sf, lm>;
+	case 0x20: return &GTE::op_nct<sf, lm>;
+	case 0x28: return &GTE::op_sqr<sf, lm>;
+	case 0x29: return &GTE::op_dcpl<sf, lm>;
+	case 0x2A: return &GTE::op_dpct<sf, lm>;
+	case 0x2D: return &GTE::op_avsz3;
+	case 0x2E: return &GTE::op_avsz4;
+	case 0x30: return &GTE::op_rtpt<sf, lm>;
+	case 0x3D: return &GTE::op_gpf<sf, lm>;
+	case 0x3E: return &GTE::op_gpl<sf, lm>;
+	case 0x3F: return &GTE::op_ncct<sf, lm>;
+	default: return &GTE::op_unknown;
+	}
+}
+
+// MVMVA table index: instruction bits 13-19 (cv, v, mx, sf) << 1 | lm
+template<size_t index>
+constexpr GTE::Command GTE::mvmva_for()
+{
+	constexpr bool lm = index & 1;
+	constexpr int cv = (index >> 1) & 3;
+	constexpr int vsel = (index >> 3) & 3;
+	constexpr int mx = (index >> 5) & 3;
+	constexpr bool sf = (index >> 7) & 1;
+
+	return &GTE::op_mvmva<sf, lm, mx, vsel, cv>;
+}
+
+template<size_t... I>
+constexpr std::array<GTE::Command, sizeof...(I)> GTE::make_command_table(std::index_sequence<I...>)
+{
+	return {command_for<I>()...};
+}
+
+template<size_t... I>
+constexpr std::array<GTE::Command, sizeof...(I)> GTE::make_mvmva_table(std::index_sequence<I...>)
+{
+	return {mvmva_for<I>()...};
+}
+
+constinit const std::array<GTE::Command, 64 * 4> GTE::command_table = make_command_table(std::make_index_sequence<64 * 4>());
+constinit const std::array<GTE::Command, 128 * 2> GTE::mvmva_table = make_mvmva_table(std::make_index_sequence<128 * 2>());
+
+void GTE::execute(uint32_t instr)
+{
+	flag = 0;
+	cur_instr = instr;
+
+	const bool lm = instr & (1 << 10);
+
+	if ((instr & 0x3F) == 0x12)
+		(this->*mvmva_table[((instr >> 12) & 0xFE) | lm])();
+	else
+		(this->*command_table[((instr & 0x3F) << 2) | ((instr >> 18) & 2) | lm])();
+
+	if (flag & FLAG_ERROR_MASK)
+		flag |= 0x80000000;
+}
+
+void GTE::do_state(StateStream& s)
+{
+	s.section("GTE ", 1);
+
+	s.value(v);
+	s.value(rgbc);
+	s.value(otz);
+	s.value(ir);
+	s.value(sxy);
+	s.value(sz);
+	s.value(rgb);
+	s.value(res1);
+	s.value(mac);
+	s.value(lzcs);
+	s.value(matrix);
+	s.value(tr);
+	s.value(bk);
+	s.value(fc);
+	s.value(ofx);
+	s.value(ofy);
+	s.value(h);
+	s.value(dqa);
+	s.value(dqb);
+	s.value(zsf3);
+	s.value(zsf4);
+	s.value(flag);
+	s.value(cur_instr);
+}
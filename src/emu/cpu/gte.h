@@ -1,21 +1,142 @@
 #pragma once
 
 #include <cstdint>
-#include <glm/glm.hpp>
-
-typedef glm::i32vec2 vec2s32;
-typedef glm::u32vec3 vec3u32;
+#include <util/state.h>
+#include <array>
+#include <algorithm>
+#include <utility>
 
 class GTE
 {
 private:
-	int16_t zsf3 = 0, zsf4 = 0;
-	uint16_t h = 0;
+	enum Matrix
+	{
+		Rotation = 0,
+		Light = 1,
+		Color = 2,
+		Garbage = 3,	// mx=3 in MVMVA
+	};
+
+	// Vectors
+	int16_t v[3][3] = {};		// V0..V2 (X, Y, Z)
+	uint8_t rgbc[4] = {};		// Color + GPU code
+	uint16_t otz = 0;
+	int16_t ir[4] = {};			// IR0..IR3
+	int16_t sxy[3][2] = {};		// Screen XY fifo
+	uint16_t sz[4] = {};		// Screen Z fifo
+	uint32_t rgb[3] = {};		// Color fifo
+	uint32_t res1 = 0;
+	int32_t mac[4] = {};		// MAC0..MAC3
+	uint32_t lzcs = 0;
+
+	// Matrices, with every row padded to 4 lanes so a pair of rows is one
+	// 128-bit load
+	int16_t matrix[4][3][4] = {};
+	int32_t tr[3] = {};			// Translation vector
+	int32_t bk[3] = {};			// Background color
+	int32_t fc[3] = {};			// Far color
+
+	int32_t ofx = 0, ofy = 0;	// Screen offset (16.16)
+	uint16_t h = 0;				// Projection plane distance
 	int16_t dqa = 0;
 	int32_t dqb = 0;
-	vec2s32 screen_offset = {};
-	vec3u32 rgb_bg = {};
-	vec3u32 rgb_fc = {};
+	int16_t zsf3 = 0, zsf4 = 0;
+	uint32_t flag = 0;
+
+	static constexpr std::array<uint8_t, 0x101> unr_table = []
+	{
+		std::array<uint8_t, 0x101> table = {};
+		for (int i = 0; i < 0x101; i++)
+			table[i] = std::max(0, (0x40000 / (i + 0x100) + 1) / 2 - 0x101);
+		return table;
+	}();
+
+	// FLAG bits
+	static constexpr uint32_t FLAG_IR0_SAT = 1 << 12;
+	static constexpr uint32_t FLAG_SY2_SAT = 1 << 13;
+	static constexpr uint32_t FLAG_SX2_SAT = 1 << 14;
+	static constexpr uint32_t FLAG_MAC0_NEG = 1 << 15;
+	static constexpr uint32_t FLAG_MAC0_POS = 1 << 16;
+	static constexpr uint32_t FLAG_DIV_OVERFLOW = 1 << 17;
+	static constexpr uint32_t FLAG_SZ3_OTZ_SAT = 1 << 18;
+	static constexpr uint32_t FLAG_ERROR_MASK = 0x7F87E000;
+
+	static constexpr uint32_t flag_color_sat(int i) {return 1 << (21 - i);}
+	static constexpr uint32_t flag_ir_sat(int i) {return 1 << (25 - i);}
+	static constexpr uint32_t flag_mac_neg(int i) {return 1 << (28 - i);}
+	static constexpr uint32_t flag_mac_pos(int i) {return 1 << (31 - i);}
+
+	// Every helper below is specialized on the component index and on the
+	// sf/lm fields, so the saturation bounds and flag bits are constants
+	template<int i> int64_t check_mac(int64_t value);
+	template<int i, int shift> void set_mac(int64_t value);
+	template<int i, bool lm> void set_ir(int32_t value);
+	template<int i, int shift, bool lm> void set_mac_ir(int64_t value);
+	void set_mac0(int64_t value);
+	void set_ir0(int32_t value);
+	template<int i> uint8_t saturate_color(int32_t value);
+
+	void push_sxy(int32_t x, int32_t y);
+	void push_sz(int32_t z);
+	void push_rgb_from_mac();
+
+	uint32_t divide(uint32_t lhs, uint32_t rhs);
+
+	void matrix_products(const int16_t m[3][4], int16_t vx, int16_t vy, int16_t vz, int32_t out[3][4]);
+	template<int i> int64_t dot_row(const int32_t p[3][4], const int32_t* t);
+	template<int shift, bool lm> void mul_mat_vec(const int16_t m[3][4], const int32_t* t, int16_t vx, int16_t vy, int16_t vz);
+	template<int shift, bool lm> void mul_mat_vec_buggy(const int16_t m[3][4], const int32_t* t, int16_t vx, int16_t vy, int16_t vz);
+	template<int shift, bool lm> void interpolate_color(int64_t in_mac1, int64_t in_mac2, int64_t in_mac3);
+
+	template<int shift, bool lm, bool last> void rtps(int n);
+	template<int shift, bool lm> void ncds(int n);
+	template<int shift, bool lm> void nccs(int n);
+	template<int shift, bool lm> void ncs(int n);
+	template<int shift, bool lm> void dpcs(const uint8_t* color);
+
+	template<bool sf, bool lm> void op_rtps();
+	template<bool sf, bool lm> void op_rtpt();
+	void op_nclip();
+	template<bool sf, bool lm> void op_op();
+	template<bool sf, bool lm> void op_dpcs();
+	template<bool sf, bool lm> void op_dpct();
+	template<bool sf, bool lm> void op_intpl();
+	template<bool sf, bool lm, int mx, int vsel, int cv> void op_mvmva();
+	template<bool sf, bool lm> void op_ncds();
+	template<bool sf, bool lm> void op_ncdt();
+	template<bool sf, bool lm> void op_cdp();
+	template<bool sf, bool lm> void op_nccs();
+	template<bool sf, bool lm> void op_ncct();
+	template<bool sf, bool lm> void op_cc();
+	template<bool sf, bool lm> void op_ncs();
+	template<bool sf, bool lm> void op_nct();
+	template<bool sf, bool lm> void op_sqr();
+	template<bool sf, bool lm> void op_dcpl();
+	void op_avsz3();
+	void op_avsz4();
+	template<bool sf, bool lm> void op_gpf();
+	template<bool sf, bool lm> void op_gpl();
+	void op_unknown();
+
+	// Handlers are looked up by (funct, sf, lm), or by (sf, mx, v, cv, lm)
+	// for MVMVA, in tables generated at compile time
+	using Command = void (GTE::*)();
+
+	template<size_t index> static constexpr Command command_for();
+	template<size_t index> static constexpr Command mvmva_for();
+	template<size_t... I> static constexpr std::array<Command, sizeof...(I)> make_command_table(std::index_sequence<I...>);
+	template<size_t... I> static constexpr std::array<Command, sizeof...(I)> make_mvmva_table(std::index_sequence<I...>);
+
+	static const std::array<Command, 64 * 4> command_table;
+	static const std::array<Command, 128 * 2> mvmva_table;
+
+	uint32_t cur_instr = 0;
 public:
+	// Registers 0-31 are data registers, 32-63 control registers
+	uint32_t read_reg(uint32_t reg);
 	void write_reg(uint32_t reg, uint32_t data);
-};
\ No newline at end of file
+
+	void execute(uint32_t instr);
+
+	void do_state(StateStream& s);
+};
@@ -0,0 +1,230 @@
+#include <emu/memory/Bus.h>
+#include <cstring>
+#include "cpu.h"
+
+// Idle loop detection. Games and the BIOS spend a lot of time in loops like
+//
+//     loop: lw   v0, 0x1070(t0)	; I_STAT
+//           nop
+//           andi v0, v0, 1
+//           beq  v0, zero, loop
+//           nop
+//
+// which can't make progress until an interrupt or a device event changes
+// what they read. Once such a loop has gone round with no change in register
+// state, the CPU stops executing until that can have happened.
+
+// Straight-line loop bodies only, branch and delay slot included
+static constexpr uint32_t IDLE_LOOP_MAX_WORDS = 16;
+
+// Iterations with identical register state before the loop counts as idle
+static constexpr int IDLE_LOOP_CONFIRM = 2;
+
+// Whether an instruction can appear in an idle loop body: loads, ALU ops
+// and nothing that writes memory, jumps, traps or touches a coprocessor
+static bool idle_safe(Opcode op)
+{
+	switch (op.opcode)
+	{
+	case 0x00:
+		switch (op.r_type.func)
+		{
+		case 0x00 ... 0x07:
+		case 0x10:
+		case 0x12:
+		case 0x20 ... 0x27:
+		case 0x2A:
+		case 0x2B:
+			return true;
+		default:
+			return false;
+		}
+	case 0x08 ... 0x0F:
+	case 0x20:
+	case 0x21:
+	case 0x23:
+	case 0x24:
+	case 0x25:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_branch(Opcode op)
+{
+	return op.opcode == 0x01 || (op.opcode >= 0x04 && op.opcode <= 0x07);
+}
+
+static bool is_load(Opcode op)
+{
+	return op.opcode >= 0x20 && op.opcode <= 0x25 && op.opcode != 0x22;
+}
+
+void CPU::idle_check_branch(uint32_t target)
+{
+	if (i.pc != idle_loop.branch_pc)
+	{
+		idle_loop.branch_pc = i.pc;
+		idle_loop.target = target;
+		idle_loop.pure = idle_scan();
+		idle_loop.matches = 0;
+	}
+	else if (!idle_loop.pure)
+	{
+		return;
+	}
+	else if (!memcmp(idle_loop.regs, regs, sizeof(regs)) && idle_loop.hi == hi && idle_loop.lo == lo)
+	{
+		if (++idle_loop.matches >= IDLE_LOOP_CONFIRM)
+			idle_enter();
+		return;
+	}
+	else
+	{
+		idle_loop.matches = 0;
+	}
+
+	memcpy(idle_loop.regs, regs, sizeof(regs));
+	idle_loop.hi = hi;
+	idle_loop.lo = lo;
+}
+
+bool CPU::idle_scan()
+{
+	uint32_t words = (i.pc - idle_loop.target) / 4 + 2;
+	if (words > IDLE_LOOP_MAX_WORDS)
+		return false;
+
+	for (uint32_t w = 0; w < words; w++)
+	{
+		Opcode op;
+		op.full = bus->read<uint32_t>(idle_loop.target + w * 4);
+
+		if (idle_loop.target + w * 4 == i.pc)
+			continue;
+		if (!idle_safe(op))
+			return false;
+	}
+
+	return true;
+}
+
+// Works out which addresses the loop reads, starting from the register
+// state at the branch: delay slot first, then the body. Only address
+// arithmetic is followed; a load whose base can't be known this way rules
+// the loop out.
+bool CPU::idle_classify()
+{
+	uint32_t vals[32];
+	uint32_t known = 0xFFFFFFFF;
+	memcpy(vals, regs, sizeof(vals));
+
+	idle_loop.wake_on_step = false;
+
+	uint32_t words = (i.pc - idle_loop.target) / 4 + 1;
+
+	for (uint32_t w = 0; w <= words; w++)
+	{
+		// Delay slot, then target .. branch
+		uint32_t addr = w == 0 ? i.pc + 4 : idle_loop.target + (w - 1) * 4;
+
+		Opcode op;
+		op.full = bus->read<uint32_t>(addr);
+
+		if (is_branch(op))
+			continue;
+
+		int rs = op.i_type.rs;
+		int rt = op.i_type.rt;
+		uint32_t imm = op.i_type.imm;
+		bool rs_known = known & (1 << rs);
+
+		if (is_load(op))
+		{
+			if (!rs_known)
+				return false;
+
+			uint32_t phys = (vals[rs] + (int16_t)imm) & 0x1FFFFFFF;
+
+			if (phys < 0x200000 || (phys & 0xfffffc00) == 0x1f800000)
+			{
+				// RAM only changes under an interrupt handler
+			}
+			else if (phys >= 0x1f801070 && phys < 0x1f801078)
+			{
+				// I_STAT / I_MASK
+			}
+			else if ((phys == 0x1f801800 || phys == 0x1f801803) && (op.opcode == 0x20 || op.opcode == 0x24))
+			{
+				// CD-ROM status and interrupt flags, changed by scheduler
+				// events. The response and data FIFOs in between pop on read
+			}
+			else if (phys >= 0x1f801810 && phys < 0x1f801818)
+			{
+				// GPUSTAT
+			}
+			else if (phys >= 0x1f801100 && phys < 0x1f801130)
+			{
+				// Timers move every step, so only the rest of the slice
+				// can be skipped
+				idle_loop.wake_on_step = true;
+			}
+			else
+			{
+				return false;
+			}
+
+			known &= ~(1u << rt);
+			continue;
+		}
+
+		switch (op.opcode)
+		{
+		case 0x0F:
+			vals[rt] = imm << 16;
+			known |= 1 << rt;
+			break;
+		case 0x0D:
+			vals[rt] = vals[rs] | imm;
+			known = rs_known ? known | (1 << rt) : known & ~(1u << rt);
+			break;
+		case 0x08:
+		case 0x09:
+			vals[rt] = vals[rs] + (int16_t)imm;
+			known = rs_known ? known | (1 << rt) : known & ~(1u << rt);
+			break;
+		case 0x00:
+			known &= ~(1u << op.r_type.rd);
+			break;
+		default:
+			known &= ~(1u << rt);
+			break;
+		}
+
+		vals[0] = 0;
+		known |= 1;
+	}
+
+	return true;
+}
+
+void CPU::idle_enter()
+{
+	if (!idle_classify())
+	{
+		idle_loop.pure = false;
+		return;
+	}
+
+	idle = true;
+	idle_loop.i_stat = bus->I_STAT;
+	idle_loop.events = bus->get_scheduler()->get_dispatched();
+}
+
+bool CPU::idle_should_wake()
+{
+	return idle_loop.wake_on_step
+		|| bus->I_STAT != idle_loop.i_stat
+		|| bus->get_scheduler()->get_dispatched() != idle_loop.events;
+}
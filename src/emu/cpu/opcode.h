@@ -6,7 +6,7 @@ struct Opcode
 {
     union
     {
-        uint32_t full;
+        uint32_t full = 0;
         struct
         { /* Used when polling for the opcode */
             uint32_t : 26;
@@ -35,7 +35,7 @@ struct Opcode
         } r_type;
     };
 
-    uint32_t pc;
+    uint32_t pc = 0;
     bool is_delay_slot = false;
 	bool branch_taken = false;
 };
\ No newline at end of file
@@ -6,55 +6,46 @@
 
 void CPU::op_special()
 {
-	switch (i.r_type.func)
-    {
-        case 0b000000: op_sll(); break;
-        case 0b100101: op_or(); break;
-        case 0b101011: op_sltu(); break;
-        case 0b100001: op_addu(); break;
-        case 0b001000: op_jr(); break;
-        case 0b100100: op_and(); break;
-        case 0b100000: op_add(); break;
-        case 0b001001: op_jalr(); break;
-        case 0b100011: op_subu(); break;
-        case 0b000011: op_sra(); break;
-		case 0b011010: op_div(); break;
-        case 0b010010: op_mflo(); break;
-        case 0b000010: op_srl(); break;
-        case 0b011011: op_divu(); break;
-        case 0b010000: op_mfhi(); break;
-        case 0b101010: op_slt(); break;
-        case 0b001100: op_syscall(); break;
-        case 0b010011: op_mtlo(); break;
-        case 0b010001: op_mthi(); break;
-        case 0b000100: op_sllv(); break;
-        case 0b100111: op_nor(); break;
-        case 0b000110: op_srlv(); break;
-        case 0b011001: op_multu(); break;
-        case 0b100110: op_xor(); break;
-        case 0b011000: op_mult(); break;
-		case 0b000111: op_srav(); break;
-		case 0b100010: op_sub(); break;
-		default:
-			printf("[emu/IOP]: Unknown special opcode 0x%02x\n", i.r_type.func);
-			exit(1);
-    }
+	(this->*special_table[i.r_type.func])();
 }
 
 void CPU::op_bcond()
 {
-    int rt = i.i_type.rt;
+	(this->*bcond_table[i.i_type.rt])();
+}
+
+// Only bit 0 (bltz/bgez) and bits 1-4 == 0x10 (link) of rt are decoded, the
+// table maps every other encoding onto one of these four
+void CPU::bcond(bool ge, bool link)
+{
     int rs = i.i_type.rs;
 
 	next_instr.is_delay_slot = true;
-	
-	bool should_link = (rt & 0x1E) == 0x10;
-	bool should_branch = (int)(regs[rs] ^ (rt << 31)) < 0;
 
-	if (should_link) regs[31] = i.pc + 8;
+	bool should_branch = ge ? (int32_t)regs[rs] >= 0 : (int32_t)regs[rs] < 0;
+
+	if (link) regs[31] = i.pc + 8;
 	if (should_branch) branch();
 
-    if (can_disassemble) printf("b%sz %s, 0x%08x\n", rt & 1 ? "lt" : "gt", Reg(rs), pc + ((int16_t)i.i_type.imm << 2));
+    if (can_disassemble) printf("b%sz%s %s, 0x%08x\n", ge ? "ge" : "lt", link ? "al" : "", Reg(rs), i.pc + 4 + ((int16_t)i.i_type.imm << 2));
+}
+
+void CPU::op_bltz() {bcond(false, false);}
+void CPU::op_bgez() {bcond(true, false);}
+void CPU::op_bltzal() {bcond(false, true);}
+void CPU::op_bgezal() {bcond(true, true);}
+
+void CPU::op_illegal()
+{
+	printf("[emu/IOP]: Illegal instruction 0x%08x at 0x%08x\n", i.full, i.pc);
+	exception(Exception::IllegalInstr);
+}
+
+void CPU::op_cop_unusable()
+{
+	// COP1 and COP3 don't exist, and COP0 has no load/store forms
+	if (can_disassemble) printf("cop%d access\n", i.opcode & 3);
+	exception(Exception::CoprocessorError, i.opcode & 3);
 }
 
 void CPU::op_j()
@@ -80,17 +71,11 @@ void CPU::op_beq()
     int rs = i.i_type.rs;
 	
 	next_instr.is_delay_slot = true;
-	std::string op = "beq " + std::string(Reg(rs)) + ", " + std::string(Reg(rt));
+
+	if (can_disassemble) printf("beq %s, %s, 0x%08x\n", Reg(rs), Reg(rt), next_instr.pc + ((int16_t)i.i_type.imm << 2));
+
 	if (regs[rs] == regs[rt])
-	{
-		branch(op);
-	}
-	else if (can_disassemble)
-	{
-		int32_t imm = (int16_t)i.i_type.imm;
-		uint32_t dest = next_instr.pc + (imm << 2);
-		printf("%s, 0x%08x\n", op.c_str(), dest);
-	}
+		branch();
 }
 
 void CPU::op_bne()
@@ -99,45 +84,39 @@ void CPU::op_bne()
     int rs = i.i_type.rs;
 	
 	next_instr.is_delay_slot = true;
-	std::string op = "bne " + std::string(Reg(rs)) + ", " + std::string(Reg(rt));
+
+	if (can_disassemble) printf("bne %s, %s, 0x%08x\n", Reg(rs), Reg(rt), next_instr.pc + ((int16_t)i.i_type.imm << 2));
+
 	if (regs[rs] != regs[rt])
-	{
-		branch(op);
-	}
-	else if (can_disassemble)
-	{
-		int32_t imm = (int16_t)i.i_type.imm;
-		uint32_t dest = next_instr.pc + (imm << 2);
-		printf("%s, 0x%08x\n", op.c_str(), dest);
-	}
+		branch();
 }
 
 void CPU::op_blez()
 {
     int rs = i.r_type.rs;
 
+	next_instr.is_delay_slot = true;
+
     int32_t reg = (int32_t)regs[rs];
 
-    if (can_disassemble) printf("blez %s, 0x%08x\n", Reg(rs), next_instr.pc + ((int16_t)i.i_type.imm << 2));
+    if (can_disassemble) printf("blez %s, 0x%08x\n", Reg(rs), i.pc + 4 + ((int16_t)i.i_type.imm << 2));
 
-    std::string op = "blez " + std::string(Reg(rs));
 	if (reg <= 0)
-    {
-		branch(op);
-    }
+		branch();
 }
 
 void CPU::op_bgtz()
 {
     int rs = i.r_type.rs;
 
+	next_instr.is_delay_slot = true;
+
     int32_t reg = (int32_t)regs[rs];
-    
-	std::string op = "bgez " + std::string(Reg(rs));
+
+    if (can_disassemble) printf("bgtz %s, 0x%08x\n", Reg(rs), i.pc + 4 + ((int16_t)i.i_type.imm << 2));
+
 	if (reg > 0)
-	{
-		branch(op);
-	}
+		branch();
 }
 
 void CPU::op_addi()
@@ -237,21 +216,25 @@ void CPU::op_lui()
 
 void CPU::op_cop0()
 {
-    switch (i.r_type.rs)
-    {
-    case 0:
-        op_mfc0();
-        break;
-    case 4:
-        op_mtc0();
-        break;
-	case 0x10:
-		op_rfe();
-		break;
-    default:
-        printf("[emu/CPU]: %s: Unknown cop0 opcode 0x%08x (0x%02x)\n", __FUNCTION__, i.full, i.r_type.rs);
-        Application::Exit(1);
-    }
+	(this->*cop0_table[i.r_type.rs])();
+}
+
+void CPU::mfc2()
+{
+	load(i.r_type.rt, gte.read_reg(i.r_type.rd));
+	if (can_disassemble) printf("mfc2 %s, r%d\n", Reg(i.r_type.rt), i.r_type.rd);
+}
+
+void CPU::cfc2()
+{
+	load(i.r_type.rt, gte.read_reg(i.r_type.rd + 32));
+	if (can_disassemble) printf("cfc2 %s, r%d\n", Reg(i.r_type.rt), i.r_type.rd + 32);
+}
+
+void CPU::mtc2()
+{
+	gte.write_reg(i.r_type.rd, regs[i.r_type.rt]);
+	if (can_disassemble) printf("mtc2 r%d, %s\n", i.r_type.rd, Reg(i.r_type.rt));
 }
 
 void CPU::ctc2()
@@ -262,15 +245,13 @@ void CPU::ctc2()
 
 void CPU::op_cop2()
 {
-    switch (i.r_type.rs)
-    {
-	case 0x06:
-		ctc2();
-		break;
-    default:
-        printf("[emu/CPU]: %s: Unknown cop2 opcode 0x%08x (0x%02x)\n", __FUNCTION__, i.full, i.r_type.rs);
-        Application::Exit(1);
-    }
+	(this->*cop2_table[i.r_type.rs])();
+}
+
+void CPU::op_gte()
+{
+	if (can_disassemble) printf("cop2 0x%07x\n", i.full & 0x1FFFFFF);
+	gte.execute(i.full & 0x1FFFFFF);
 }
 
 void CPU::op_lb()
@@ -436,7 +417,9 @@ void CPU::op_sb()
     
     if (can_disassemble) printf("sb %s, %d(%s)\n", Reg(rt), off, Reg(base));
 
-    if (!isCacheIsolated())
+    if (isCacheIsolated())
+        icache_store(addr);
+    else
         bus->write<uint8_t>(addr, regs[rt]);
 }
 
@@ -457,7 +440,9 @@ void CPU::op_sh()
 		exit(1);
 	}
 
-    if (!isCacheIsolated())
+    if (isCacheIsolated())
+        icache_store(addr);
+    else
         bus->write<uint16_t>(addr, regs[rt]);
 }
 
@@ -471,6 +456,12 @@ void CPU::op_swl()
 	uint32_t addr = regs[base] + offset;
 	int shift = addr & 0x3;
 
+	if (isCacheIsolated())
+	{
+		icache_store(addr);
+		return;
+	}
+
 	uint32_t mem = bus->read<uint32_t>(addr & ~3);
 
 	bus->write<uint32_t>(addr & ~0x3, (regs[source] >> SWL_SHIFT[shift]) | (mem & SWL_MASK[shift]));
@@ -492,7 +483,9 @@ void CPU::op_sw()
 		exit(1);
 	}
 
-    if (!isCacheIsolated())
+    if (isCacheIsolated())
+        icache_store(addr);
+    else
         bus->write(addr, regs[rt]);
 }
 
@@ -505,11 +498,59 @@ void CPU::op_swr()
 	uint32_t base = i.i_type.rs;
 	uint32_t addr = regs[base] + offset;
 	int shift = addr & 0x3;
+
+	if (isCacheIsolated())
+	{
+		icache_store(addr);
+		return;
+	}
+
 	uint32_t mem = bus->read<uint32_t>(addr & ~3);
 
 	bus->write<uint32_t>(addr & ~0x3, (regs[source] << SWR_SHIFT[shift]) | (mem & SWR_MASK[shift]));
 }
 
+void CPU::op_lwc2()
+{
+    int rt = i.i_type.rt;
+    int base = i.i_type.rs;
+    int16_t off = (int16_t)i.i_type.imm;
+
+    uint32_t vaddr = regs[base] + off;
+
+	if (vaddr & 3)
+	{
+		printf("Unaligned LWC2 at address 0x%08x!\n", vaddr);
+		exit(1);
+	}
+
+	gte.write_reg(rt, bus->read<uint32_t>(vaddr));
+
+    if (can_disassemble) printf("lwc2 r%d, %d(%s)\n", rt, off, Reg(base));
+}
+
+void CPU::op_swc2()
+{
+    int rt = i.i_type.rt;
+    int base = i.i_type.rs;
+    int16_t off = (int16_t)i.i_type.imm;
+
+    uint32_t addr = regs[base] + off;
+
+	if (can_disassemble) printf("swc2 r%d, %d(%s)\n", rt, off, Reg(base));
+
+	if (addr & 3)
+	{
+		printf("Unaligned SWC2!\n");
+		exit(1);
+	}
+
+    if (isCacheIsolated())
+        icache_store(addr);
+    else
+        bus->write<uint32_t>(addr, gte.read_reg(rt));
+}
+
 void CPU::op_sll()
 {
     int rt = i.r_type.rt;
@@ -612,6 +653,12 @@ void CPU::op_syscall()
 	if (can_disassemble) printf("syscall\n");
 }
 
+void CPU::op_break()
+{
+	exception(Exception::Break, 0);
+	if (can_disassemble) printf("break\n");
+}
+
 void CPU::op_addu()
 {
     int rt = i.r_type.rt;
@@ -835,6 +882,11 @@ void CPU::op_mfc0()
     int rt = i.r_type.rt;
     int rd = i.r_type.rd;
 
+	// Cause.IP2 mirrors the interrupt line, which isn't tracked while it
+	// can't be taken
+	if (rd == 13)
+		Cop0.cause.IP = (Cop0.cause.IP & ~0x4) | (bus->irq_pending << 2);
+
 	load(rt, Cop0.regs[rd]);
 
 	if (rd == 14)
@@ -850,6 +902,9 @@ void CPU::op_mtc0()
     int rd = i.r_type.rd;
 
     Cop0.regs[rd] = regs[rt];
+
+	if (rd == 12 || rd == 13)
+		update_int_enabled();
  
 	if (can_disassemble) printf("mtc0 %d, %s\n", rd, Reg(rt));
 }
@@ -861,5 +916,7 @@ void CPU::op_rfe()
 	Cop0.status.value &= ~(uint32_t)0xF;
 	Cop0.status.value |= mode >> 2;
 
+	update_int_enabled();
+
 	if (can_disassemble) printf("rfe\n");
 }
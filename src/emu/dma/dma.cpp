@@ -2,6 +2,7 @@
 #include <emu/memory/Bus.h>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 
 DMA::DMA(Bus* bus)
 : bus(bus)
@@ -9,7 +10,11 @@ DMA::DMA(Bus* bus)
 	dpcr = 0x07654321;
 	dicr = 0;
 
+	channels[0].RunFunc = std::bind(&DMA::HandleMDECIn, this);
+	channels[1].RunFunc = std::bind(&DMA::HandleMDECOut, this);
 	channels[2].RunFunc = std::bind(&DMA::HandleGPU, this);
+	channels[3].RunFunc = std::bind(&DMA::HandleCDROM, this);
+	channels[4].RunFunc = std::bind(&DMA::HandleSPU, this);
 	channels[6].RunFunc = std::bind(&DMA::HandleOTC, this);
 }
 
@@ -174,6 +179,122 @@ void DMA::HandleGPU()
 	}
 }
 
+void DMA::HandleCDROM()
+{
+	auto& chan = channels[3];
+
+	if (chan.chcr.sync_mode != 0)
+	{
+		printf("Unhandled CDROM sync mode %d\n", chan.chcr.sync_mode);
+		exit(1);
+	}
+
+	uint32_t addr = chan.madr;
+	uint32_t remsz = chan.bcr.word_count ? chan.bcr.word_count : 0x10000;
+
+	int inc = chan.chcr.address_step ? -4 : 4;
+
+	while (remsz > 0)
+	{
+		bus->write<uint32_t>(addr & 0x1ffffc, bus->get_cdvd()->read_data_word());
+
+		addr += inc;
+		remsz -= 1;
+	}
+
+	chan.chcr.busy = chan.chcr.start = 0;
+}
+
+void DMA::HandleSPU()
+{
+	auto& chan = channels[4];
+
+	if (chan.chcr.sync_mode != 1)
+	{
+		printf("Unhandled SPU sync mode %d\n", chan.chcr.sync_mode);
+		exit(1);
+	}
+
+	// Sound RAM is plain memory on the other end, so the whole transfer is
+	// copied in one go instead of word by word through the bus
+	uint32_t addr = chan.madr & 0x1ffffc;
+	uint32_t size = chan.bcr.blocksize * chan.bcr.block_count * 4;
+	uint8_t* ram = bus->get_ram();
+
+	while (size > 0)
+	{
+		uint32_t chunk = std::min(size, 0x200000 - addr);
+
+		if (chan.chcr.direction)
+			bus->get_spu()->dma_write(&ram[addr], chunk);
+		else
+			bus->get_spu()->dma_read(&ram[addr], chunk);
+
+		size -= chunk;
+		addr = (addr + chunk) & 0x1ffffc;
+	}
+
+	chan.madr = addr;
+	chan.chcr.busy = chan.chcr.start = 0;
+}
+
+void DMA::HandleMDECIn()
+{
+	auto& chan = channels[0];
+
+	if (chan.chcr.sync_mode != 1)
+	{
+		printf("Unhandled MDEC in sync mode %d\n", chan.chcr.sync_mode);
+		exit(1);
+	}
+
+	// Macroblock data is handed over straight from RAM, one run per wrap
+	uint32_t addr = chan.madr & 0x1ffffc;
+	uint32_t size = chan.bcr.blocksize * chan.bcr.block_count * 4;
+	uint8_t* ram = bus->get_ram();
+
+	while (size > 0)
+	{
+		uint32_t chunk = std::min(size, 0x200000 - addr);
+
+		bus->get_mdec()->dma_in((const uint32_t*)&ram[addr], chunk / 4);
+
+		size -= chunk;
+		addr = (addr + chunk) & 0x1ffffc;
+	}
+
+	chan.madr = addr;
+	chan.chcr.busy = chan.chcr.start = 0;
+}
+
+void DMA::HandleMDECOut()
+{
+	auto& chan = channels[1];
+
+	if (chan.chcr.sync_mode != 1)
+	{
+		printf("Unhandled MDEC out sync mode %d\n", chan.chcr.sync_mode);
+		exit(1);
+	}
+
+	uint32_t addr = chan.madr & 0x1ffffc;
+	uint32_t size = chan.bcr.blocksize * chan.bcr.block_count * 4;
+	uint8_t* ram = bus->get_ram();
+
+	while (size > 0)
+	{
+		uint32_t chunk = std::min(size, 0x200000 - addr);
+
+		bus->get_mdec()->dma_out((uint32_t*)&ram[addr], chunk / 4);
+
+		size -= chunk;
+		addr = (addr + chunk) & 0x1ffffc;
+	}
+
+	chan.madr = addr;
+	chan.chcr.busy = chan.chcr.start = 0;
+}
+
 uint32_t DMA::read_dma(uint32_t addr)
 {
 	int channel = ((addr >> 4) & 0xf) - 0x8;
@@ -192,3 +313,18 @@ uint32_t DMA::read_dma(uint32_t addr)
 		exit(1);
 	}
 }
+
+void DMA::do_state(StateStream& s)
+{
+	s.section("DMA ", 1);
+
+	s.value(dpcr);
+	s.value(dicr);
+
+	for (auto& channel : channels)
+	{
+		s.value(channel.madr);
+		s.value(channel.chcr);
+		s.value(channel.bcr);
+	}
+}
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <functional>
+#include <util/state.h>
 
 class Bus;
 
@@ -50,9 +51,9 @@ private:
 
 	struct Channel
 	{
-		uint32_t madr;
-		DN_CHCR chcr;
-		BCR bcr;
+		uint32_t madr = 0;
+		DN_CHCR chcr = {};
+		BCR bcr = {};
 		std::function<void()> RunFunc;
 	} channels[7];
 
@@ -60,6 +61,10 @@ private:
 
 	void HandleOTC();
 	void HandleGPU();
+	void HandleCDROM();
+	void HandleSPU();
+	void HandleMDECIn();
+	void HandleMDECOut();
 public:
 	DMA(Bus* bus);
 
@@ -68,4 +73,6 @@ public:
 
 	void write_dma(uint32_t addr, uint32_t data);
 	uint32_t read_dma(uint32_t addr);
+
+	void do_state(StateStream& s);
 };
\ No newline at end of file
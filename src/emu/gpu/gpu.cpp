@@ -4,8 +4,6 @@
 #include <fstream>
 #include <emu/renderer/renderer.h>
 
-extern renderer::Renderer* g_renderer;
-
 union ClutAttrib {
 	ushort raw;
 
@@ -96,7 +94,7 @@ void GPU::HandleGP0(uint32_t command)
 			{
 				const uint8_t opcode = parameters[0] >> 24;
 				auto polygon = renderer::DrawCommand{opcode}.polygon;
-				g_renderer->draw_polygon(polygon);
+				rasterizer->draw_polygon(polygon);
 				break;
 			}
 			case 0x60 ... 0x7F:
@@ -249,6 +247,12 @@ GPU::GPU()
 	gpustat.word = 0x1C802000;
 	mode = WAITING_ON_COMMAND;
 	m_vram = std::make_unique<std::array<uint16_t, VRAM_WIDTH * VRAM_HEIGHT>>();
+	rasterizer = new renderer::Renderer(this);
+}
+
+GPU::~GPU()
+{
+	delete rasterizer;
 }
 
 void GPU::Dump()
@@ -283,4 +287,42 @@ void GPU::write(uint32_t addr, uint32_t data)
 
 	printf("[emu/GPU]: Write to unknown address 0x%08x\n", addr);
 	exit(1);
-}
\ No newline at end of file
+}
+
+void GPU::do_state(StateStream& s)
+{
+	s.section("GPU ", 1);
+
+	s.value(gpuread);
+	s.value(mode);
+	s.vector(parameters);
+	s.value(param_count);
+	s.value(image_remaining);
+	s.value(cur_transfer_start_x);
+	s.value(cur_transfer_x);
+	s.value(cur_transfer_y);
+	s.value(cur_transfer_width);
+	s.value(cur_transfer_height);
+	s.value(transfer_x_start);
+	s.value(transfer_y_start);
+
+	s.value(draw_mode);
+	s.value(tex_window);
+	s.value(display_area);
+	s.value(hdisplay_range);
+	s.value(vdisplay_range);
+	s.value(drawing_area_top_left);
+	s.value(drawing_area_bottom_right);
+	s.value(drawing_offset);
+	s.value(gpustat);
+
+	s.bytes(m_vram->data(), m_vram->size() * sizeof(uint16_t));
+
+	// A command in progress has its opcode and fewer than all of its words
+	s.check(mode >= WAITING_ON_COMMAND && mode <= IMAGE_TRANSFER_FROM_VRAM);
+	if (mode == WAITING_PARAMS)
+		s.check(!parameters.empty() && parameters.size() < param_count && param_count <= 32);
+	else
+		s.check(parameters.empty());
+	s.check(mode != IMAGE_TRANSFER_TO_VRAM || (cur_transfer_x < VRAM_WIDTH && cur_transfer_y < VRAM_HEIGHT));
+}
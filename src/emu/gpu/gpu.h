@@ -5,6 +5,12 @@
 #include <glm/glm.hpp>
 #include <memory>
 #include <array>
+#include <util/state.h>
+
+namespace renderer
+{
+class Renderer;
+}
 
 constexpr uint32_t VRAM_WIDTH = 1024;
 constexpr uint32_t VRAM_HEIGHT = 512;
@@ -51,9 +57,9 @@ public:
 	uint32_t param_count = 0;
 	uint32_t image_remaining = 0;
 	uint32_t cur_transfer_start_x = 0;
-	uint16_t cur_transfer_x, cur_transfer_y;
-	uint16_t cur_transfer_width, cur_transfer_height = 0;
-	uint16_t transfer_x_start, transfer_y_start = 0;
+	uint16_t cur_transfer_x = 0, cur_transfer_y = 0;
+	uint16_t cur_transfer_width = 0, cur_transfer_height = 0;
+	uint16_t transfer_x_start = 0, transfer_y_start = 0;
 
 	glm::ivec2 PosFromGP0(uint32_t word);
 	glm::ivec3 ColFromGP0(uint32_t word); 
@@ -154,6 +160,8 @@ public:
 
 	std::unique_ptr<std::array<uint16_t, VRAM_WIDTH * VRAM_HEIGHT>> m_vram;
 
+	renderer::Renderer* rasterizer;
+
 	uint32_t read_from_vram();
 public:
 	void set_vram_pos(uint16_t x, uint16_t y, uint16_t val)
@@ -170,9 +178,15 @@ public:
 
 	std::vector<uint32_t> get_gp0() {return parameters;}
 
+	// Rasterizes into this GPU's VRAM and presents it
+	renderer::Renderer* get_renderer() {return rasterizer;}
+
 	GPU();
+	~GPU();
 	void Dump();
 
+	void do_state(StateStream& s);
+
 	uint32_t read(uint32_t addr);
 	void write(uint32_t addr, uint32_t data);
 };
\ No newline at end of file
@@ -0,0 +1,576 @@
+#include "mdec.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Row-major position of the k-th coefficient in zigzag scan order
+static constexpr uint8_t zagzig[64] =
+{
+	 0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// 4x4 Bayer matrix, scaled to the 3 bits lost going from 8 to 5 bits
+static constexpr int16_t dither_table[4][8] =
+{
+	{0, 4, 1, 5, 0, 4, 1, 5},
+	{6, 2, 7, 3, 6, 2, 7, 3},
+	{1, 5, 0, 4, 1, 5, 0, 4},
+	{7, 3, 6, 2, 7, 3, 6, 2},
+};
+
+// YUV -> RGB factors as 16-bit fractions, split so every multiply fits a
+// signed 16-bit lane: R = Cr * 1.402, G = -(Cb * 0.3437 + Cr * 0.7143),
+// B = Cb * 1.772
+static constexpr int16_t CR_R = 26345;		// 1.402 - 1
+static constexpr int16_t CB_G = 22525;		// 0.3437
+static constexpr int16_t CR_G = 18724;		// 1 - 0.7143
+static constexpr int16_t CB_B = 14942;		// 2 - 1.772
+
+#ifndef __SSE2__
+static int32_t mulhi(int32_t a, int32_t b)
+{
+	return (a * b) >> 16;
+}
+#endif
+
+static int32_t signed10(uint16_t value)
+{
+	return (int16_t)(value << 6) >> 6;
+}
+
+MDEC::MDEC()
+{
+	unsigned int threads = std::thread::hardware_concurrency();
+	workers = threads > 1 ? threads - 1 : 0;
+}
+
+void MDEC::start_command(uint32_t word)
+{
+	depth = (word >> 27) & 3;
+	is_signed = (word >> 26) & 1;
+	set_bit15 = (word >> 25) & 1;
+
+	input.clear();
+
+	switch (word >> 29)
+	{
+	case 1:
+		command = Command::Decode;
+		remaining = word & 0xFFFF;
+		output.clear();
+		output_pos = 0;
+		break;
+	case 2:
+		command = Command::SetQuant;
+		color_quant = word & 1;
+		remaining = color_quant ? 32 : 16;
+		break;
+	case 3:
+		command = Command::SetScale;
+		remaining = 32;
+		break;
+	default:
+		command = Command::None;
+		remaining = 0;
+		return;
+	}
+
+	if (!remaining)
+		finish_command();
+}
+
+void MDEC::finish_command()
+{
+	switch (command)
+	{
+	case Command::Decode:
+		decode_macroblocks();
+		break;
+	case Command::SetQuant:
+		std::memcpy(quant_luma, input.data(), 64);
+		if (color_quant)
+			std::memcpy(quant_color, (const uint8_t*)input.data() + 64, 64);
+		break;
+	case Command::SetScale:
+		std::memcpy(scale_table, input.data(), sizeof(scale_table));
+
+		for (int p = 0; p < 4; p++)
+		{
+			for (int x = 0; x < 8; x++)
+			{
+				idct_pairs[p][x * 2 + 0] = scale_table[(p * 2 + 0) * 8 + x];
+				idct_pairs[p][x * 2 + 1] = scale_table[(p * 2 + 1) * 8 + x];
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	input.clear();
+	command = Command::None;
+}
+
+uint32_t MDEC::macroblock_words() const
+{
+	switch (depth)
+	{
+	case Depth4Bit:
+		return 8 * 8 / 2 / 4;
+	case Depth8Bit:
+		return 8 * 8 / 4;
+	case Depth24Bit:
+		return 16 * 16 * 3 / 4;
+	default:
+		return 16 * 16 * 2 / 4;
+	}
+}
+
+void MDEC::decode_macroblocks()
+{
+	const uint16_t* src = (const uint16_t*)input.data();
+	const uint16_t* end = src + input.size() * 2;
+
+	const uint32_t words = macroblock_words();
+	const int blocks = (depth == Depth4Bit || depth == Depth8Bit) ? 1 : 6;
+
+	// Only the run-length structure has to be walked serially to find where
+	// each macroblock starts
+	macroblock_starts.clear();
+
+	for (;;)
+	{
+		// Trailing padding isn't a macroblock
+		while (src < end && *src == 0xFE00)
+			src++;
+		if (src >= end)
+			break;
+
+		macroblock_starts.push_back(src);
+		for (int i = 0; i < blocks; i++)
+			src = skip_block(src, end);
+	}
+
+	const size_t count = macroblock_starts.size();
+	const size_t base = output.size();
+	output.resize(base + count * words);
+
+	auto decode = [this, end, words, base](size_t i)
+	{
+		decode_macroblock(macroblock_starts[i], end, &output[base + i * words]);
+	};
+
+	if (count < PARALLEL_MIN_MACROBLOCKS || !workers)
+	{
+		for (size_t i = 0; i < count; i++)
+			decode(i);
+		return;
+	}
+
+	if (!pool)
+		pool = std::make_unique<ThreadPool>(workers);
+
+	pool->parallel_for(count, decode);
+}
+
+// Same walk as decode_block(), without producing any coefficients
+const uint16_t* MDEC::skip_block(const uint16_t* src, const uint16_t* end) const
+{
+	while (src < end && *src == 0xFE00)
+		src++;
+	if (src >= end)
+		return end;
+
+	src++;
+
+	for (int k = 0; src < end;)
+	{
+		k += ((*src++ >> 10) & 0x3F) + 1;
+		if (k > 63)
+			break;
+	}
+
+	return src;
+}
+
+const uint16_t* MDEC::decode_macroblock(const uint16_t* src, const uint16_t* end, uint32_t* out) const
+{
+	alignas(32) int16_t blocks[6][64];
+	uint8_t* pixels = (uint8_t*)out;
+
+	if (depth == Depth4Bit || depth == Depth8Bit)
+	{
+		src = decode_block(src, end, quant_luma, blocks[0]);
+		idct(blocks[0]);
+		y_to_mono(blocks[0], pixels);
+		return src;
+	}
+
+	// Cr, Cb, then the four luma blocks
+	src = decode_block(src, end, quant_color, blocks[0]);
+	src = decode_block(src, end, quant_color, blocks[1]);
+	for (int i = 2; i < 6; i++)
+		src = decode_block(src, end, quant_luma, blocks[i]);
+
+	for (int i = 0; i < 6; i++)
+		idct(blocks[i]);
+
+	yuv_to_rgb(blocks[0], blocks[1], blocks[2], 0, 0, pixels);
+	yuv_to_rgb(blocks[0], blocks[1], blocks[3], 8, 0, pixels);
+	yuv_to_rgb(blocks[0], blocks[1], blocks[4], 0, 8, pixels);
+	yuv_to_rgb(blocks[0], blocks[1], blocks[5], 8, 8, pixels);
+
+	return src;
+}
+
+const uint16_t* MDEC::decode_block(const uint16_t* src, const uint16_t* end, const uint8_t* qt, int16_t* blk) const
+{
+	std::fill(blk, blk + 64, 0);
+
+	while (src < end && *src == 0xFE00)
+		src++;
+	if (src >= end)
+		return end;
+
+	uint16_t n = *src++;
+	int k = 0;
+	int q_scale = (n >> 10) & 0x3F;
+
+	// The DC coefficient isn't scaled by q_scale
+	int32_t value = signed10(n) * qt[0];
+
+	for (;;)
+	{
+		if (!q_scale)
+			value = signed10(n) * 2;
+
+		value = std::clamp(value, -0x400, 0x3FF);
+
+		if (q_scale)
+			blk[zagzig[k]] = value;
+		else
+			blk[k] = value;
+
+		if (src >= end)
+			break;
+
+		n = *src++;
+		k += ((n >> 10) & 0x3F) + 1;
+
+		if (k > 63)
+			break;
+
+		value = (signed10(n) * qt[k] * q_scale + 4) / 8;
+	}
+
+	return src;
+}
+
+// One pass of the separable IDCT: dst[y][x] = sum(z) src[z][y] * scale[z][x],
+// i.e. multiply by the scale table and transpose. Two passes make the full
+// 2D transform.
+void MDEC::idct_pass(const int16_t* src, int16_t* dst) const
+{
+	for (int y = 0; y < 8; y++)
+	{
+#if defined(__AVX2__)
+		__m256i acc = _mm256_setzero_si256();
+
+		for (int p = 0; p < 4; p++)
+		{
+			uint32_t pair = (uint16_t)src[y + p * 16] | ((uint32_t)(uint16_t)src[y + p * 16 + 8] << 16);
+			__m256i coeffs = _mm256_load_si256((const __m256i*)idct_pairs[p]);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi32(pair), coeffs));
+		}
+
+		acc = _mm256_srai_epi32(_mm256_add_epi32(acc, _mm256_set1_epi32(0x8000)), 16);
+		__m128i row = _mm_packs_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+		_mm_store_si128((__m128i*)&dst[y * 8], row);
+#elif defined(__SSE2__)
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+
+		for (int p = 0; p < 4; p++)
+		{
+			uint32_t pair = (uint16_t)src[y + p * 16] | ((uint32_t)(uint16_t)src[y + p * 16 + 8] << 16);
+			__m128i b = _mm_set1_epi32(pair);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(b, _mm_load_si128((const __m128i*)&idct_pairs[p][0])));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(b, _mm_load_si128((const __m128i*)&idct_pairs[p][8])));
+		}
+
+		const __m128i round = _mm_set1_epi32(0x8000);
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 16);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 16);
+		_mm_store_si128((__m128i*)&dst[y * 8], _mm_packs_epi32(lo, hi));
+#else
+		for (int x = 0; x < 8; x++)
+		{
+			int32_t sum = 0;
+			for (int z = 0; z < 8; z++)
+				sum += src[y + z * 8] * scale_table[z * 8 + x];
+			dst[y * 8 + x] = std::clamp((sum + 0x8000) >> 16, -0x8000, 0x7FFF);
+		}
+#endif
+	}
+}
+
+void MDEC::idct(int16_t* blk) const
+{
+	alignas(32) int16_t tmp[64];
+
+	idct_pass(blk, tmp);
+	idct_pass(tmp, blk);
+}
+
+void MDEC::yuv_to_rgb(const int16_t* cr, const int16_t* cb, const int16_t* yblk, int xx, int yy, uint8_t* out) const
+{
+	const int16_t offset = is_signed ? 0 : 0x80;
+	const bool dither = dithering && !is_signed && depth == Depth15Bit;
+	const uint16_t bit15 = set_bit15 ? 0x8000 : 0;
+
+	for (int y = 0; y < 8; y++)
+	{
+		alignas(16) int16_t r[8], g[8], b[8];
+
+		const int16_t* crr = &cr[((y + yy) / 2) * 8 + xx / 2];
+		const int16_t* cbr = &cb[((y + yy) / 2) * 8 + xx / 2];
+
+#ifdef __SSE2__
+		__m128i c_r = _mm_loadl_epi64((const __m128i*)crr);
+		__m128i c_b = _mm_loadl_epi64((const __m128i*)cbr);
+		c_r = _mm_unpacklo_epi16(c_r, c_r);
+		c_b = _mm_unpacklo_epi16(c_b, c_b);
+
+		__m128i rr = _mm_add_epi16(c_r, _mm_mulhi_epi16(c_r, _mm_set1_epi16(CR_R)));
+		__m128i gg = _mm_sub_epi16(_mm_sub_epi16(_mm_setzero_si128(), _mm_mulhi_epi16(c_b, _mm_set1_epi16(CB_G))),
+									_mm_sub_epi16(c_r, _mm_mulhi_epi16(c_r, _mm_set1_epi16(CR_G))));
+		__m128i bb = _mm_sub_epi16(_mm_add_epi16(c_b, c_b), _mm_mulhi_epi16(c_b, _mm_set1_epi16(CB_B)));
+
+		__m128i luma = _mm_load_si128((const __m128i*)&yblk[y * 8]);
+		const __m128i lo = _mm_set1_epi16(-128), hi = _mm_set1_epi16(127);
+		const __m128i off = _mm_set1_epi16(offset);
+
+		rr = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_adds_epi16(luma, rr), lo), hi), off);
+		gg = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_adds_epi16(luma, gg), lo), hi), off);
+		bb = _mm_add_epi16(_mm_min_epi16(_mm_max_epi16(_mm_adds_epi16(luma, bb), lo), hi), off);
+
+		if (depth == Depth15Bit)
+		{
+			const __m128i mask = _mm_set1_epi16(0xFF);
+
+			if (dither)
+			{
+				__m128i d = _mm_loadu_si128((const __m128i*)dither_table[(y + yy) & 3]);
+				rr = _mm_min_epi16(_mm_add_epi16(rr, d), mask);
+				gg = _mm_min_epi16(_mm_add_epi16(gg, d), mask);
+				bb = _mm_min_epi16(_mm_add_epi16(bb, d), mask);
+			}
+
+			__m128i pix = _mm_srli_epi16(_mm_and_si128(rr, mask), 3);
+			pix = _mm_or_si128(pix, _mm_slli_epi16(_mm_srli_epi16(_mm_and_si128(gg, mask), 3), 5));
+			pix = _mm_or_si128(pix, _mm_slli_epi16(_mm_srli_epi16(_mm_and_si128(bb, mask), 3), 10));
+			pix = _mm_or_si128(pix, _mm_set1_epi16(bit15));
+
+			_mm_storeu_si128((__m128i*)&out[((y + yy) * 16 + xx) * 2], pix);
+			continue;
+		}
+
+		_mm_store_si128((__m128i*)r, rr);
+		_mm_store_si128((__m128i*)g, gg);
+		_mm_store_si128((__m128i*)b, bb);
+#else
+		for (int x = 0; x < 8; x++)
+		{
+			int32_t c_r = crr[x / 2], c_b = cbr[x / 2];
+			int32_t luma = yblk[y * 8 + x];
+
+			int32_t rr = (int16_t)(c_r + mulhi(c_r, CR_R));
+			int32_t gg = (int16_t)(-mulhi(c_b, CB_G) - (c_r - mulhi(c_r, CR_G)));
+			int32_t bb = (int16_t)(c_b * 2 - mulhi(c_b, CB_B));
+
+			r[x] = std::clamp(luma + rr, -128, 127) + offset;
+			g[x] = std::clamp(luma + gg, -128, 127) + offset;
+			b[x] = std::clamp(luma + bb, -128, 127) + offset;
+
+			if (dither)
+			{
+				r[x] = std::min(r[x] + dither_table[(y + yy) & 3][x], 0xFF);
+				g[x] = std::min(g[x] + dither_table[(y + yy) & 3][x], 0xFF);
+				b[x] = std::min(b[x] + dither_table[(y + yy) & 3][x], 0xFF);
+			}
+		}
+
+		if (depth == Depth15Bit)
+		{
+			uint16_t* row = (uint16_t*)&out[((y + yy) * 16 + xx) * 2];
+			for (int x = 0; x < 8; x++)
+				row[x] = ((r[x] & 0xFF) >> 3) | (((g[x] & 0xFF) >> 3) << 5) | (((b[x] & 0xFF) >> 3) << 10) | bit15;
+			continue;
+		}
+#endif
+
+		uint8_t* row = &out[((y + yy) * 16 + xx) * 3];
+		for (int x = 0; x < 8; x++)
+		{
+			row[x * 3 + 0] = r[x];
+			row[x * 3 + 1] = g[x];
+			row[x * 3 + 2] = b[x];
+		}
+	}
+}
+
+void MDEC::y_to_mono(const int16_t* y, uint8_t* out) const
+{
+	const int offset = is_signed ? 0 : 0x80;
+
+	for (int i = 0; i < 64; i++)
+	{
+		uint8_t value = std::clamp<int>(y[i], -128, 127) + offset;
+
+		if (depth == Depth8Bit)
+			out[i] = value;
+		else if (i & 1)
+			out[i / 2] |= (value >> 4) << 4;
+		else
+			out[i / 2] = value >> 4;
+	}
+}
+
+void MDEC::dma_in(const uint32_t* src, size_t words)
+{
+	while (words > 0)
+	{
+		if (!remaining)
+		{
+			start_command(*src++);
+			words--;
+			continue;
+		}
+
+		size_t count = std::min<size_t>(words, remaining);
+		input.insert(input.end(), src, src + count);
+
+		src += count;
+		words -= count;
+		remaining -= count;
+
+		if (!remaining)
+			finish_command();
+	}
+}
+
+void MDEC::dma_out(uint32_t* dst, size_t words)
+{
+	size_t count = std::min(words, output.size() - output_pos);
+
+	std::memcpy(dst, &output[output_pos], count * 4);
+	output_pos += count;
+
+	// Reading past the decoded data returns zeroes
+	std::memset(dst + count, 0, (words - count) * 4);
+}
+
+uint32_t MDEC::read(uint32_t addr)
+{
+	switch (addr)
+	{
+	case 0x1f801820:
+	{
+		uint32_t word = 0;
+		dma_out(&word, 1);
+		return word;
+	}
+	case 0x1f801824:
+	{
+		uint32_t status = 0;
+
+		if (output_pos >= output.size())
+			status |= 1u << 31;
+		if (remaining)
+			status |= 1 << 29;
+		if (dma_in_enabled)
+			status |= 1 << 28;
+		if (dma_out_enabled && output_pos < output.size())
+			status |= 1 << 27;
+
+		status |= depth << 25;
+		status |= is_signed << 24;
+		status |= set_bit15 << 23;
+		status |= (remaining - 1) & 0xFFFF;
+		return status;
+	}
+	default:
+		printf("[emu/MDEC]: Read from unknown address 0x%08x\n", addr);
+		exit(1);
+	}
+}
+
+void MDEC::write(uint32_t addr, uint32_t data)
+{
+	switch (addr)
+	{
+	case 0x1f801820:
+		dma_in(&data, 1);
+		break;
+	case 0x1f801824:
+		if (data & (1u << 31))
+		{
+			command = Command::None;
+			remaining = 0;
+			depth = 0;
+			is_signed = set_bit15 = false;
+			input.clear();
+			output.clear();
+			output_pos = 0;
+		}
+
+		dma_in_enabled = data & (1 << 30);
+		dma_out_enabled = data & (1 << 29);
+		break;
+	default:
+		printf("[emu/MDEC]: Write to unknown address 0x%08x\n", addr);
+		exit(1);
+	}
+}
+
+void MDEC::do_state(StateStream& s)
+{
+	s.section("MDEC", 1);
+
+	s.value(command);
+	s.value(remaining);
+
+	s.value(depth);
+	s.value(is_signed);
+	s.value(set_bit15);
+	s.value(color_quant);
+
+	s.value(dma_in_enabled);
+	s.value(dma_out_enabled);
+
+	s.value(quant_luma);
+	s.value(quant_color);
+	s.value(scale_table);
+	s.value(idct_pairs);
+
+	s.vector(input);
+	s.vector(output);
+	s.value(output_pos);
+
+	s.check(output_pos <= output.size());
+	s.check(command != Command::SetQuant || input.size() + remaining == (color_quant ? 32u : 16u));
+	s.check(command != Command::SetScale || input.size() + remaining == 32);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <memory>
+#include <util/thread_pool.h>
+#include <util/state.h>
+
+// Macroblock decoder. Input (commands and RLE data) is collected until the
+// current command has all of its parameter words, then decoded in one go;
+// the decoded pixels sit in the output buffer until read back through
+// 0x1f801820 or DMA channel 1.
+//
+// Macroblocks of a burst are independent once their boundaries are known,
+// so larger bursts are split up and decoded on a thread pool, each into its
+// own slot of the output buffer. The pool is only started by the first such
+// burst, so machines that never play a movie don't own idle threads.
+class MDEC
+{
+private:
+	enum class Command : uint8_t
+	{
+		None,
+		Decode,
+		SetQuant,
+		SetScale,
+	};
+
+	enum Depth
+	{
+		Depth4Bit = 0,
+		Depth8Bit = 1,
+		Depth24Bit = 2,
+		Depth15Bit = 3,
+	};
+
+	Command command = Command::None;
+	uint32_t remaining = 0;			// Parameter words still expected
+
+	uint32_t depth = 0;
+	bool is_signed = false;
+	bool set_bit15 = false;
+	bool color_quant = false;
+
+	bool dma_in_enabled = false;
+	bool dma_out_enabled = false;
+	bool dithering = false;
+
+	uint8_t quant_luma[64] = {};
+	uint8_t quant_color[64] = {};
+	int16_t scale_table[64] = {};
+
+	// Scale table rows interleaved in pairs, (s[z][x], s[z+1][x]) for
+	// x = 0..7, so one madd handles two rows of the IDCT sum
+	alignas(32) int16_t idct_pairs[4][16] = {};
+
+	// Bursts smaller than this aren't worth waking the workers for
+	static constexpr size_t PARALLEL_MIN_MACROBLOCKS = 16;
+
+	size_t workers;
+	std::unique_ptr<ThreadPool> pool;
+	std::vector<const uint16_t*> macroblock_starts;
+
+	std::vector<uint32_t> input;
+	std::vector<uint32_t> output;
+	size_t output_pos = 0;
+
+	void start_command(uint32_t word);
+	void finish_command();
+
+	uint32_t macroblock_words() const;
+	void decode_macroblocks();
+	const uint16_t* skip_block(const uint16_t* src, const uint16_t* end) const;
+	const uint16_t* decode_macroblock(const uint16_t* src, const uint16_t* end, uint32_t* out) const;
+	const uint16_t* decode_block(const uint16_t* src, const uint16_t* end, const uint8_t* qt, int16_t* blk) const;
+
+	void idct_pass(const int16_t* src, int16_t* dst) const;
+	void idct(int16_t* blk) const;
+
+	void yuv_to_rgb(const int16_t* cr, const int16_t* cb, const int16_t* y, int xx, int yy, uint8_t* out) const;
+	void y_to_mono(const int16_t* y, uint8_t* out) const;
+public:
+	MDEC();
+
+	uint32_t read(uint32_t addr);
+	void write(uint32_t addr, uint32_t data);
+
+	// DMA channels 0 (in) and 1 (out), whole bursts at a time
+	void dma_in(const uint32_t* src, size_t words);
+	void dma_out(uint32_t* dst, size_t words);
+
+	// Ordered dithering when truncating to 15-bit output; off by default,
+	// the hardware simply truncates
+	void set_dithering(bool enabled) {dithering = enabled;}
+
+	// Worker threads for large bursts, one less than the host has cores by
+	// default; 0 decodes on the calling thread
+	void set_workers(size_t threads)
+	{
+		if (threads != workers)
+			pool.reset();
+		workers = threads;
+	}
+
+	// A forked child has none of the parent's threads: abandons the pool
+	// (its workers can't be joined) and decodes on the calling thread
+	void detach_workers()
+	{
+		(void)pool.release();
+		workers = 0;
+	}
+
+	void do_state(StateStream& s);
+};
@@ -1,21 +1,57 @@
 #include "Bus.h"
 #include <fstream>
 #include <cstring>
+#include <algorithm>
 #include <emu/cpu/cpu.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 Bus::Bus(std::string biosFileName)
 {
-	std::ifstream file(biosFileName, std::ios::ate | std::ios::binary);
-	size_t size = file.tellg();
-	file.seekg(0, std::ios::beg);
+	int fd = open(biosFileName.c_str(), O_RDONLY);
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) || st.st_size != BIOS_SIZE)
+	{
+		printf("[emu/Bus]: %s is not a %d KiB BIOS image\n", biosFileName.c_str(), BIOS_SIZE / 1024);
+		exit(1);
+	}
 
-	file.read((char*)bios, size);
-	file.close();
+	void* map = mmap(nullptr, BIOS_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
+	if (map == MAP_FAILED)
+	{
+		printf("[emu/Bus]: Couldn't map %s\n", biosFileName.c_str());
+		exit(1);
+	}
+
+	bios = (const uint8_t*)map;
+
+	scheduler = new Scheduler();
 	dma = new DMA(this);
 	gpu = new GPU();
 	dvd = new CDVD(this);
+	spu = new SPU(this);
+	mdec = new MDEC();
 	timers = new Timers(this);
+	sio = new SIO(this);
+}
+
+Bus::~Bus()
+{
+	delete sio;
+	delete timers;
+	delete mdec;
+	delete spu;
+	delete dvd;
+	delete gpu;
+	delete dma;
+	delete scheduler;
+
+	munmap((void*)bios, BIOS_SIZE);
 }
 
 void Bus::Dump()
@@ -28,9 +64,56 @@ void Bus::Dump()
 	out.close();
 }
 
+void Bus::move(uint32_t dst, uint32_t src, uint32_t size)
+{
+	uint8_t* host_dst = get_host_pointer(dst, size);
+	uint8_t* host_src = get_host_pointer(src, size);
+
+	if (host_dst && host_src)
+	{
+		std::memmove(host_dst, host_src, size);
+		return;
+	}
+
+	if (dst <= src)
+	{
+		for (uint32_t i = 0; i < size; i++)
+			write<uint8_t>(dst + i, read<uint8_t>(src + i));
+	}
+	else
+	{
+		for (uint32_t i = size; i > 0; i--)
+			write<uint8_t>(dst + i - 1, read<uint8_t>(src + i - 1));
+	}
+}
+
 void Bus::TriggerInterrupt(int interrupt)
 {
 	I_STAT |= (1 << interrupt);
+	update_irq();
+}
+
+void Bus::do_state(StateStream& s)
+{
+	s.section("BUS ", 1);
+
+	s.value(ram);
+	s.value(scratchpad);
+	s.value(I_MASK);
+	s.value(I_STAT);
+	s.value(cache_control);
+
+	if (s.is_loading())
+		update_irq();
+
+	scheduler->do_state(s);
+	dma->do_state(s);
+	gpu->do_state(s);
+	dvd->do_state(s);
+	spu->do_state(s);
+	mdec->do_state(s);
+	timers->do_state(s);
+	sio->do_state(s);
 }
 
 struct PSEXEHeader
@@ -51,33 +134,58 @@ struct PSEXEHeader
 	char ascii_marker[];
 };
 
-void Bus::LoadEXE(std::string exe_name, CPU* cpu)
+void Bus::LoadEXE(std::string exe_name, CPU* cpu, uint32_t stack)
 {
 	std::ifstream file(exe_name, std::ios::ate | std::ios::binary);
-	size_t size = file.tellg();
-	uint8_t* buf = new uint8_t[size];
+
+	if (!file.is_open())
+	{
+		printf("[emu/Bus]: Couldn't open %s\n", exe_name.c_str());
+		exit(1);
+	}
+
+	std::vector<uint8_t> buf(file.tellg());
 	file.seekg(0, std::ios::beg);
-	file.read((char*)buf, size);
+	file.read((char*)buf.data(), buf.size());
 
-	file.close();
+	LoadEXE(buf, cpu, stack);
+}
 
-	PSEXEHeader* hdr = (PSEXEHeader*)buf;
+void Bus::LoadEXE(const std::vector<uint8_t>& exe, CPU* cpu, uint32_t stack)
+{
+	PSEXEHeader* hdr = (PSEXEHeader*)exe.data();
 
-	if (std::strncmp(hdr->magic, "PS-X EXE", 8))
+	if (exe.size() < 0x800 || std::strncmp(hdr->magic, "PS-X EXE", 8))
 	{
 		printf("Invalid PS-X EXE magic\n");
 		exit(1);
 	}
 
+	uint32_t size = std::min<size_t>(hdr->file_size, exe.size() - 0x800);
+
+	uint32_t sp = hdr->initial_sp_base ? hdr->initial_sp_base + hdr->initial_sp_offset : stack;
+
 	printf("[emu/Bus]: Loading EXE to 0x%08x\n", hdr->destination);
-	printf("[emu/Bus]: Stack is at 0x%08x\n", hdr->initial_sp_base + hdr->initial_sp_offset);\
+	printf("[emu/Bus]: Stack is at 0x%08x\n", sp);
 
-	for (int i = 0; i < hdr->file_size; i++)
+	if (uint8_t* dst = get_host_pointer(hdr->destination, size))
+		std::memcpy(dst, &exe[0x800], size);
+	else
 	{
-		write<uint8_t>(hdr->destination+i, buf[i+0x800]);
+		for (uint32_t i = 0; i < size; i++)
+			write<uint8_t>(hdr->destination + i, exe[0x800 + i]);
 	}
 
-	cpu->JumpToExe(hdr->initial_pc, hdr->initial_sp_base + hdr->initial_sp_offset);
+	if (hdr->bss_section_size)
+	{
+		if (uint8_t* bss = get_host_pointer(hdr->bss_section_start, hdr->bss_section_size))
+			std::memset(bss, 0, hdr->bss_section_size);
+		else
+		{
+			for (uint32_t i = 0; i < hdr->bss_section_size; i++)
+				write<uint8_t>(hdr->bss_section_start + i, 0);
+		}
+	}
 
-	delete[] buf;
+	cpu->JumpToExe(hdr->initial_pc, hdr->initial_gp, sp);
 }
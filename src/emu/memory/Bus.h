@@ -2,10 +2,16 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
+#include <util/state.h>
 #include <emu/dma/dma.h>
 #include <emu/gpu/gpu.h>
 #include <emu/cdvd/cdvd.h>
+#include <emu/spu/spu.h>
+#include <emu/mdec/mdec.h>
 #include <emu/timer/timers.h>
+#include <emu/sio/sio.h>
+#include <emu/scheduler/scheduler.h>
 
 class CPU;
 
@@ -13,8 +19,11 @@ class Bus
 {
 	friend class System;
 private:
-	uint8_t bios[0x80000];
-	uint8_t ram[0x200000];
+	// Mapped read-only from the file, so every instance with the same BIOS
+	// shares one copy in the page cache
+	const uint8_t* bios;
+	uint8_t ram[0x200000] = {};
+	uint8_t scratchpad[0x400] = {};
 
 	static uint32_t Translate(uint32_t addr)
     {
@@ -38,25 +47,75 @@ private:
 	DMA* dma;
 	GPU* gpu;
 	CDVD* dvd;
+	SPU* spu;
+	MDEC* mdec;
 	Timers* timers;
+	SIO* sio;
+	Scheduler* scheduler;
 public:
 	uint32_t I_MASK = 0;
 	uint32_t I_STAT = 0;
 
+	// I_STAT & I_MASK != 0, kept up to date on every change to either so the
+	// CPU only has to test one flag
+	bool irq_pending = false;
+
+	void update_irq() {irq_pending = (I_STAT & I_MASK) != 0;}
+
+	// 0xfffe0130, bit 11 enables the instruction cache
+	uint32_t cache_control = 0;
+
 	void step() 
 	{
 		timers->step(300);
-		dvd->step();
+		scheduler->advance(300);
 	}
 
 	GPU* get_gpu() {return gpu;}
+	CDVD* get_cdvd() {return dvd;}
+	SPU* get_spu() {return spu;}
+	MDEC* get_mdec() {return mdec;}
+	SIO* get_sio() {return sio;}
+	uint8_t* get_ram() {return ram;}
+	Scheduler* get_scheduler() {return scheduler;}
+
+	static constexpr uint32_t BIOS_SIZE = 0x80000;
 
 	Bus(std::string biosFileName);
+	~Bus();
 	void Dump();
 
 	void TriggerInterrupt(int interrupt);
 
-	void LoadEXE(std::string exe_name, CPU* cpu);
+	// RAM, interrupt registers and every device on the bus; the BIOS ROM
+	// is left out
+	void do_state(StateStream& s);
+
+	// Side-loads a PS-X EXE and points the CPU at it; the BIOS must already
+	// be initialized (see System::FastBoot). The stack is used when the
+	// header doesn't give one
+	void LoadEXE(std::string exe_name, CPU* cpu, uint32_t stack = DEFAULT_EXE_STACK);
+	void LoadEXE(const std::vector<uint8_t>& exe, CPU* cpu, uint32_t stack = DEFAULT_EXE_STACK);
+
+	static constexpr uint32_t DEFAULT_EXE_STACK = 0x801FFF00;
+
+	// Host pointer to [addr, addr + size) if it lies entirely inside RAM or
+	// the scratchpad, nullptr otherwise
+	uint8_t* get_host_pointer(uint32_t addr, uint32_t size)
+	{
+		addr = Translate(addr);
+
+		// Against the space left, so a huge size can't wrap around
+		if (addr < 0x200000 && size <= 0x200000 - addr)
+			return &ram[addr];
+		if ((addr & 0xfffffc00) == 0x1f800000 && size <= 0x400 - (addr & 0x3ff))
+			return &scratchpad[addr & 0x3ff];
+		return nullptr;
+	}
+
+	// memmove() between guest addresses, falling back to byte accesses when
+	// either side isn't plain memory
+	void move(uint32_t dst, uint32_t src, uint32_t size);
 
 	template<typename T>
 	T read(uint32_t addr)
@@ -66,23 +125,30 @@ public:
 		
 		if (addr < 0x200000)
 			return *(T*)&ram[addr];
+		if ((addr & 0xfffffc00) == 0x1f800000)
+			return *(T*)&scratchpad[addr & 0x3ff];
 		if (addr >= 0x1fc00000 && addr < 0x1fc80000)
-			return *(T*)&bios[addr - 0x1fc00000];
+			return *(const T*)&bios[addr - 0x1fc00000];
 
 
 		if ((addr & 0xfffffff0) == 0x1f801100 || (addr & 0xfffffff0) == 0x1f801110 || (addr & 0xfffffff0) == 0x1f801120)
 			return timers->read(addr);
 		if (addr >= 0x1f000000 && addr < 0x1f080000)
 			return 0;
-		if (addr >= 0x1f801d80 && addr <= 0x1f801dfc)
-			return 0;
-		if (addr >= 0x1f801c00 && addr <= 0x1F801D7E)
-			return 0;
+		if (addr >= 0x1f801c00 && addr < 0x1f801e80)
+		{
+			if constexpr (sizeof(T) == 4)
+				return spu->read(addr) | (spu->read(addr + 2) << 16);
+			else
+				return spu->read(addr);
+		}
 
 		switch (addr)
 		{
 		case 0x1f80101c:
 			return 0;
+		case 0x1ffe0130:
+			return cache_control;
 		case 0x1f801070:
 			return I_STAT;
 		case 0x1f801074:
@@ -90,20 +156,18 @@ public:
 		case 0x1f8010f0:
 		case 0x1f8010f4:
 			return dma->read(addr);
-		case 0x1f8010A0 ... 0x1f8010AF:
-		case 0x1f8010E0 ... 0x1f8010EF:
+		case 0x1f801080 ... 0x1f8010EF:
 			return dma->read_dma(addr);
 		case 0x1f801810:
 		case 0x1f801814:
 			return gpu->read(addr);
 		case 0x1f801800 ... 0x1f801803:
 			return dvd->read(addr);
-		case 0x1f801040:
-			return 0xFF;
-		case 0x1f801044:
-			return 0x7;
-		case 0x1f80104A:
-			return 0;
+		case 0x1f801820:
+		case 0x1f801824:
+			return mdec->read(addr);
+		case 0x1f801040 ... 0x1f80104f:
+			return sio->read(addr);
 		}
 		
 		printf("[emu/Bus]: Read from unknown address 0x%08x\n", addr);
@@ -120,11 +184,19 @@ public:
 			*(T*)&ram[addr] = data;
 			return;
 		}
+		if ((addr & 0xfffffc00) == 0x1f800000)
+		{
+			*(T*)&scratchpad[addr & 0x3ff] = data;
+			return;
+		}
 
-		if (addr >= 0x1f801000 && addr <= 0x1f801020 || addr == 0x1f801060 || addr == 0x1ffe0130)
+		if (addr == 0x1ffe0130)
+		{
+			cache_control = data;
 			return;
+		}
 
-		if (addr >= 0x1f801d80 && addr <= 0x1f801dbc)
+		if (addr >= 0x1f801000 && addr <= 0x1f801020 || addr == 0x1f801060)
 			return;
 
 		if (addr == 0x1f802041)
@@ -138,41 +210,46 @@ public:
 			timers->write(addr, data);
 			return;
 		}
-		if (addr >= 0x1f801c00 && addr <= 0x1F801D7E)
-			return;
-		if (addr >= 0x1f801d80 && addr <= 0x1f801dff)
+		if (addr >= 0x1f801c00 && addr < 0x1f801e80)
+		{
+			spu->write(addr, data & 0xFFFF);
+			if constexpr (sizeof(T) == 4)
+				spu->write(addr + 2, data >> 16);
 			return;
+		}
 
 		switch (addr)
 		{
 		case 0x1f801070:
 			I_STAT &= data;
+			update_irq();
 			return;
 		case 0x1f801074:
 			I_MASK = data;
+			update_irq();
 			printf("Writing 0x%08x to I_MASK\n", data);
 			return;
 		case 0x1f8010f0:
 		case 0x1f8010f4:
 			dma->write(addr, data);
 			return;
-		case 0x1f8010A0 ... 0x1f8010AF:
-		case 0x1f8010E0 ... 0x1f8010EF:
+		case 0x1f801080 ... 0x1f8010EF:
 			dma->write_dma(addr, data);
 			return;
 		case 0x1f801810:
 		case 0x1f801814:
 			gpu->write(addr, data);
 			return;
-		case 0x1f801040:
-		case 0x1f801044:
-		case 0x1f801048:
-		case 0x1f80104a:
-		case 0x1f80104e:
+		case 0x1f801040 ... 0x1f80104f:
+			sio->write(addr, data);
 			return;
 		case 0x1f801800 ... 0x1f801803:
 			dvd->write(addr, data);
 			return;
+		case 0x1f801820:
+		case 0x1f801824:
+			mdec->write(addr, data);
+			return;
 		case 0x1f802082:
 			printf("PCSX test exited with code %d\n", data);
 			exit(1);
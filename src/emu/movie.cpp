@@ -0,0 +1,243 @@
+#include "movie.h"
+#include <util/xor_delta.h>
+#include <cstring>
+
+Movie::~Movie()
+{
+	close();
+}
+
+void Movie::write_chunk(uint32_t tag, uint32_t frame, const void* data, size_t size)
+{
+	Chunk chunk = {tag, frame, size};
+
+	if (fwrite(&chunk, sizeof(chunk), 1, file) != 1 || fwrite(data, 1, size, file) != size || fflush(file))
+		printf("[emu/Movie]: Write failed, the movie will end early\n");
+}
+
+void Movie::write_inputs()
+{
+	if (inputs_written == inputs.size())
+		return;
+
+	std::vector<uint8_t> data;
+	data.reserve((inputs.size() - inputs_written) * INPUT_SIZE);
+
+	for (size_t i = inputs_written; i < inputs.size(); i++)
+	{
+		const Input& input = inputs[i];
+
+		data.push_back(input.buttons[0]);
+		data.push_back(input.buttons[0] >> 8);
+		data.push_back(input.buttons[1]);
+		data.push_back(input.buttons[1] >> 8);
+		data.push_back(input.connected[0] | (input.connected[1] << 1));
+		data.insert(data.end(), &input.axes[0][0], &input.axes[0][0] + 8);
+	}
+
+	write_chunk(ChunkInput, inputs_written, data.data(), data.size());
+	inputs_written = inputs.size();
+}
+
+bool Movie::create(const std::string& path, uint64_t bios_hash, uint32_t keyframe_interval, const std::vector<uint8_t>& state)
+{
+	close();
+
+	file = fopen(path.c_str(), "wb");
+
+	if (!file)
+	{
+		printf("[emu/Movie]: Couldn't open %s for writing\n", path.c_str());
+		return false;
+	}
+
+	interval = keyframe_interval;
+	start = state;
+	inputs.clear();
+	inputs_written = 0;
+	keyframes.clear();
+	discs.clear();
+
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.keyframe_interval = interval;
+	header.bios_hash = bios_hash;
+
+	// Packed as a delta against nothing, which squeezes out the mostly
+	// empty RAM and VRAM
+	std::vector<uint8_t> packed;
+	XorDelta::encode(start, {}, packed);
+
+	fwrite(&header, sizeof(header), 1, file);
+	write_chunk(ChunkStart, 0, packed.data(), packed.size());
+	return true;
+}
+
+void Movie::add_input(const Input& input)
+{
+	inputs.push_back(input);
+}
+
+void Movie::add_keyframe(uint32_t frame, const std::vector<uint8_t>& state)
+{
+	write_inputs();
+
+	std::vector<uint8_t> delta;
+	XorDelta::encode(state, start, delta);
+	write_chunk(ChunkKeyframe, frame, delta.data(), delta.size());
+}
+
+void Movie::add_disc(uint32_t frame, const std::string& path)
+{
+	write_inputs();
+
+	discs.push_back({frame, path});
+	write_chunk(ChunkDisc, frame, path.data(), path.size());
+}
+
+void Movie::close()
+{
+	if (!file)
+		return;
+
+	write_inputs();
+	fclose(file);
+	file = nullptr;
+}
+
+bool Movie::open(const std::string& path, uint64_t bios_hash)
+{
+	close();
+
+	FILE* in = fopen(path.c_str(), "rb");
+
+	if (!in)
+	{
+		printf("[emu/Movie]: Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	fseek(in, 0, SEEK_END);
+	std::vector<uint8_t> data(ftell(in));
+	fseek(in, 0, SEEK_SET);
+
+	size_t size = fread(data.data(), 1, data.size(), in);
+	fclose(in);
+
+	Header header = {};
+
+	if (size >= sizeof(header))
+		memcpy(&header, data.data(), sizeof(header));
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION)
+	{
+		printf("[emu/Movie]: %s is not a version %d movie\n", path.c_str(), VERSION);
+		return false;
+	}
+
+	if (header.bios_hash != bios_hash)
+	{
+		printf("[emu/Movie]: %s was recorded with a different BIOS\n", path.c_str());
+		return false;
+	}
+
+	interval = header.keyframe_interval;
+	start.clear();
+	inputs.clear();
+	keyframes.clear();
+	discs.clear();
+
+	size_t pos = sizeof(header);
+	bool have_start = false;
+
+	// A truncated final chunk is a recording that was cut short: keep
+	// everything before it
+	while (pos + sizeof(Chunk) <= size)
+	{
+		Chunk chunk;
+		memcpy(&chunk, &data[pos], sizeof(chunk));
+		pos += sizeof(chunk);
+
+		if (chunk.size > size - pos)
+			break;
+
+		const uint8_t* payload = &data[pos];
+		pos += chunk.size;
+
+		switch (chunk.tag)
+		{
+		case ChunkStart:
+			if (have_start || !XorDelta::apply(std::vector<uint8_t>(payload, payload + chunk.size), start, MAX_STATE_SIZE))
+			{
+				printf("[emu/Movie]: %s has a bad start state\n", path.c_str());
+				return false;
+			}
+			have_start = true;
+			break;
+		case ChunkInput:
+			if (chunk.frame != inputs.size())
+			{
+				printf("[emu/Movie]: Inputs out of order at frame %d\n", chunk.frame);
+				return false;
+			}
+
+			for (size_t i = 0; i + INPUT_SIZE <= chunk.size; i += INPUT_SIZE)
+			{
+				Input input;
+				input.buttons[0] = payload[i] | (payload[i + 1] << 8);
+				input.buttons[1] = payload[i + 2] | (payload[i + 3] << 8);
+				input.connected[0] = payload[i + 4] & 1;
+				input.connected[1] = payload[i + 4] & 2;
+				memcpy(input.axes, &payload[i + 5], 8);
+				inputs.push_back(input);
+			}
+			break;
+		case ChunkKeyframe:
+			keyframes.push_back({chunk.frame, std::vector<uint8_t>(payload, payload + chunk.size)});
+
+			// Checked now so that seeking can't fail later
+			if (!have_start || !XorDelta::check(keyframes.back().delta, start.size(), MAX_STATE_SIZE))
+			{
+				printf("[emu/Movie]: %s has a bad keyframe at frame %d\n", path.c_str(), chunk.frame);
+				return false;
+			}
+			break;
+		case ChunkDisc:
+			discs.push_back({chunk.frame, std::string((const char*)payload, chunk.size)});
+			break;
+		default:
+			printf("[emu/Movie]: Skipping unknown chunk 0x%08x\n", chunk.tag);
+			break;
+		}
+	}
+
+	if (!have_start)
+	{
+		printf("[emu/Movie]: %s has no start state\n", path.c_str());
+		return false;
+	}
+
+	// Keyframes past the last recorded input are of no use
+	while (!keyframes.empty() && keyframes.back().frame > inputs.size())
+		keyframes.pop_back();
+
+	printf("[emu/Movie]: %s: %zu frames, %zu keyframes\n", path.c_str(), inputs.size(), keyframes.size());
+	return true;
+}
+
+uint32_t Movie::keyframe(uint32_t frame, std::vector<uint8_t>& state) const
+{
+	state = start;
+
+	for (auto it = keyframes.rbegin(); it != keyframes.rend(); it++)
+	{
+		if (it->frame <= frame)
+		{
+			XorDelta::apply(it->delta, state);
+			return it->frame;
+		}
+	}
+
+	return 0;
+}
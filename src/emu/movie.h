@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Input movie: the machine state a recording started from, then everything
+// that reaches the machine from outside, frame by frame (pad state, disc
+// changes). Emulation is otherwise deterministic, so replaying the inputs
+// from the start state reproduces the session bit for bit.
+//
+// Every keyframe_interval frames the full state is stored as well, as an
+// XOR delta against the start state, so seeking is restoring the nearest
+// keyframe and replaying at most that many frames of input.
+//
+// The file is a header followed by chunks and is flushed chunk by chunk, so
+// a recording cut short (e.g. by a crash) still replays up to its last
+// keyframe.
+class Movie
+{
+public:
+	struct Input
+	{
+		uint16_t buttons[2];	// Active high
+		bool connected[2];
+		uint8_t axes[2][4];		// Right X/Y, left X/Y, 0x80 centered
+	};
+
+	struct DiscChange
+	{
+		uint32_t frame;			// Inserted before this frame runs
+		std::string path;
+	};
+
+	// Far above any real machine state; anything bigger in a file is
+	// corruption, not a state
+	static constexpr size_t MAX_STATE_SIZE = 64 << 20;
+private:
+	static constexpr char MAGIC[8] = {'P', 'S', 'X', 'M', 'O', 'V', 'I', 'E'};
+	static constexpr uint32_t VERSION = 2;
+
+	// Bytes per frame of input
+	static constexpr size_t INPUT_SIZE = 13;
+
+	enum ChunkTag : uint32_t
+	{
+		ChunkStart = 0x54525453,		// "STRT", start state
+		ChunkInput = 0x54504E49,		// "INPT", inputs from frame on
+		ChunkKeyframe = 0x4659454B,		// "KEYF"
+		ChunkDisc = 0x43534944,			// "DISC"
+	};
+
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t keyframe_interval;
+		uint64_t bios_hash;
+	};
+
+	struct Chunk
+	{
+		uint32_t tag;
+		uint32_t frame;
+		uint64_t size;
+	};
+
+	struct Keyframe
+	{
+		uint32_t frame;
+		std::vector<uint8_t> delta;
+	};
+
+	FILE* file = nullptr;
+	uint32_t interval = 0;
+
+	std::vector<uint8_t> start;
+	std::vector<Input> inputs;
+	size_t inputs_written = 0;
+	std::vector<Keyframe> keyframes;	// Only kept when playing back
+	std::vector<DiscChange> discs;
+
+	void write_chunk(uint32_t tag, uint32_t frame, const void* data, size_t size);
+	void write_inputs();
+public:
+	~Movie();
+
+	// Recording. The state is where the movie starts, at frame 0
+	bool create(const std::string& path, uint64_t bios_hash, uint32_t keyframe_interval, const std::vector<uint8_t>& state);
+	void add_input(const Input& input);
+	void add_keyframe(uint32_t frame, const std::vector<uint8_t>& state);
+	void add_disc(uint32_t frame, const std::string& path);
+	void close();
+
+	bool is_recording() const {return file != nullptr;}
+
+	// Playback
+	bool open(const std::string& path, uint64_t bios_hash);
+
+	uint32_t length() const {return inputs.size();}
+	uint32_t keyframe_interval() const {return interval;}
+	const Input& input(uint32_t frame) const {return inputs[frame];}
+	const std::vector<uint8_t>& start_state() const {return start;}
+	const std::vector<DiscChange>& disc_changes() const {return discs;}
+
+	// State of the last keyframe at or before frame (the start state if
+	// there is none), and the frame it belongs to
+	uint32_t keyframe(uint32_t frame, std::vector<uint8_t>& state) const;
+};
@@ -15,7 +15,21 @@ namespace renderer
 const gl::GLuint ATTRIB_INDEX_POSITION = 0;
 const gl::GLuint ATTRIB_INDEX_TEXCOORD = 1;
 
-Renderer::Renderer()
+Renderer::Renderer(GPU* gpu)
+: gpu(gpu)
+{
+}
+
+Renderer::~Renderer()
+{
+	if (!window)
+		return;
+
+	SDL_GL_DeleteContext(context);
+	SDL_DestroyWindow(window);
+}
+
+void Renderer::open_window()
 {
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -83,10 +97,15 @@ Renderer::Renderer()
 	tex_size = gl::glGetUniformLocation(shader_program, "u_tex_size");
 
 	gl::glBindVertexArray(0);
+
+	set_texture_size(VRAM_WIDTH, VRAM_HEIGHT);
 }
 
-void Renderer::render(const void *vram_data) const
+void Renderer::render(const void *vram_data)
 {
+	if (!window)
+		open_window();
+
 	SDL_GL_MakeCurrent(window, context);
 
 	gl::glBindVertexArray(vao);
@@ -324,14 +324,18 @@ struct TexelPos {
   int32_t y;
 };
 
+// Draws into the VRAM of one GPU. The window showing it is only opened on
+// the first render(), so a machine that never presents stays off SDL and
+// can run on any thread
 class Renderer
 {
 public:
 	GPU* gpu;
 
-	Renderer();
+	Renderer(GPU* gpu);
+	~Renderer();
 
-	void render(const void* vram_data) const;
+	void render(const void* vram_data);
 	void bind_screen_texture() const;
 	void set_texture_size(int32_t width, int32_t height);
 
@@ -368,7 +372,9 @@ private:
 	RGB16 calculate_pixel_tex_8bit(TextureInfo tex_info, TexelPos texel_pos) const;
 	RGB16 calculate_pixel_tex_16bit(TextureInfo tex_info, TexelPos texel_pos) const;
 
-	int32_t screen_width, screen_height;
+	void open_window();
+
+	int32_t screen_width = 0, screen_height = 0;
 	gl::GLuint shader_program;
 
 	gl::GLuint vao;
@@ -376,8 +382,8 @@ private:
 	gl::GLuint tex_screen;
 	gl::GLuint tex_size;
 
-	SDL_Window* window;
-	SDL_GLContext context;
+	SDL_Window* window = nullptr;
+	SDL_GLContext context = nullptr;
 };
 
 }
\ No newline at end of file
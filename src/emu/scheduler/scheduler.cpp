@@ -0,0 +1,69 @@
+#include "scheduler.h"
+
+void Scheduler::set_callback(Event event, std::function<void()> callback)
+{
+	events[(size_t)event].callback = callback;
+}
+
+void Scheduler::schedule(Event event, uint64_t delay)
+{
+	auto& entry = events[(size_t)event];
+
+	entry.when = cycles + delay;
+	entry.pending = true;
+
+	if (entry.when < next_event)
+		next_event = entry.when;
+}
+
+void Scheduler::cancel(Event event)
+{
+	events[(size_t)event].pending = false;
+	recompute_next();
+}
+
+void Scheduler::recompute_next()
+{
+	next_event = UINT64_MAX;
+
+	for (auto& entry : events)
+	{
+		if (entry.pending && entry.when < next_event)
+			next_event = entry.when;
+	}
+}
+
+void Scheduler::run_events()
+{
+	// Callbacks may re-arm themselves (or other events), so keep going until
+	// nothing is due anymore
+	while (cycles >= next_event)
+	{
+		for (auto& entry : events)
+		{
+			if (entry.pending && entry.when <= cycles)
+			{
+				entry.pending = false;
+				dispatched++;
+				entry.callback();
+			}
+		}
+
+		recompute_next();
+	}
+}
+
+void Scheduler::do_state(StateStream& s)
+{
+	s.section("SCHD", 2);
+
+	s.value(cycles);
+	s.value(next_event);
+	s.value(dispatched);
+
+	for (auto& entry : events)
+	{
+		s.value(entry.when);
+		s.value(entry.pending);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <array>
+#include <util/state.h>
+
+enum class Event : uint8_t
+{
+	CdromCommand,		// First response to the command being transmitted
+	CdromSecondResponse,	// Second (delayed) response, e.g. GetID/Init
+	CdromIrq,			// Delivery of the next queued response after an ack
+	CdromRead,			// Next sector of a ReadN/ReadS is ready
+	SpuTick,			// Generate the next block of SPU samples
+	SioTransfer,		// JOY_DATA byte fully shifted out
+	SioAck,				// Pad/memory card /ACK pulse
+	Count
+};
+
+// Cycle-based event scheduler. Devices register one callback per event slot
+// and arm it with a delay; nothing is done between events.
+class Scheduler
+{
+private:
+	struct Entry
+	{
+		uint64_t when = 0;
+		bool pending = false;
+		std::function<void()> callback;
+	};
+
+	std::array<Entry, (size_t)Event::Count> events;
+
+	uint64_t cycles = 0;
+	uint64_t next_event = UINT64_MAX;
+	uint64_t dispatched = 0;
+
+	void recompute_next();
+	void run_events();
+public:
+	void set_callback(Event event, std::function<void()> callback);
+
+	void schedule(Event event, uint64_t delay);
+	void cancel(Event event);
+	bool is_pending(Event event) const {return events[(size_t)event].pending;}
+
+	void advance(uint32_t elapsed)
+	{
+		cycles += elapsed;
+		if (cycles >= next_event)
+			run_events();
+	}
+
+	uint64_t get_cycles() const {return cycles;}
+	uint64_t cycles_until_next_event() const {return next_event - cycles;}
+
+	// Total callbacks run so far; a change means some device state may have
+	// changed
+	uint64_t get_dispatched() const {return dispatched;}
+
+	// Times and pending flags; the callbacks stay as registered
+	void do_state(StateStream& s);
+};
@@ -0,0 +1,299 @@
+#include "memcard.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Header, 15 free directory entries, an empty broken sector list and the
+// write test sector, each sector ending in the XOR of its other bytes
+static void format(uint8_t* data)
+{
+	memset(data, 0, MemoryCard::SIZE);
+
+	auto sector = [&](int index) {return &data[index * MemoryCard::SECTOR_SIZE];};
+
+	sector(0)[0] = 'M';
+	sector(0)[1] = 'C';
+
+	for (int i = 1; i < 16; i++)
+	{
+		sector(i)[0] = 0xA0;
+		sector(i)[8] = 0xFF;
+		sector(i)[9] = 0xFF;
+	}
+
+	for (int i = 16; i < 36; i++)
+	{
+		memset(sector(i), 0xFF, 4);
+		sector(i)[8] = 0xFF;
+		sector(i)[9] = 0xFF;
+	}
+
+	memcpy(sector(63), sector(0), MemoryCard::SECTOR_SIZE);
+
+	for (int i = 0; i < 64; i++)
+	{
+		uint8_t checksum = 0;
+		for (uint32_t j = 0; j < MemoryCard::SECTOR_SIZE - 1; j++)
+			checksum ^= sector(i)[j];
+		sector(i)[MemoryCard::SECTOR_SIZE - 1] = checksum;
+	}
+}
+
+MemoryCard::MemoryCard()
+{
+	format(data);
+}
+
+MemoryCard::~MemoryCard()
+{
+	close();
+}
+
+bool MemoryCard::open(const std::string& path)
+{
+	close();
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0)
+	{
+		printf("[emu/MemoryCard]: Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+
+	bool created = st.st_size == 0;
+
+	if (created && ftruncate(fd, SIZE))
+		st.st_size = -1;
+	else if (created)
+		st.st_size = SIZE;
+
+	if (st.st_size != SIZE)
+	{
+		printf("[emu/MemoryCard]: %s is not a %d KiB memory card\n", path.c_str(), SIZE / 1024);
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	map = (uint8_t*)mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED)
+	{
+		printf("[emu/MemoryCard]: Couldn't map %s\n", path.c_str());
+		map = nullptr;
+		::close(fd);
+		fd = -1;
+		return false;
+	}
+
+	if (created)
+		format(map);
+
+	memcpy(data, map, SIZE);
+	memset(dirty, 0, sizeof(dirty));
+	flag = 0x08;
+	step = 0;
+	return true;
+}
+
+void MemoryCard::close()
+{
+	if (!map)
+		return;
+
+	flush();
+	msync(map, SIZE, MS_SYNC);
+	munmap(map, SIZE);
+	::close(fd);
+
+	map = nullptr;
+	fd = -1;
+}
+
+void MemoryCard::flush()
+{
+	if (!map)
+		return;
+
+	bool written = false;
+
+	for (uint32_t i = 0; i < SECTOR_COUNT; i++)
+	{
+		if (!dirty[i])
+			continue;
+
+		dirty[i] = false;
+
+		uint32_t offset = i * SECTOR_SIZE;
+		if (memcmp(&map[offset], &data[offset], SECTOR_SIZE))
+		{
+			memcpy(&map[offset], &data[offset], SECTOR_SIZE);
+			written = true;
+		}
+	}
+
+	// Start writeback now rather than whenever the kernel gets to it
+	if (written)
+		msync(map, SIZE, MS_ASYNC);
+}
+
+void MemoryCard::reload()
+{
+	if (!map)
+		return;
+
+	memcpy(data, map, SIZE);
+	memset(dirty, 0, sizeof(dirty));
+	flag = 0x08;
+}
+
+// Byte  Host  Card
+//   2   00h   5Ah
+//   3   00h   5Dh
+//   4   MSB   00h
+//   5   LSB   MSB
+//   6   00h   5Ch
+//   7   00h   5Dh
+//   8   00h   MSB
+//   9   00h   LSB
+// 10-137 00h  Data
+// 138   00h   Checksum (MSB ^ LSB ^ data)
+// 139   00h   47h
+uint8_t MemoryCard::read_command(uint8_t in, bool& ack)
+{
+	switch (step)
+	{
+	case 2: return 0x5A;
+	case 3: return 0x5D;
+	case 4:
+		sector = in << 8;
+		return 0x00;
+	case 5:
+		sector |= in;
+		return previous;
+	case 6: return 0x5C;
+	case 7: return 0x5D;
+	case 8:
+		if (sector >= SECTOR_COUNT)
+		{
+			ack = false;
+			return 0xFF;
+		}
+		checksum = (sector >> 8) ^ (sector & 0xFF);
+		return sector >> 8;
+	case 9: return sector & 0xFF;
+	case 138: return checksum;
+	case 139:
+		ack = false;
+		return 0x47;
+	default:
+	{
+		uint8_t value = data[sector * SECTOR_SIZE + step - 10];
+		checksum ^= value;
+		return value;
+	}
+	}
+}
+
+// Byte  Host      Card
+//   2   00h       5Ah
+//   3   00h       5Dh
+//   4   MSB       00h
+//   5   LSB       MSB
+// 6-133 Data      Previous byte
+// 134   Checksum  Previous byte
+// 135   00h       5Ch
+// 136   00h       5Dh
+// 137   00h       47h good, 4Eh bad checksum, FFh bad sector
+uint8_t MemoryCard::write_command(uint8_t in, bool& ack)
+{
+	switch (step)
+	{
+	case 2: return 0x5A;
+	case 3: return 0x5D;
+	case 4:
+		sector = in << 8;
+		return 0x00;
+	case 5:
+		sector |= in;
+		checksum = (sector >> 8) ^ (sector & 0xFF);
+		return previous;
+	case 134:
+		checksum ^= in;
+		return previous;
+	case 135: return 0x5C;
+	case 136: return 0x5D;
+	case 137:
+		ack = false;
+
+		if (sector >= SECTOR_COUNT)
+			return 0xFF;
+		if (checksum)
+			return 0x4E;
+
+		memcpy(&data[sector * SECTOR_SIZE], buffer, SECTOR_SIZE);
+		dirty[sector] = true;
+		flag &= ~0x08;
+		return 0x47;
+	default:
+		buffer[step - 6] = in;
+		checksum ^= in;
+		return previous;
+	}
+}
+
+uint8_t MemoryCard::id_command(uint8_t, bool& ack)
+{
+	static constexpr uint8_t reply[] = {0x5A, 0x5D, 0x5C, 0x5D, 0x04, 0x00, 0x00, 0x80};
+
+	ack = step < 9;
+	return reply[step - 2];
+}
+
+uint8_t MemoryCard::transfer(uint8_t in, bool& ack)
+{
+	uint8_t reply;
+	ack = true;
+
+	if (step == 0)
+		reply = 0xFF;
+	else if (step == 1)
+	{
+		command = in;
+		reply = flag;
+		ack = command == 'R' || command == 'W' || command == 'S';
+	}
+	else if (command == 'R')
+		reply = read_command(in, ack);
+	else if (command == 'W')
+		reply = write_command(in, ack);
+	else
+		reply = id_command(in, ack);
+
+	previous = in;
+	step = ack ? step + 1 : 0;
+	return reply;
+}
+
+void MemoryCard::do_state(StateStream& s)
+{
+	s.value(data);
+	s.value(flag);
+	s.value(command);
+	s.value(step);
+	s.value(sector);
+	s.value(checksum);
+	s.value(previous);
+	s.value(buffer);
+
+	// The file is brought in line with the loaded contents on the next flush
+	if (s.is_loading())
+		memset(dirty, 1, sizeof(dirty));
+}
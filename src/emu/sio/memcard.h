@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <util/state.h>
+
+// Memory card on the JOY port: 1024 sectors of 128 bytes, read and written
+// a sector per 'R'/'W' command.
+//
+// The card's contents live in the machine (and so in save states, rewind
+// and movies) and are backed by a 128 KiB file mapped into memory. Writes
+// only touch the in-machine copy; flush() copies changed sectors into the
+// mapping once per real frame, so speculative frames and states that get
+// thrown away never reach the file, and there is no file I/O per byte.
+//
+// Contents that come from another session, a state file or a movie, are
+// never written back: the file has moved on since, see reload().
+class MemoryCard
+{
+public:
+	static constexpr uint32_t SECTOR_SIZE = 128;
+	static constexpr uint32_t SECTOR_COUNT = 1024;
+	static constexpr uint32_t SIZE = SECTOR_SIZE * SECTOR_COUNT;
+private:
+	uint8_t data[SIZE];
+
+	// FLAG byte: bit 3 is set until the first write after power on
+	uint8_t flag = 0x08;
+
+	uint8_t command = 0;
+	uint32_t step = 0;
+	uint16_t sector = 0;
+	uint8_t checksum = 0;
+	uint8_t previous = 0;		// Writes echo the byte received before
+	uint8_t buffer[SECTOR_SIZE] = {};
+
+	int fd = -1;
+	uint8_t* map = nullptr;
+	bool dirty[SECTOR_COUNT] = {};
+
+	uint8_t read_command(uint8_t in, bool& ack);
+	uint8_t write_command(uint8_t in, bool& ack);
+	uint8_t id_command(uint8_t in, bool& ack);
+public:
+	MemoryCard();
+	~MemoryCard();
+
+	// Creates the file (formatted as empty) if it doesn't exist
+	bool open(const std::string& path);
+	void close();
+	bool inserted() const {return map != nullptr;}
+
+	// One byte of an exchange that started with the 0x81 address byte; ack
+	// is set if the card expects another byte
+	uint8_t transfer(uint8_t in, bool& ack);
+	void deselect() {step = 0;}
+
+	// Writes changed sectors back to the file
+	void flush();
+
+	// Takes the contents from the file again, as if the card had just been
+	// plugged in, dropping whatever a loaded state brought along
+	void reload();
+
+	void do_state(StateStream& s);
+};
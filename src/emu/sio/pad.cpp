@@ -0,0 +1,60 @@
+#include "pad.h"
+
+void Pad::set_axes(uint8_t rx, uint8_t ry, uint8_t lx, uint8_t ly)
+{
+	axes[0] = rx;
+	axes[1] = ry;
+	axes[2] = lx;
+	axes[3] = ly;
+}
+
+// Byte  Host  Pad
+//   0   01h   Hi-Z
+//   1   42h   ID (41h digital, 73h analog)
+//   2   00h   5Ah
+//   3   00h   Buttons 0-7, active low
+//   4   00h   Buttons 8-15
+//  5-8  00h   Right X/Y, left X/Y (analog only)
+uint8_t Pad::transfer(uint8_t data, bool& ack)
+{
+	uint8_t last = type == Type::Analog ? 8 : 4;
+	uint8_t reply = 0xFF;
+
+	switch (step)
+	{
+	case 0:
+		reply = 0xFF;
+		break;
+	case 1:
+		valid_command = data == 0x42;
+		reply = type == Type::Analog ? 0x73 : 0x41;
+		break;
+	case 2:
+		reply = 0x5A;
+		break;
+	case 3:
+		reply = ~buttons & 0xFF;
+		break;
+	case 4:
+		reply = ~buttons >> 8;
+		break;
+	default:
+		reply = axes[step - 5];
+		break;
+	}
+
+	// Anything but a poll ends the exchange after the ID
+	ack = step < last && (step < 1 || valid_command);
+	step = ack ? step + 1 : 0;
+	return reply;
+}
+
+// The pad type is configuration, like which pad is plugged in, and isn't
+// part of the state
+void Pad::do_state(StateStream& s)
+{
+	s.value(buttons);
+	s.value(axes);
+	s.value(valid_command);
+	s.value(step);
+}
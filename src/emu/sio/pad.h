@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <util/state.h>
+
+// Controller on the JOY port. Digital pads answer the 0x42 poll with their
+// ID and two button bytes; analog pads (analog mode fixed on, no DualShock
+// config commands) add both sticks.
+class Pad
+{
+public:
+	enum class Type : uint8_t
+	{
+		None,
+		Digital,
+		Analog,
+	};
+private:
+	Type type = Type::Digital;
+	uint16_t buttons = 0;	// Active high, bit order as on the wire
+	uint8_t axes[4] = {0x80, 0x80, 0x80, 0x80};	// Right X/Y, left X/Y
+	bool valid_command = false;
+
+	uint8_t step = 0;		// Bytes of the current exchange so far
+public:
+	void set_type(Type type) {this->type = type;}
+	Type get_type() const {return type;}
+	void set_buttons(uint16_t buttons) {this->buttons = buttons;}
+	void set_axes(uint8_t rx, uint8_t ry, uint8_t lx, uint8_t ly);
+
+	bool connected() const {return type != Type::None;}
+
+	// One byte of an exchange that started with the 0x01 address byte; ack
+	// is set if the pad expects another byte
+	uint8_t transfer(uint8_t data, bool& ack);
+	void deselect() {step = 0;}
+
+	void do_state(StateStream& s);
+};
@@ -0,0 +1,177 @@
+#include "sio.h"
+#include <emu/memory/Bus.h>
+#include <emu/scheduler/scheduler.h>
+#include <algorithm>
+
+SIO::SIO(Bus* bus)
+: bus(bus)
+{
+	auto scheduler = bus->get_scheduler();
+
+	scheduler->set_callback(Event::SioTransfer, [this]()
+	{
+		transfer_done();
+	});
+	scheduler->set_callback(Event::SioAck, [this]()
+	{
+		ack();
+	});
+}
+
+void SIO::deselect()
+{
+	target = Target::None;
+
+	for (int i = 0; i < 2; i++)
+	{
+		pads[i].deselect();
+		cards[i].deselect();
+	}
+}
+
+void SIO::transfer_done()
+{
+	transferring = false;
+
+	uint8_t reply = 0xFF;
+	bool acked = false;
+
+	if (selected())
+	{
+		if (target == Target::None && tx == 0x01 && pads[port()].connected())
+			target = Target::Pad;
+		else if (target == Target::None && tx == 0x81 && cards[port()].inserted())
+			target = Target::Card;
+
+		if (target == Target::Pad)
+			reply = pads[port()].transfer(tx, acked);
+		else if (target == Target::Card)
+			reply = cards[port()].transfer(tx, acked);
+	}
+
+	rx.push(reply);
+
+	if (acked)
+		bus->get_scheduler()->schedule(Event::SioAck, target == Target::Pad ? PAD_ACK_DELAY : CARD_ACK_DELAY);
+	else
+		target = Target::None;
+}
+
+void SIO::ack()
+{
+	ack_level = true;
+
+	if (ctrl & (1 << 12))
+	{
+		irq = true;
+		bus->TriggerInterrupt(7);
+	}
+}
+
+uint32_t SIO::stat() const
+{
+	return 1 | (!rx.empty() << 1) | (!transferring << 2) | (ack_level << 7) | (irq << 9);
+}
+
+uint32_t SIO::read(uint32_t addr)
+{
+	switch (addr)
+	{
+	case 0x1f801040:
+		return rx.empty() ? 0xFF : rx.pop();
+	case 0x1f801044:
+		return stat();
+	case 0x1f801048:
+		return mode;
+	case 0x1f80104a:
+		return ctrl;
+	case 0x1f80104e:
+		return baud;
+	}
+
+	return 0;
+}
+
+void SIO::write(uint32_t addr, uint32_t data)
+{
+	switch (addr)
+	{
+	case 0x1f801040:
+	{
+		// 8 bits at the baud rate, scaled by the mode's reload factor
+		static constexpr uint32_t factors[4] = {1, 1, 16, 64};
+		uint32_t cycles = std::max<uint32_t>(baud, 1) * factors[mode & 3] * 8;
+
+		tx = data;
+		transferring = true;
+		ack_level = false;
+		bus->get_scheduler()->cancel(Event::SioAck);
+		bus->get_scheduler()->schedule(Event::SioTransfer, cycles);
+		return;
+	}
+	case 0x1f801048:
+		mode = data;
+		return;
+	case 0x1f80104a:
+	{
+		if (data & (1 << 6))
+		{
+			mode = ctrl = baud = 0;
+			rx.clear();
+			transferring = ack_level = irq = false;
+			bus->get_scheduler()->cancel(Event::SioTransfer);
+			bus->get_scheduler()->cancel(Event::SioAck);
+			deselect();
+			return;
+		}
+
+		if (data & (1 << 4))
+			irq = false;
+
+		int old_port = port();
+
+		// Acknowledge and reset are strobes, not settings
+		ctrl = data & ~((1 << 4) | (1 << 6));
+
+		if (!selected() || port() != old_port)
+			deselect();
+		return;
+	}
+	case 0x1f80104e:
+		baud = data;
+		return;
+	}
+}
+
+void SIO::flush_cards()
+{
+	cards[0].flush();
+	cards[1].flush();
+}
+
+void SIO::reload_cards()
+{
+	cards[0].reload();
+	cards[1].reload();
+}
+
+void SIO::do_state(StateStream& s)
+{
+	s.section("SIO ", 1);
+
+	for (int i = 0; i < 2; i++)
+	{
+		pads[i].do_state(s);
+		cards[i].do_state(s);
+	}
+
+	s.value(target);
+	s.value(rx);
+	s.value(tx);
+	s.value(transferring);
+	s.value(ack_level);
+	s.value(irq);
+	s.value(mode);
+	s.value(ctrl);
+	s.value(baud);
+}
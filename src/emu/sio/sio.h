@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <util/fifo.h>
+#include <util/state.h>
+#include <emu/sio/pad.h>
+#include <emu/sio/memcard.h>
+
+class Bus;
+
+// Controller and memory card port (JOY, 0x1f801040-0x1f80104e). Each byte
+// written to JOY_DATA is shifted out to the selected slot over the baud
+// rate timer; the device's reply lands in the RX FIFO at the end, and if it
+// wants another byte it pulses /ACK a little later, which raises IRQ7 when
+// enabled. The first byte of an exchange picks the device: 01h the pad,
+// 81h the memory card.
+class SIO
+{
+private:
+	enum class Target : uint8_t
+	{
+		None,
+		Pad,
+		Card,
+	};
+
+	// Delay from the end of a byte to the /ACK pulse; cards answer faster
+	static constexpr uint32_t PAD_ACK_DELAY = 338;
+	static constexpr uint32_t CARD_ACK_DELAY = 170;
+
+	Pad pads[2];
+	MemoryCard cards[2];
+
+	Target target = Target::None;
+
+	Fifo<uint8_t, 8> rx;
+	uint8_t tx = 0;
+	bool transferring = false;
+
+	bool ack_level = false;		// /ACK input low
+	bool irq = false;
+
+	uint16_t mode = 0;
+	uint16_t ctrl = 0;
+	uint16_t baud = 0;
+
+	Bus* bus;
+
+	int port() const {return (ctrl >> 13) & 1;}
+	bool selected() const {return ctrl & 2;}
+
+	void deselect();
+	void transfer_done();
+	void ack();
+
+	uint32_t stat() const;
+public:
+	SIO(Bus* bus);
+
+	uint32_t read(uint32_t addr);
+	void write(uint32_t addr, uint32_t data);
+
+	Pad& get_pad(int port) {return pads[port];}
+	MemoryCard& get_card(int port) {return cards[port];}
+
+	// Once per frame that actually happened, see MemoryCard
+	void flush_cards();
+	void reload_cards();
+
+	void do_state(StateStream& s);
+};
@@ -0,0 +1,158 @@
+#include "spu.h"
+#include <algorithm>
+
+// Indices into SPU::reverb_regs (0x1f801dc0 + 2 * index). d* and m* are
+// addresses in 8 byte units relative to the current work area position,
+// v* are signed volumes/coefficients.
+enum ReverbReg
+{
+	dAPF1, dAPF2, vIIR, vCOMB1, vCOMB2, vCOMB3, vCOMB4, vWALL,
+	vAPF1, vAPF2, mLSAME, mRSAME, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2,
+	dLSAME, dRSAME, mLDIFF, mRDIFF, mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4,
+	dLDIFF, dRDIFF, mLAPF1, mRAPF1, mLAPF2, mRAPF2, vLIN, vRIN,
+};
+
+// The work area runs from the base address to the end of sound RAM and
+// rotates by one halfword per 22.05 kHz step. It is viewed as one
+// contiguous ring of halfwords so every tap is a single index with a
+// conditional wrap.
+class ReverbRing
+{
+private:
+	int16_t* buffer;
+	uint32_t size;
+public:
+	uint32_t pos;
+
+	ReverbRing(uint8_t* ram, uint16_t base, uint32_t pos)
+	: buffer((int16_t*)ram + base * 4), size(SPU_RAM_SIZE / 2 - base * 4), pos(pos)
+	{
+		if (this->pos >= size)
+			this->pos = 0;
+	}
+
+	int16_t& at(int32_t offset)
+	{
+		int64_t index = (int64_t)pos + offset;
+
+		if (index >= size)
+			index -= size;
+		else if (index < 0)
+			index += size;
+
+		// Tap offsets larger than the area itself
+		if (index < 0 || index >= size)
+			index = ((index % size) + size) % size;
+
+		return buffer[index];
+	}
+
+	void advance()
+	{
+		if (++pos >= size)
+			pos = 0;
+	}
+};
+
+static int16_t clamp16(int32_t value)
+{
+	return (int16_t)std::clamp(value, -0x8000, 0x7FFF);
+}
+
+static int32_t mul(int32_t a, int32_t b)
+{
+	return (a * b) >> 15;
+}
+
+void SPU::process_reverb(const int32_t* in, int32_t* out)
+{
+	const bool write = spucnt & (1 << 7);
+
+	if (reverb_base * 4 >= SPU_RAM_SIZE / 2)
+		return;
+
+	ReverbRing ring(ram, reverb_base, reverb_pos);
+
+	// Decode the register block once per block rather than per step
+	auto vol = [this](int reg) {return (int32_t)(int16_t)reverb_regs[reg];};
+	auto off = [this](int reg) {return (int32_t)reverb_regs[reg] * 4;};
+
+	const int32_t iir = vol(vIIR), wall = vol(vWALL);
+	const int32_t apf1 = vol(vAPF1), apf2 = vol(vAPF2);
+	const int32_t comb1 = vol(vCOMB1), comb2 = vol(vCOMB2), comb3 = vol(vCOMB3), comb4 = vol(vCOMB4);
+	const int32_t lin = vol(vLIN), rin = vol(vRIN);
+	const int32_t lout_vol = (int16_t)reverb_vol_l, rout_vol = (int16_t)reverb_vol_r;
+
+	const int32_t l_same = off(mLSAME), r_same = off(mRSAME);
+	const int32_t l_diff = off(mLDIFF), r_diff = off(mRDIFF);
+	const int32_t dl_same = off(dLSAME), dr_same = off(dRSAME);
+	const int32_t dl_diff = off(dLDIFF), dr_diff = off(dRDIFF);
+	const int32_t l_comb1 = off(mLCOMB1), l_comb2 = off(mLCOMB2), l_comb3 = off(mLCOMB3), l_comb4 = off(mLCOMB4);
+	const int32_t r_comb1 = off(mRCOMB1), r_comb2 = off(mRCOMB2), r_comb3 = off(mRCOMB3), r_comb4 = off(mRCOMB4);
+	const int32_t l_apf1 = off(mLAPF1), r_apf1 = off(mRAPF1), d_apf1 = off(dAPF1);
+	const int32_t l_apf2 = off(mLAPF2), r_apf2 = off(mRAPF2), d_apf2 = off(dAPF2);
+
+	auto store = [&](int32_t offset, int32_t value)
+	{
+		if (write)
+			ring.at(offset) = clamp16(value);
+	};
+
+	// The reverb runs at half the output rate: each step consumes the average
+	// of two input samples and its output is interpolated back up to two
+	for (uint32_t s = 0; s < SPU_BLOCK_SAMPLES * 2; s += 4)
+	{
+		const int32_t in_l = mul((in[s + 0] + in[s + 2]) >> 1, lin);
+		const int32_t in_r = mul((in[s + 1] + in[s + 3]) >> 1, rin);
+
+		// Same side and cross (diffused) reflections
+		int32_t prev = ring.at(l_same - 1);
+		store(l_same, mul(in_l + mul(ring.at(dl_same), wall) - prev, iir) + prev);
+		prev = ring.at(r_same - 1);
+		store(r_same, mul(in_r + mul(ring.at(dr_same), wall) - prev, iir) + prev);
+		prev = ring.at(l_diff - 1);
+		store(l_diff, mul(in_l + mul(ring.at(dr_diff), wall) - prev, iir) + prev);
+		prev = ring.at(r_diff - 1);
+		store(r_diff, mul(in_r + mul(ring.at(dl_diff), wall) - prev, iir) + prev);
+
+		// Early echo
+		int32_t l = mul(ring.at(l_comb1), comb1) + mul(ring.at(l_comb2), comb2) + mul(ring.at(l_comb3), comb3) + mul(ring.at(l_comb4), comb4);
+		int32_t r = mul(ring.at(r_comb1), comb1) + mul(ring.at(r_comb2), comb2) + mul(ring.at(r_comb3), comb3) + mul(ring.at(r_comb4), comb4);
+
+		// Late reverb, two all-pass stages
+		int32_t tap = ring.at(l_apf1 - d_apf1);
+		l = clamp16(l - mul(tap, apf1));
+		store(l_apf1, l);
+		l = mul(l, apf1) + tap;
+
+		tap = ring.at(r_apf1 - d_apf1);
+		r = clamp16(r - mul(tap, apf1));
+		store(r_apf1, r);
+		r = mul(r, apf1) + tap;
+
+		tap = ring.at(l_apf2 - d_apf2);
+		l = clamp16(l - mul(tap, apf2));
+		store(l_apf2, l);
+		l = mul(l, apf2) + tap;
+
+		tap = ring.at(r_apf2 - d_apf2);
+		r = clamp16(r - mul(tap, apf2));
+		store(r_apf2, r);
+		r = mul(r, apf2) + tap;
+
+		l = mul(clamp16(l), lout_vol);
+		r = mul(clamp16(r), rout_vol);
+
+		out[s + 0] = (reverb_prev_l + l) >> 1;
+		out[s + 1] = (reverb_prev_r + r) >> 1;
+		out[s + 2] = l;
+		out[s + 3] = r;
+
+		reverb_prev_l = l;
+		reverb_prev_r = r;
+
+		ring.advance();
+	}
+
+	reverb_pos = ring.pos;
+}
@@ -0,0 +1,782 @@
+#include "spu.h"
+#include <emu/memory/Bus.h>
+#include <emu/scheduler/scheduler.h>
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The hardware interpolates with this 512 entry table of Gaussian weights
+// (four taps per sample, indexed by the top 8 fraction bits of the pitch
+// counter). Entry k weighs a sample 2 - k/256 samples away from the output
+// position. The taps of one position don't quite sum to unity (0x7F7F up to
+// 0x81BA), so the result can overflow and has to be clamped.
+static constexpr int16_t gauss_table[512] =
+{
+	-0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001,
+	-0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001, -0x001,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0001,
+	0x0001, 0x0001, 0x0001, 0x0002, 0x0002, 0x0002, 0x0003, 0x0003,
+	0x0003, 0x0004, 0x0004, 0x0005, 0x0005, 0x0006, 0x0007, 0x0007,
+	0x0008, 0x0009, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E,
+	0x000F, 0x0010, 0x0011, 0x0012, 0x0013, 0x0015, 0x0016, 0x0018,
+	0x0019, 0x001B, 0x001C, 0x001E, 0x0020, 0x0021, 0x0023, 0x0025,
+	0x0027, 0x0029, 0x002C, 0x002E, 0x0030, 0x0033, 0x0035, 0x0038,
+	0x003A, 0x003D, 0x0040, 0x0043, 0x0046, 0x0049, 0x004D, 0x0050,
+	0x0054, 0x0057, 0x005B, 0x005F, 0x0063, 0x0067, 0x006B, 0x006F,
+	0x0074, 0x0078, 0x007D, 0x0082, 0x0087, 0x008C, 0x0091, 0x0096,
+	0x009C, 0x00A1, 0x00A7, 0x00AD, 0x00B3, 0x00BA, 0x00C0, 0x00C7,
+	0x00CD, 0x00D4, 0x00DB, 0x00E3, 0x00EA, 0x00F2, 0x00FA, 0x0101,
+	0x010A, 0x0112, 0x011B, 0x0123, 0x012C, 0x0135, 0x013F, 0x0148,
+	0x0152, 0x015C, 0x0166, 0x0171, 0x017B, 0x0186, 0x0191, 0x019C,
+	0x01A8, 0x01B4, 0x01C0, 0x01CC, 0x01D9, 0x01E5, 0x01F2, 0x0200,
+	0x020D, 0x021B, 0x0229, 0x0237, 0x0246, 0x0255, 0x0264, 0x0273,
+	0x0283, 0x0293, 0x02A3, 0x02B4, 0x02C4, 0x02D6, 0x02E7, 0x02F9,
+	0x030B, 0x031D, 0x0330, 0x0343, 0x0356, 0x036A, 0x037E, 0x0392,
+	0x03A7, 0x03BC, 0x03D1, 0x03E7, 0x03FC, 0x0413, 0x042A, 0x0441,
+	0x0458, 0x0470, 0x0488, 0x04A0, 0x04B9, 0x04D2, 0x04EC, 0x0506,
+	0x0520, 0x053B, 0x0556, 0x0572, 0x058E, 0x05AA, 0x05C7, 0x05E4,
+	0x0601, 0x061F, 0x063E, 0x065C, 0x067C, 0x069B, 0x06BB, 0x06DC,
+	0x06FD, 0x071E, 0x0740, 0x0762, 0x0784, 0x07A7, 0x07CB, 0x07EF,
+	0x0813, 0x0838, 0x085D, 0x0883, 0x08A9, 0x08D0, 0x08F7, 0x091E,
+	0x0946, 0x096F, 0x0998, 0x09C1, 0x09EB, 0x0A16, 0x0A40, 0x0A6C,
+	0x0A98, 0x0AC4, 0x0AF1, 0x0B1E, 0x0B4C, 0x0B7A, 0x0BA9, 0x0BD8,
+	0x0C07, 0x0C38, 0x0C68, 0x0C99, 0x0CCB, 0x0CFD, 0x0D30, 0x0D63,
+	0x0D97, 0x0DCB, 0x0E00, 0x0E35, 0x0E6B, 0x0EA1, 0x0ED7, 0x0F0F,
+	0x0F46, 0x0F7F, 0x0FB7, 0x0FF1, 0x102A, 0x1065, 0x109F, 0x10DB,
+	0x1116, 0x1153, 0x118F, 0x11CD, 0x120B, 0x1249, 0x1288, 0x12C7,
+	0x1307, 0x1347, 0x1388, 0x13C9, 0x140B, 0x144D, 0x1490, 0x14D4,
+	0x1517, 0x155C, 0x15A0, 0x15E6, 0x162C, 0x1672, 0x16B9, 0x1700,
+	0x1747, 0x1790, 0x17D8, 0x1821, 0x186B, 0x18B5, 0x1900, 0x194B,
+	0x1996, 0x19E2, 0x1A2E, 0x1A7B, 0x1AC8, 0x1B16, 0x1B64, 0x1BB3,
+	0x1C02, 0x1C51, 0x1CA1, 0x1CF1, 0x1D42, 0x1D93, 0x1DE5, 0x1E37,
+	0x1E89, 0x1EDC, 0x1F2F, 0x1F82, 0x1FD6, 0x202A, 0x207F, 0x20D4,
+	0x2129, 0x217F, 0x21D5, 0x222C, 0x2282, 0x22DA, 0x2331, 0x2389,
+	0x23E1, 0x2439, 0x2492, 0x24EB, 0x2545, 0x259E, 0x25F8, 0x2653,
+	0x26AD, 0x2708, 0x2763, 0x27BE, 0x281A, 0x2876, 0x28D2, 0x292E,
+	0x298B, 0x29E7, 0x2A44, 0x2AA1, 0x2AFF, 0x2B5C, 0x2BBA, 0x2C18,
+	0x2C76, 0x2CD4, 0x2D33, 0x2D91, 0x2DF0, 0x2E4F, 0x2EAE, 0x2F0D,
+	0x2F6C, 0x2FCC, 0x302B, 0x308B, 0x30EA, 0x314A, 0x31AA, 0x3209,
+	0x3269, 0x32C9, 0x3329, 0x3389, 0x33E9, 0x3449, 0x34A9, 0x3509,
+	0x3569, 0x35C9, 0x3629, 0x3689, 0x36E8, 0x3748, 0x37A8, 0x3807,
+	0x3867, 0x38C6, 0x3926, 0x3985, 0x39E4, 0x3A43, 0x3AA2, 0x3B00,
+	0x3B5F, 0x3BBD, 0x3C1B, 0x3C79, 0x3CD7, 0x3D34, 0x3D92, 0x3DEF,
+	0x3E4C, 0x3EA8, 0x3F05, 0x3F61, 0x3FBD, 0x4018, 0x4074, 0x40CF,
+	0x412A, 0x4184, 0x41DE, 0x4238, 0x4292, 0x42EB, 0x4344, 0x439C,
+	0x43F5, 0x444C, 0x44A4, 0x44FB, 0x4551, 0x45A7, 0x45FD, 0x4652,
+	0x46A7, 0x46FC, 0x4750, 0x47A3, 0x47F6, 0x4849, 0x489B, 0x48ED,
+	0x493E, 0x498F, 0x49DF, 0x4A2F, 0x4A7E, 0x4ACD, 0x4B1B, 0x4B69,
+	0x4BB6, 0x4C03, 0x4C4F, 0x4C9A, 0x4CE5, 0x4D30, 0x4D7A, 0x4DC3,
+	0x4E0B, 0x4E53, 0x4E9B, 0x4EE2, 0x4F28, 0x4F6E, 0x4FB3, 0x4FF8,
+	0x503B, 0x507F, 0x50C1, 0x5103, 0x5144, 0x5185, 0x51C5, 0x5204,
+	0x5243, 0x5281, 0x52BE, 0x52FB, 0x5337, 0x5372, 0x53AC, 0x53E6,
+	0x5420, 0x5458, 0x5490, 0x54C7, 0x54FD, 0x5533, 0x5568, 0x559C,
+	0x55D0, 0x5602, 0x5634, 0x5666, 0x5696, 0x56C6, 0x56F5, 0x5723,
+	0x5751, 0x577E, 0x57AA, 0x57D5, 0x57FF, 0x5829, 0x5852, 0x587A,
+	0x58A1, 0x58C7, 0x58ED, 0x5912, 0x5936, 0x5959, 0x597B, 0x599C,
+	0x59BC, 0x59DC, 0x59FA, 0x5A18, 0x5A35, 0x5A51, 0x5A6C, 0x5A86,
+	0x5A9F, 0x5AB8, 0x5ACF, 0x5AE6, 0x5AFC, 0x5B11, 0x5B25, 0x5B38,
+	0x5B4A, 0x5B5B, 0x5B6B, 0x5B7B, 0x5B89, 0x5B97, 0x5BA4, 0x5BB0
+};
+
+static constexpr int32_t adpcm_pos[5] = {0, 60, 115, 98, 122};
+static constexpr int32_t adpcm_neg[5] = {0, 0, -52, -55, -60};
+
+static int16_t clamp16(int32_t value)
+{
+	return (int16_t)std::clamp(value, -0x8000, 0x7FFF);
+}
+
+// Volume registers in fixed mode hold a 15-bit signed volume/2. Sweep mode
+// isn't emulated; a sweeping voice keeps its last fixed volume.
+static void set_volume(uint16_t reg, int16_t& current)
+{
+	if (!(reg & 0x8000))
+		current = (int16_t)(reg << 1);
+}
+
+SPU::SPU(Bus* bus)
+: bus(bus)
+{
+	ram = new uint8_t[SPU_RAM_SIZE];
+	std::memset(ram, 0, SPU_RAM_SIZE);
+
+	auto scheduler = bus->get_scheduler();
+
+	scheduler->set_callback(Event::SpuTick, [this]()
+	{
+		generate_block();
+		this->bus->get_scheduler()->schedule(Event::SpuTick, SPU_BLOCK_SAMPLES * SPU_CYCLES_PER_SAMPLE);
+	});
+	scheduler->schedule(Event::SpuTick, SPU_BLOCK_SAMPLES * SPU_CYCLES_PER_SAMPLE);
+}
+
+SPU::~SPU()
+{
+	delete[] ram;
+}
+
+void SPU::check_irq(uint32_t addr)
+{
+	// The IRQ address is in 8 byte units, and only fires while enabled
+	if ((spucnt & (1 << 6)) && (addr & ~7) == (uint32_t)irq_addr * 8)
+	{
+		spustat |= (1 << 6);
+		bus->TriggerInterrupt(9);
+	}
+}
+
+void SPU::key_on(uint32_t mask)
+{
+	for (uint32_t i = 0; i < SPU_VOICES; i++)
+	{
+		if (!(mask & (1 << i)))
+			continue;
+
+		auto& voice = voices[i];
+
+		voice.cur_addr = (voice.start_addr * 8) & (SPU_RAM_SIZE - 1);
+		voice.counter = 0;
+		voice.adpcm_old = voice.adpcm_older = 0;
+		std::fill(std::begin(voice.samples), std::end(voice.samples), 0);
+		voice.phase = AdsrPhase::Attack;
+		voice.adsr_level = 0;
+		voice.adsr_wait = 0;
+
+		decode_block(voice);
+		endx &= ~(1 << i);
+	}
+}
+
+void SPU::key_off(uint32_t mask)
+{
+	for (uint32_t i = 0; i < SPU_VOICES; i++)
+	{
+		if ((mask & (1 << i)) && voices[i].phase != AdsrPhase::Off)
+		{
+			voices[i].phase = AdsrPhase::Release;
+			voices[i].adsr_wait = 0;
+		}
+	}
+}
+
+void SPU::decode_block(Voice& voice)
+{
+	const uint8_t* block = &ram[voice.cur_addr];
+
+	check_irq(voice.cur_addr);
+
+	// Keep the tail of the previous block for the interpolator
+	voice.samples[0] = voice.samples[28];
+	voice.samples[1] = voice.samples[29];
+	voice.samples[2] = voice.samples[30];
+
+	int shift = block[0] & 0xF;
+	int filter = std::min((block[0] >> 4) & 0x7, 4);
+	voice.block_flags = block[1];
+
+	// Shift values 13-15 behave like 9
+	if (shift > 12)
+		shift = 9;
+
+	int32_t old = voice.adpcm_old;
+	int32_t older = voice.adpcm_older;
+
+	for (int i = 0; i < 28; i++)
+	{
+		int32_t nibble = (block[2 + i / 2] >> ((i & 1) * 4)) & 0xF;
+		int32_t sample = (int16_t)(nibble << 12) >> shift;
+
+		sample += (old * adpcm_pos[filter] + older * adpcm_neg[filter] + 32) >> 6;
+		sample = clamp16(sample);
+
+		voice.samples[3 + i] = sample;
+		older = old;
+		old = sample;
+	}
+
+	voice.adpcm_old = old;
+	voice.adpcm_older = older;
+
+	if (voice.block_flags & 4)
+		voice.repeat_addr = voice.cur_addr / 8;
+}
+
+void SPU::tick_envelope(Voice& voice)
+{
+	if (voice.phase == AdsrPhase::Off)
+		return;
+
+	if (voice.adsr_wait > 0)
+	{
+		voice.adsr_wait--;
+		return;
+	}
+
+	uint32_t adsr = voice.adsr_lo | (voice.adsr_hi << 16);
+
+	bool exponential, decrease;
+	int shift, step;
+
+	switch (voice.phase)
+	{
+	case AdsrPhase::Attack:
+		exponential = adsr & (1 << 15);
+		decrease = false;
+		shift = (adsr >> 10) & 0x1F;
+		step = 7 - ((adsr >> 8) & 3);
+		break;
+	case AdsrPhase::Decay:
+		exponential = true;
+		decrease = true;
+		shift = ((adsr >> 4) & 0xF) << 2;
+		step = -8;
+		break;
+	case AdsrPhase::Sustain:
+		exponential = adsr & (1u << 31);
+		decrease = adsr & (1 << 30);
+		shift = (adsr >> 24) & 0x1F;
+		step = decrease ? -8 + ((adsr >> 22) & 3) : 7 - ((adsr >> 22) & 3);
+		break;
+	default:
+		exponential = adsr & (1 << 21);
+		decrease = true;
+		shift = ((adsr >> 16) & 0x1F);
+		step = -8;
+		break;
+	}
+
+	int32_t cycles = 1 << std::max(0, shift - 11);
+	int32_t delta = step << std::max(0, 11 - shift);
+
+	if (exponential && !decrease && voice.adsr_level > 0x6000)
+		cycles *= 4;
+	if (exponential && decrease)
+		delta = (delta * voice.adsr_level) >> 15;
+
+	voice.adsr_wait = cycles - 1;
+	voice.adsr_level = std::clamp<int32_t>(voice.adsr_level + delta, 0, 0x7FFF);
+
+	switch (voice.phase)
+	{
+	case AdsrPhase::Attack:
+		if (voice.adsr_level == 0x7FFF)
+			voice.phase = AdsrPhase::Decay;
+		break;
+	case AdsrPhase::Decay:
+		if (voice.adsr_level <= (int32_t)(((adsr & 0xF) + 1) * 0x800))
+			voice.phase = AdsrPhase::Sustain;
+		break;
+	case AdsrPhase::Release:
+		if (voice.adsr_level == 0)
+			voice.phase = AdsrPhase::Off;
+		break;
+	default:
+		break;
+	}
+}
+
+void SPU::tick_noise()
+{
+	int step = 4 + ((spucnt >> 8) & 3);
+	int shift = (spucnt >> 10) & 0xF;
+
+	int parity = ((noise_level >> 15) ^ (noise_level >> 12) ^ (noise_level >> 11) ^ (noise_level >> 10) ^ 1) & 1;
+
+	noise_timer -= step;
+	if (noise_timer < 0)
+	{
+		noise_level = (int16_t)((noise_level << 1) | parity);
+		noise_timer += 0x20000 >> shift;
+		if (noise_timer < 0)
+			noise_timer += 0x20000 >> shift;
+	}
+}
+
+void SPU::generate_block()
+{
+	alignas(16) int16_t out[SPU_BLOCK_SAMPLES * 2];
+	int32_t dry[SPU_BLOCK_SAMPLES * 2];
+	int32_t wet[SPU_BLOCK_SAMPLES * 2];
+
+	// Voice parameters laid out as 3 lanes of 8 for the mixer
+	alignas(16) int16_t raw[SPU_VOICES];
+	alignas(16) int16_t level[SPU_VOICES];
+	alignas(16) int16_t vol_l[SPU_VOICES];
+	alignas(16) int16_t vol_r[SPU_VOICES];
+	alignas(16) int16_t eon_mask[SPU_VOICES];
+
+	const bool enabled = spucnt & (1 << 15);
+	const bool unmuted = spucnt & (1 << 14);
+
+	for (uint32_t i = 0; i < SPU_VOICES; i++)
+	{
+		vol_l[i] = voices[i].cur_vol_l;
+		vol_r[i] = voices[i].cur_vol_r;
+		eon_mask[i] = (eon & (1 << i)) ? -1 : 0;
+	}
+
+	for (uint32_t s = 0; s < SPU_BLOCK_SAMPLES; s++)
+	{
+		tick_noise();
+
+		// Per-voice sample generation is inherently serial (ADPCM history,
+		// pitch modulation from the previous voice), so it stays scalar
+		for (uint32_t i = 0; i < SPU_VOICES; i++)
+		{
+			auto& voice = voices[i];
+
+			if (voice.phase == AdsrPhase::Off)
+			{
+				raw[i] = level[i] = 0;
+				voice.last_out = 0;
+				continue;
+			}
+
+			uint32_t pos = voice.counter >> 12;
+			uint32_t frac = (voice.counter >> 4) & 0xFF;
+			const int16_t* src = &voice.samples[pos];
+
+			int32_t sample = (gauss_table[0x0FF - frac] * src[0]) >> 15;
+			sample += (gauss_table[0x1FF - frac] * src[1]) >> 15;
+			sample += (gauss_table[0x100 + frac] * src[2]) >> 15;
+			sample += (gauss_table[frac] * src[3]) >> 15;
+
+			raw[i] = (non & (1 << i)) ? noise_level : clamp16(sample);
+			level[i] = voice.adsr_level;
+			voice.last_out = (raw[i] * voice.adsr_level) >> 15;
+
+			tick_envelope(voice);
+
+			uint32_t step = voice.pitch;
+			if (i > 0 && (pmon & (1 << i)))
+				step = (step * (uint32_t)(voices[i - 1].last_out + 0x8000)) >> 15;
+			voice.counter += std::min<uint32_t>(step, 0x4000);
+
+			while ((voice.counter >> 12) >= 28)
+			{
+				voice.counter -= 28 << 12;
+
+				if (voice.block_flags & 1)
+				{
+					endx |= (1 << i);
+					voice.cur_addr = (voice.repeat_addr * 8) & (SPU_RAM_SIZE - 1);
+
+					if (!(voice.block_flags & 2))
+					{
+						voice.phase = AdsrPhase::Off;
+						voice.adsr_level = 0;
+					}
+				}
+				else
+					voice.cur_addr = (voice.cur_addr + 16) & (SPU_RAM_SIZE - 1);
+
+				decode_block(voice);
+			}
+		}
+
+		int32_t left = 0, right = 0;
+		int32_t wet_l = 0, wet_r = 0;
+
+#ifdef __SSE2__
+		// Envelope and volume are applied 8 voices per lane as full 32-bit
+		// products ((a * b) >> 15, like the hardware), then summed. Voices
+		// enabled in EON are also summed into the reverb send.
+		__m128i acc_l = _mm_setzero_si128();
+		__m128i acc_r = _mm_setzero_si128();
+		__m128i send_l = _mm_setzero_si128();
+		__m128i send_r = _mm_setzero_si128();
+
+		for (uint32_t i = 0; i < SPU_VOICES; i += 8)
+		{
+			__m128i r = _mm_load_si128((const __m128i*)&raw[i]);
+			__m128i e = _mm_load_si128((const __m128i*)&level[i]);
+
+			__m128i v_lo = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_mullo_epi16(r, e), _mm_mulhi_epi16(r, e)), 15);
+			__m128i v_hi = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_mullo_epi16(r, e), _mm_mulhi_epi16(r, e)), 15);
+			__m128i v = _mm_packs_epi32(v_lo, v_hi);
+
+			__m128i m = _mm_load_si128((const __m128i*)&eon_mask[i]);
+			__m128i m_lo = _mm_unpacklo_epi16(m, m), m_hi = _mm_unpackhi_epi16(m, m);
+
+			__m128i l = _mm_load_si128((const __m128i*)&vol_l[i]);
+			__m128i rv = _mm_load_si128((const __m128i*)&vol_r[i]);
+
+			__m128i lo = _mm_mullo_epi16(v, l), hi = _mm_mulhi_epi16(v, l);
+			__m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+			__m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+			acc_l = _mm_add_epi32(acc_l, _mm_add_epi32(p0, p1));
+			send_l = _mm_add_epi32(send_l, _mm_add_epi32(_mm_and_si128(p0, m_lo), _mm_and_si128(p1, m_hi)));
+
+			lo = _mm_mullo_epi16(v, rv);
+			hi = _mm_mulhi_epi16(v, rv);
+			p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 15);
+			p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 15);
+			acc_r = _mm_add_epi32(acc_r, _mm_add_epi32(p0, p1));
+			send_r = _mm_add_epi32(send_r, _mm_add_epi32(_mm_and_si128(p0, m_lo), _mm_and_si128(p1, m_hi)));
+		}
+
+		alignas(16) int32_t sums[16];
+		_mm_store_si128((__m128i*)&sums[0], acc_l);
+		_mm_store_si128((__m128i*)&sums[4], acc_r);
+		_mm_store_si128((__m128i*)&sums[8], send_l);
+		_mm_store_si128((__m128i*)&sums[12], send_r);
+
+		left = sums[0] + sums[1] + sums[2] + sums[3];
+		right = sums[4] + sums[5] + sums[6] + sums[7];
+		wet_l = sums[8] + sums[9] + sums[10] + sums[11];
+		wet_r = sums[12] + sums[13] + sums[14] + sums[15];
+#else
+		for (uint32_t i = 0; i < SPU_VOICES; i++)
+		{
+			int32_t v = (raw[i] * level[i]) >> 15;
+			int32_t l = (v * vol_l[i]) >> 15;
+			int32_t r = (v * vol_r[i]) >> 15;
+
+			left += l;
+			right += r;
+			wet_l += l & eon_mask[i];
+			wet_r += r & eon_mask[i];
+		}
+#endif
+
+		dry[s * 2 + 0] = clamp16(left);
+		dry[s * 2 + 1] = clamp16(right);
+		wet[s * 2 + 0] = clamp16(wet_l);
+		wet[s * 2 + 1] = clamp16(wet_r);
+	}
+
+	// Reverb is skipped entirely while it can neither be heard nor written
+	if ((spucnt & (1 << 7)) || reverb_vol_l || reverb_vol_r)
+		process_reverb(wet, wet);
+	else
+		std::fill(std::begin(wet), std::end(wet), 0);
+
+	for (uint32_t s = 0; s < SPU_BLOCK_SAMPLES * 2; s += 2)
+	{
+		if (!enabled || !unmuted)
+		{
+			out[s + 0] = out[s + 1] = 0;
+			continue;
+		}
+
+		out[s + 0] = clamp16(((dry[s + 0] * cur_main_l) >> 15) + wet[s + 0]);
+		out[s + 1] = clamp16(((dry[s + 1] * cur_main_r) >> 15) + wet[s + 1]);
+	}
+
+	if (output)
+		output(out, SPU_BLOCK_SAMPLES);
+}
+
+void SPU::dma_write(const uint8_t* src, uint32_t size)
+{
+	// Transfers wrap around the end of sound RAM
+	while (size > 0)
+	{
+		uint32_t chunk = std::min(size, SPU_RAM_SIZE - transfer_cur);
+
+		if ((spucnt & (1 << 6)) && (uint32_t)irq_addr * 8 >= transfer_cur && (uint32_t)irq_addr * 8 < transfer_cur + chunk)
+			check_irq(irq_addr * 8);
+
+		std::memcpy(&ram[transfer_cur], src, chunk);
+
+		src += chunk;
+		size -= chunk;
+		transfer_cur = (transfer_cur + chunk) & (SPU_RAM_SIZE - 1);
+	}
+}
+
+void SPU::dma_read(uint8_t* dst, uint32_t size)
+{
+	while (size > 0)
+	{
+		uint32_t chunk = std::min(size, SPU_RAM_SIZE - transfer_cur);
+
+		if ((spucnt & (1 << 6)) && (uint32_t)irq_addr * 8 >= transfer_cur && (uint32_t)irq_addr * 8 < transfer_cur + chunk)
+			check_irq(irq_addr * 8);
+
+		std::memcpy(dst, &ram[transfer_cur], chunk);
+
+		dst += chunk;
+		size -= chunk;
+		transfer_cur = (transfer_cur + chunk) & (SPU_RAM_SIZE - 1);
+	}
+}
+
+uint16_t SPU::read(uint32_t addr)
+{
+	uint32_t offset = (addr - 0x1f801c00) & 0x3FE;
+
+	if (offset < 0x180)
+	{
+		auto& voice = voices[offset >> 4];
+
+		switch (offset & 0xF)
+		{
+		case 0x0:
+			return voice.vol_l;
+		case 0x2:
+			return voice.vol_r;
+		case 0x4:
+			return voice.pitch;
+		case 0x6:
+			return voice.start_addr;
+		case 0x8:
+			return voice.adsr_lo;
+		case 0xA:
+			return voice.adsr_hi;
+		case 0xC:
+			return voice.adsr_level;
+		case 0xE:
+			return voice.repeat_addr;
+		}
+	}
+
+	if (offset >= 0x1C0 && offset < 0x200)
+		return reverb_regs[(offset - 0x1C0) / 2];
+
+	if (offset >= 0x200 && offset < 0x260)
+	{
+		auto& voice = voices[(offset - 0x200) >> 2];
+		return (offset & 2) ? voice.cur_vol_r : voice.cur_vol_l;
+	}
+
+	switch (offset)
+	{
+	case 0x180:
+		return main_vol_l;
+	case 0x182:
+		return main_vol_r;
+	case 0x184:
+		return reverb_vol_l;
+	case 0x186:
+		return reverb_vol_r;
+	case 0x188:
+	case 0x18A:
+	case 0x18C:
+	case 0x18E:
+		return 0;
+	case 0x190:
+		return pmon & 0xFFFF;
+	case 0x192:
+		return pmon >> 16;
+	case 0x194:
+		return non & 0xFFFF;
+	case 0x196:
+		return non >> 16;
+	case 0x198:
+		return eon & 0xFFFF;
+	case 0x19A:
+		return eon >> 16;
+	case 0x19C:
+		return endx & 0xFFFF;
+	case 0x19E:
+		return endx >> 16;
+	case 0x1A2:
+		return reverb_base;
+	case 0x1A4:
+		return irq_addr;
+	case 0x1A6:
+		return transfer_addr;
+	case 0x1AA:
+		return spucnt;
+	case 0x1AC:
+		return transfer_ctrl;
+	case 0x1AE:
+		return spustat;
+	case 0x1B0:
+		return cd_vol_l;
+	case 0x1B2:
+		return cd_vol_r;
+	case 0x1B4:
+		return ext_vol_l;
+	case 0x1B6:
+		return ext_vol_r;
+	case 0x1B8:
+		return cur_main_l;
+	case 0x1BA:
+		return cur_main_r;
+	default:
+		return 0;
+	}
+}
+
+void SPU::write(uint32_t addr, uint16_t data)
+{
+	uint32_t offset = (addr - 0x1f801c00) & 0x3FE;
+
+	if (offset < 0x180)
+	{
+		auto& voice = voices[offset >> 4];
+
+		switch (offset & 0xF)
+		{
+		case 0x0:
+			voice.vol_l = data;
+			set_volume(data, voice.cur_vol_l);
+			break;
+		case 0x2:
+			voice.vol_r = data;
+			set_volume(data, voice.cur_vol_r);
+			break;
+		case 0x4:
+			voice.pitch = data;
+			break;
+		case 0x6:
+			voice.start_addr = data;
+			break;
+		case 0x8:
+			voice.adsr_lo = data;
+			break;
+		case 0xA:
+			voice.adsr_hi = data;
+			break;
+		case 0xC:
+			voice.adsr_level = data;
+			break;
+		case 0xE:
+			voice.repeat_addr = data;
+			break;
+		}
+		return;
+	}
+
+	if (offset >= 0x1C0 && offset < 0x200)
+	{
+		reverb_regs[(offset - 0x1C0) / 2] = data;
+		return;
+	}
+
+	switch (offset)
+	{
+	case 0x180:
+		main_vol_l = data;
+		set_volume(data, cur_main_l);
+		break;
+	case 0x182:
+		main_vol_r = data;
+		set_volume(data, cur_main_r);
+		break;
+	case 0x184:
+		reverb_vol_l = data;
+		break;
+	case 0x186:
+		reverb_vol_r = data;
+		break;
+	case 0x188:
+		key_on(data);
+		break;
+	case 0x18A:
+		key_on(data << 16);
+		break;
+	case 0x18C:
+		key_off(data);
+		break;
+	case 0x18E:
+		key_off(data << 16);
+		break;
+	case 0x190:
+		pmon = (pmon & 0xFFFF0000) | data;
+		break;
+	case 0x192:
+		pmon = (pmon & 0xFFFF) | (data << 16);
+		break;
+	case 0x194:
+		non = (non & 0xFFFF0000) | data;
+		break;
+	case 0x196:
+		non = (non & 0xFFFF) | (data << 16);
+		break;
+	case 0x198:
+		eon = (eon & 0xFFFF0000) | data;
+		break;
+	case 0x19A:
+		eon = (eon & 0xFFFF) | (data << 16);
+		break;
+	case 0x19C:
+	case 0x19E:
+		break;
+	case 0x1A2:
+		reverb_base = data;
+		reverb_pos = 0;
+		break;
+	case 0x1A4:
+		irq_addr = data;
+		break;
+	case 0x1A6:
+		transfer_addr = data;
+		transfer_cur = (data * 8) & (SPU_RAM_SIZE - 1);
+		break;
+	case 0x1A8:
+		check_irq(transfer_cur);
+		ram[transfer_cur] = data & 0xFF;
+		ram[transfer_cur + 1] = data >> 8;
+		transfer_cur = (transfer_cur + 2) & (SPU_RAM_SIZE - 1);
+		break;
+	case 0x1AA:
+		spucnt = data;
+		if (!(spucnt & (1 << 6)))
+			spustat &= ~(1 << 6);
+		// SPUSTAT mirrors the mode bits of SPUCNT; transfers complete instantly
+		spustat = (spustat & ~0x3F) | (spucnt & 0x3F);
+		break;
+	case 0x1AC:
+		transfer_ctrl = data;
+		break;
+	case 0x1B0:
+		cd_vol_l = data;
+		break;
+	case 0x1B2:
+		cd_vol_r = data;
+		break;
+	case 0x1B4:
+		ext_vol_l = data;
+		break;
+	case 0x1B6:
+		ext_vol_r = data;
+		break;
+	default:
+		break;
+	}
+}
+
+void SPU::do_state(StateStream& s)
+{
+	s.section("SPU ", 1);
+
+	s.value(voices);
+	s.bytes(ram, SPU_RAM_SIZE);
+
+	s.value(main_vol_l);
+	s.value(main_vol_r);
+	s.value(cur_main_l);
+	s.value(cur_main_r);
+	s.value(reverb_vol_l);
+	s.value(reverb_vol_r);
+	s.value(pmon);
+	s.value(non);
+	s.value(eon);
+	s.value(endx);
+
+	s.value(irq_addr);
+	s.value(transfer_addr);
+	s.value(transfer_cur);
+	s.value(spucnt);
+	s.value(transfer_ctrl);
+	s.value(spustat);
+	s.value(cd_vol_l);
+	s.value(cd_vol_r);
+	s.value(ext_vol_l);
+	s.value(ext_vol_r);
+
+	s.value(reverb_base);
+	s.value(reverb_regs);
+	s.value(reverb_pos);
+	s.value(reverb_prev_l);
+	s.value(reverb_prev_r);
+
+	s.value(noise_timer);
+	s.value(noise_level);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <util/state.h>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+class Bus;
+
+constexpr uint32_t SPU_RAM_SIZE = 0x80000;
+constexpr uint32_t SPU_VOICES = 24;
+constexpr uint32_t SPU_SAMPLE_RATE = 44100;
+constexpr uint32_t SPU_CYCLES_PER_SAMPLE = 768;
+
+// Samples are generated in blocks off a single scheduler event
+constexpr uint32_t SPU_BLOCK_SAMPLES = 32;
+
+class SPU
+{
+private:
+	enum class AdsrPhase : uint8_t
+	{
+		Off,
+		Attack,
+		Decay,
+		Sustain,
+		Release,
+	};
+
+	struct Voice
+	{
+		uint16_t vol_l = 0, vol_r = 0;
+		int16_t cur_vol_l = 0, cur_vol_r = 0;
+		uint16_t pitch = 0;
+		uint16_t start_addr = 0;
+		uint16_t adsr_lo = 0, adsr_hi = 0;
+		uint16_t repeat_addr = 0;
+
+		uint32_t cur_addr = 0;		// Address of the current ADPCM block, in bytes
+		uint32_t counter = 0;		// Pitch counter, 4.12 sample position in the block
+		uint8_t block_flags = 0;
+
+		// Last three samples of the previous block followed by the current one,
+		// so the interpolator can always look back
+		int16_t samples[3 + 28] = {};
+		int16_t adpcm_old = 0, adpcm_older = 0;
+
+		AdsrPhase phase = AdsrPhase::Off;
+		int16_t adsr_level = 0;
+		int32_t adsr_wait = 0;
+
+		int16_t last_out = 0;		// Used by pitch modulation of the next voice
+	};
+
+	Voice voices[SPU_VOICES];
+
+	uint8_t* ram;
+
+	uint16_t main_vol_l = 0, main_vol_r = 0;
+	int16_t cur_main_l = 0, cur_main_r = 0;
+	uint16_t reverb_vol_l = 0, reverb_vol_r = 0;
+	uint32_t pmon = 0, non = 0, eon = 0;
+	uint32_t endx = 0;
+
+	uint16_t irq_addr = 0;
+	uint16_t transfer_addr = 0;
+	uint32_t transfer_cur = 0;		// Current transfer position, in bytes
+	uint16_t spucnt = 0;
+	uint16_t transfer_ctrl = 0;
+	uint16_t spustat = 0;
+	uint16_t cd_vol_l = 0, cd_vol_r = 0;
+	uint16_t ext_vol_l = 0, ext_vol_r = 0;
+
+	// Reverb configuration (0x1f801dc0-0x1f801dff), see reverb.cpp
+	uint16_t reverb_base = 0;
+	uint16_t reverb_regs[0x20] = {};
+	uint32_t reverb_pos = 0;		// Halfwords past the start of the work area
+	int32_t reverb_prev_l = 0, reverb_prev_r = 0;
+
+	int32_t noise_timer = 0;
+	int16_t noise_level = 1;
+
+	std::function<void(const int16_t*, size_t)> output;
+
+	Bus* bus;
+
+	void key_on(uint32_t mask);
+	void key_off(uint32_t mask);
+
+	void decode_block(Voice& voice);
+	void check_irq(uint32_t addr);
+
+	void tick_envelope(Voice& voice);
+	void tick_noise();
+
+	void process_reverb(const int32_t* in, int32_t* out);
+	void generate_block();
+public:
+	SPU(Bus* bus);
+	~SPU();
+
+	uint16_t read(uint32_t addr);
+	void write(uint32_t addr, uint16_t data);
+
+	// DMA channel 4, whole blocks at a time
+	void dma_write(const uint8_t* src, uint32_t size);
+	void dma_read(uint8_t* dst, uint32_t size);
+
+	void do_state(StateStream& s);
+
+	// Receives every generated block of interleaved stereo samples
+	void set_output(std::function<void(const int16_t*, size_t)> callback) {output = callback;}
+};
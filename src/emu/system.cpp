@@ -2,30 +2,696 @@
 #include <emu/cpu/cpu.h>
 #include <emu/memory/Bus.h>
 #include <emu/renderer/renderer.h>
+#include <emu/audio/audio_sink.h>
+#include <emu/bios/hle.h>
+#include <emu/cdvd/iso9660.h>
+#include <util/state.h>
+#include <util/rewind.h>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
 
-CPU* cpu;
-Bus* bus;
-renderer::Renderer* g_renderer;
+static uint64_t fnv1a(const uint8_t* data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 0x100000001b3;
+
+	return hash;
+}
 
 System::System(std::string biosPath)
 {
 	bus = new Bus(biosPath);
 	cpu = new CPU(bus);
-	g_renderer = new renderer::Renderer();
-	g_renderer->gpu = bus->get_gpu();
-	g_renderer->set_texture_size(VRAM_WIDTH, VRAM_HEIGHT);
+	hle = new BiosHle(bus);
+	cpu->SetBiosHle(hle);
+	bios_hash = fnv1a(bus->bios, Bus::BIOS_SIZE);
+
+	// Nothing plugged in until someone sets the pads
+	memset(pads.axes, 0x80, sizeof(pads.axes));
+	apply_pads();
 }
 
-void System::Clock()
+System::~System()
+{
+	// Closing the disc flushes its access profile
+	bus->dvd->eject_disc();
+
+	bus->spu->set_output(nullptr);
+	delete audio_sink;
+
+	bus->sio->get_card(0).close();
+	bus->sio->get_card(1).close();
+
+	cpu->SetBiosHle(nullptr);
+	delete hle;
+	delete rewind;
+
+	delete cpu;
+	delete bus;
+}
+
+void System::InsertDisc(std::string discPath)
+{
+	if (movie_mode == MovieMode::Playing)
+		return;
+
+	insert_disc(discPath);
+
+	if (movie_mode == MovieMode::Recording)
+		movie.add_disc(movie_frame, discPath);
+}
+
+void System::insert_disc(const std::string& path)
+{
+	if (path == disc_path)
+		return;
+
+	bus->dvd->insert_disc(path);
+	disc_path = path;
+
+	if (auto disc = bus->dvd->get_disc())
+		disc->set_profiling(!speculative);
+}
+
+void System::set_speculative(bool on)
+{
+	speculative = on;
+	cpu->SetSpeculative(on);
+
+	if (auto disc = bus->dvd->get_disc())
+		disc->set_profiling(!on);
+}
+
+void System::SetAudioSink(AudioSink* sink)
+{
+	delete audio_sink;
+	audio_sink = sink;
+
+	if (!sink)
+	{
+		bus->spu->set_output(nullptr);
+		return;
+	}
+
+	bus->spu->set_output([this, sink](const int16_t* samples, size_t frames)
+	{
+		if (!speculative && !headless)
+			sink->submit(samples, frames);
+	});
+}
+
+void System::SetHeadless(bool on)
+{
+	headless = on;
+
+	if (on)
+		bus->mdec->set_workers(0);
+}
+
+void System::SetMdecWorkers(size_t threads)
+{
+	bus->mdec->set_workers(threads);
+}
+
+void System::SetMdecDithering(bool on)
+{
+	bus->mdec->set_dithering(on);
+}
+
+void System::SetCpuFeatures(uint32_t features)
+{
+	cpu->SetFeatures(features);
+}
+
+void System::FastBoot(std::string exe)
+{
+	fast_boot = true;
+	boot_exe = exe;
+
+	if (!warm_boot_dir.empty() && load_warm_boot())
+	{
+		warm_boot_hit = true;
+		enter_shell();
+		return;
+	}
+
+	cpu->SetStopPc(SHELL_ENTRY);
+}
+
+void System::enter_shell()
+{
+	fast_boot = false;
+
+	if (!warm_boot_dir.empty() && !warm_boot_hit)
+		save_warm_boot();
+
+	if (!boot_exe.empty())
+		bus->LoadEXE(boot_exe, cpu);
+	else
+		boot_disc();
+
+	cpu->Resume();
+}
+
+// Same lookup as the BIOS: BOOT (and optionally STACK) from SYSTEM.CNF,
+// PSX.EXE if there is none. Without a disc the shell just starts as usual
+void System::boot_disc()
+{
+	CdImage* disc = bus->dvd->get_disc();
+
+	if (!disc)
+	{
+		printf("[emu/System]: No disc to fast boot, entering the shell\n");
+		return;
+	}
+
+	Iso9660 iso(disc);
+	Iso9660::File file;
+
+	std::string boot_path = "cdrom:\\PSX.EXE;1";
+	uint32_t stack = Bus::DEFAULT_EXE_STACK;
+
+	if (iso.find("SYSTEM.CNF;1", file))
+	{
+		std::string cnf(file.size, '\0');
+		cnf.resize(iso.read(file, 0, (uint8_t*)cnf.data(), file.size));
+
+		size_t pos = 0;
+		while (pos < cnf.size())
+		{
+			size_t end = cnf.find_first_of("\r\n", pos);
+			if (end == std::string::npos)
+				end = cnf.size();
+
+			std::string line = cnf.substr(pos, end - pos);
+			pos = end + 1;
+
+			size_t eq = line.find('=');
+			if (eq == std::string::npos)
+				continue;
+
+			auto trim = [](std::string str)
+			{
+				size_t first = str.find_first_not_of(" \t");
+				size_t last = str.find_last_not_of(" \t");
+				return first == std::string::npos ? std::string() : str.substr(first, last - first + 1);
+			};
+
+			std::string key = trim(line.substr(0, eq));
+			std::string value = trim(line.substr(eq + 1));
+
+			if (key == "BOOT")
+				boot_path = value;
+			else if (key == "STACK")
+				stack = strtoul(value.c_str(), nullptr, 16);
+		}
+	}
+
+	if (!iso.find(boot_path, file))
+	{
+		printf("[emu/System]: Couldn't find %s on the disc, entering the shell\n", boot_path.c_str());
+		return;
+	}
+
+	std::vector<uint8_t> exe(file.size);
+	exe.resize(iso.read(file, 0, exe.data(), file.size));
+
+	printf("[emu/System]: Booting %s\n", boot_path.c_str());
+	bus->LoadEXE(exe, cpu, stack);
+}
+
+// State file: this header, then the SaveState() data
+struct StateFileHeader
+{
+	char magic[8] = {'P', 'S', 'X', 'S', 'T', 'A', 'T', 'E'};
+	uint32_t version = System::STATE_VERSION;
+	uint32_t reserved = 0;
+	uint64_t bios_hash = 0;
+	uint64_t state_size = 0;
+	uint64_t state_hash = 0;	// FNV-1a of the state data
+};
+
+// One snapshot per BIOS, and per disc/no disc since the BIOS has already
+// looked at the drive by the time it enters the shell. The HLE set is part
+// of the key as well, as the boot leaves HLE-only state (e.g. the heap)
+// behind that a different set wouldn't know about
+std::string System::warm_boot_path()
+{
+	char name[80];
+	snprintf(name, sizeof(name), "/bios-%016llx-hle-%016llx-%s.warm", (unsigned long long)bios_hash,
+		(unsigned long long)hle->enabled_mask(), bus->dvd->get_disc() ? "disc" : "nodisc");
+	return warm_boot_dir + name;
+}
+
+bool System::load_warm_boot()
+{
+	std::string path = warm_boot_path();
+
+	if (access(path.c_str(), F_OK))
+		return false;
+
+	return LoadStateFile(path);
+}
+
+void System::save_warm_boot()
+{
+	SaveStateFile(warm_boot_path());
+}
+
+void System::do_state(StateStream& s)
+{
+	cpu->do_state(s);
+	bus->do_state(s);
+	hle->do_state(s);
+}
+
+void System::SaveState(std::vector<uint8_t>& out)
+{
+	// Saves happen over and over for checkpoints; avoid regrowing the
+	// buffer from scratch each time
+	out.reserve(out.size() + state_size_hint);
+
+	size_t start = out.size();
+	StateStream s(out);
+	do_state(s);
+
+	state_size_hint = out.size() - start;
+}
+
+bool System::LoadState(const std::vector<uint8_t>& in)
+{
+	return LoadState(in.data(), in.size());
+}
+
+bool System::LoadState(const uint8_t* data, size_t size)
+{
+	// Cheap enough to keep the current state around, so a bad state
+	// doesn't leave the machine half loaded
+	std::vector<uint8_t> backup;
+	SaveState(backup);
+
+	StateStream s(data, size);
+	do_state(s);
+
+	if (s.ok())
+		return true;
+
+	printf("[emu/System]: Bad save state (section '%s')\n", s.failed_section());
+
+	StateStream restore(backup.data(), backup.size());
+	do_state(restore);
+	return false;
+}
+
+bool System::SaveStateFile(std::string path)
+{
+	std::vector<uint8_t> state;
+	SaveState(state);
+
+	StateFileHeader header;
+	header.bios_hash = bios_hash;
+	header.state_size = state.size();
+	header.state_hash = fnv1a(state.data(), state.size());
+
+	// Written under a temporary name and renamed, so an interrupted save
+	// or a concurrent reader never sees a partial file
+	std::string tmp = path + "." + std::to_string(getpid());
+	FILE* file = fopen(tmp.c_str(), "wb");
+
+	if (!file)
+	{
+		printf("[emu/System]: Couldn't open %s for writing\n", tmp.c_str());
+		return false;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(state.data(), 1, state.size(), file) == state.size();
+	ok = fclose(file) == 0 && ok;
+
+	if (!ok || rename(tmp.c_str(), path.c_str()))
+	{
+		printf("[emu/System]: Couldn't write %s\n", path.c_str());
+		remove(tmp.c_str());
+		return false;
+	}
+
+	printf("[emu/System]: Saved state to %s\n", path.c_str());
+	return true;
+}
+
+bool System::LoadStateFile(std::string path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+
+	if (!file)
+	{
+		printf("[emu/System]: Couldn't open %s\n", path.c_str());
+		return false;
+	}
+
+	StateFileHeader header, expected;
+	std::vector<uint8_t> state;
+
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+
+	if (ok && (memcmp(header.magic, expected.magic, sizeof(header.magic)) || header.version != STATE_VERSION))
+	{
+		printf("[emu/System]: %s is not a version %d save state\n", path.c_str(), STATE_VERSION);
+		ok = false;
+	}
+	else if (ok && header.bios_hash != bios_hash)
+	{
+		printf("[emu/System]: %s was saved with a different BIOS\n", path.c_str());
+		ok = false;
+	}
+	else if (ok && header.state_size > Movie::MAX_STATE_SIZE)
+	{
+		printf("[emu/System]: %s is corrupt\n", path.c_str());
+		ok = false;
+	}
+	else if (ok)
+	{
+		state.resize(header.state_size);
+		ok = fread(state.data(), 1, state.size(), file) == state.size();
+
+		if (ok && fnv1a(state.data(), state.size()) != header.state_hash)
+		{
+			printf("[emu/System]: %s is corrupt\n", path.c_str());
+			ok = false;
+		}
+	}
+
+	fclose(file);
+
+	if (!ok || !LoadState(state))
+	{
+		printf("[emu/System]: Couldn't load state from %s\n", path.c_str());
+		return false;
+	}
+
+	// The card files have moved on since the state was saved; writing its
+	// cards back would undo every save made in between
+	bus->sio->reload_cards();
+
+	printf("[emu/System]: Loaded state from %s\n", path.c_str());
+	return true;
+}
+
+void System::EnableRewind(size_t budget)
+{
+	delete rewind;
+	rewind = budget ? new RewindBuffer(budget) : nullptr;
+}
+
+size_t System::Rewind(size_t frames)
+{
+	// Movies only go forwards; SeekMovie() is the way back in playback
+	if (!rewind || movie_mode != MovieMode::None)
+		return 0;
+
+	frames = rewind->rewind(frames);
+
+	if (frames)
+		LoadState(rewind->current());
+
+	return frames;
+}
+
+void System::SetPad(int port, bool connected, uint16_t buttons)
+{
+	if (movie_mode == MovieMode::Playing)
+		return;
+
+	pads.connected[port] = connected;
+	pads.buttons[port] = buttons;
+	apply_pads();
+}
+
+void System::SetPadAxes(int port, uint8_t rx, uint8_t ry, uint8_t lx, uint8_t ly)
+{
+	if (movie_mode == MovieMode::Playing)
+		return;
+
+	uint8_t axes[4] = {rx, ry, lx, ly};
+	memcpy(pads.axes[port], axes, sizeof(axes));
+	apply_pads();
+}
+
+void System::SetAnalogPad(int port, bool analog)
+{
+	analog_pads[port] = analog;
+	apply_pads();
+}
+
+void System::apply_pads()
+{
+	for (int port = 0; port < 2; port++)
+	{
+		Pad& pad = bus->sio->get_pad(port);
+
+		if (!pads.connected[port])
+			pad.set_type(Pad::Type::None);
+		else
+			pad.set_type(analog_pads[port] ? Pad::Type::Analog : Pad::Type::Digital);
+
+		pad.set_buttons(pads.buttons[port]);
+		pad.set_axes(pads.axes[port][0], pads.axes[port][1], pads.axes[port][2], pads.axes[port][3]);
+
+		hle->set_pad(port, pads.connected[port], pads.buttons[port]);
+	}
+}
+
+bool System::InsertCard(int port, std::string path)
+{
+	return bus->sio->get_card(port).open(path);
+}
+
+void System::RecordMovie(std::string path, uint32_t keyframe_interval)
+{
+	StopMovie();
+
+	movie_path = path;
+	movie_keyframes = keyframe_interval;
+	movie_mode = MovieMode::Starting;
+}
+
+// A movie has to start on a frame boundary: the frame loop isn't part of
+// the machine state, so playback always begins at the top of Clock()
+void System::start_recording()
+{
+	std::vector<uint8_t> state;
+	SaveState(state);
+
+	if (!movie.create(movie_path, bios_hash, movie_keyframes, state))
+	{
+		movie_mode = MovieMode::None;
+		return;
+	}
+
+	movie_mode = MovieMode::Recording;
+	movie_frame = 0;
+
+	if (!disc_path.empty())
+		movie.add_disc(0, disc_path);
+
+	printf("[emu/System]: Recording movie to %s\n", movie_path.c_str());
+}
+
+bool System::PlayMovie(std::string path)
+{
+	StopMovie();
+
+	if (!movie.open(path, bios_hash))
+		return false;
+
+	movie_mode = MovieMode::Playing;
+
+	if (!SeekMovie(0))
+	{
+		movie_mode = MovieMode::None;
+		return false;
+	}
+
+	return true;
+}
+
+void System::StopMovie()
+{
+	// The recording's cards were only ever played with, the files win
+	if (movie_mode == MovieMode::Playing)
+		bus->sio->reload_cards();
+
+	movie.close();
+	movie_mode = MovieMode::None;
+	movie_frame = 0;
+}
+
+bool System::SeekMovie(uint32_t frame)
+{
+	if (movie_mode != MovieMode::Playing || frame > movie.length())
+		return false;
+
+	std::vector<uint8_t> state;
+	movie_frame = movie.keyframe(frame, state);
+
+	// The disc isn't part of the state; use whichever was in at the keyframe
+	for (auto& change : movie.disc_changes())
+	{
+		if (change.frame <= movie_frame)
+			insert_disc(change.path);
+	}
+
+	if (!LoadState(state))
+	{
+		StopMovie();
+		return false;
+	}
+
+	// Replay up to the frame, without showing or playing anything
+	set_speculative(true);
+	while (movie_frame < frame)
+	{
+		movie_begin_frame();
+		run_frame(false);
+		movie_frame++;
+	}
+	set_speculative(false);
+
+	return true;
+}
+
+void System::movie_begin_frame()
+{
+	if (movie_mode == MovieMode::Starting && !fast_boot)
+		start_recording();
+
+	if (movie_mode == MovieMode::Recording)
+	{
+		if (movie_keyframes && movie_frame && movie_frame % movie_keyframes == 0)
+		{
+			std::vector<uint8_t> state;
+			SaveState(state);
+			movie.add_keyframe(movie_frame, state);
+		}
+
+		movie.add_input(pads);
+	}
+	else if (movie_mode == MovieMode::Playing)
+	{
+		if (movie_frame >= movie.length())
+		{
+			printf("[emu/System]: Movie finished at frame %d\n", movie_frame);
+			StopMovie();
+			return;
+		}
+
+		for (auto& change : movie.disc_changes())
+		{
+			if (change.frame == movie_frame)
+				insert_disc(change.path);
+		}
+
+		pads = movie.input(movie_frame);
+		apply_pads();
+	}
+}
+
+bool System::PatchMemory(uint32_t addr, const uint8_t* data, uint32_t size)
+{
+	uint8_t* dst = bus->get_host_pointer(addr, size);
+
+	if (!dst)
+		return false;
+
+	memcpy(dst, data, size);
+	cpu->FlushICache();
+	return true;
+}
+
+uint64_t System::RamHash()
+{
+	return fnv1a(bus->ram, sizeof(bus->ram));
+}
+
+uint32_t System::GetPc()
+{
+	return cpu->GetPc();
+}
+
+void System::AfterFork()
+{
+	headless = true;
+	run_ahead = 0;
+	EnableRewind(0);
+
+	// The movie file belongs to the parent; the child just stops adding to it
+	movie_mode = MovieMode::None;
+	bus->mdec->detach_workers();
+}
+
+bool System::ConfigureHle(std::string spec)
+{
+	return hle->configure(spec);
+}
+
+void System::run_frame(bool present)
 {
 	for (int i = 0; i < 564480 / 100; i += 2)
 	{
 		cpu->Clock(100);
 		bus->step();
+
+		if (fast_boot && cpu->Stopped())
+			enter_shell();
 	}
 
-	g_renderer->render((const void*)bus->get_gpu()->GetVram().data());
+	if (present && !headless)
+		bus->get_gpu()->get_renderer()->render((const void*)bus->get_gpu()->GetVram().data());
+
 	bus->TriggerInterrupt(0);
+	hle->vblank();
+}
+
+void System::Clock()
+{
+	if (movie_mode != MovieMode::None)
+		movie_begin_frame();
+
+	// The BIOS is left to reach the shell for real before speculating
+	if (!run_ahead || fast_boot)
+		run_frame(true);
+	else
+	{
+		run_frame(false);
+
+		run_ahead_state.clear();
+		SaveState(run_ahead_state);
+
+		set_speculative(true);
+		for (uint32_t i = 0; i < run_ahead; i++)
+			run_frame(i == run_ahead - 1);
+		set_speculative(false);
+
+		// Our own state from a moment ago, so no need for LoadState's checks
+		StateStream s(run_ahead_state.data(), run_ahead_state.size());
+		do_state(s);
+	}
+
+	if (rewind)
+	{
+		rewind_scratch.clear();
+		SaveState(rewind_scratch);
+		rewind->push(rewind_scratch);
+	}
+
+	if (movie_mode == MovieMode::Recording || movie_mode == MovieMode::Playing)
+		movie_frame++;
+
+	// Replays and forked children leave the cards' files alone
+	if (!headless && movie_mode != MovieMode::Playing)
+		bus->sio->flush_cards();
 }
 
 void System::Dump()
@@ -1,11 +1,181 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
+#include <vector>
+#include <emu/movie.h>
 
+class AudioSink;
+class BiosHle;
+class Bus;
+class CPU;
+class StateStream;
+class RewindBuffer;
+
+// One emulated console. Instances share nothing but the BIOS mapping, so
+// any number of them can run at once, each on its own thread; only a
+// headless one may run off the main thread, see SetHeadless()
 class System
 {
+private:
+	CPU* cpu;
+	Bus* bus;
+
+	AudioSink* audio_sink = nullptr;
+	BiosHle* hle = nullptr;
+
+	// Where the BIOS jumps once the hardware is initialized
+	static constexpr uint32_t SHELL_ENTRY = 0x80030000;
+
+	bool fast_boot = false;
+	std::string boot_exe;
+
+	void enter_shell();
+	void boot_disc();
+
+	// Warm boot: the machine as it enters the shell, saved the first time
+	// and restored on later fast boots with the same BIOS
+	std::string warm_boot_dir;
+	bool warm_boot_hit = false;
+
+	std::string warm_boot_path();
+	bool load_warm_boot();
+	void save_warm_boot();
+
+	// Identifies the BIOS a state was saved with
+	uint64_t bios_hash = 0;
+	size_t state_size_hint = 0;
+
+	RewindBuffer* rewind = nullptr;
+	std::vector<uint8_t> rewind_scratch;
+
+	// Run-ahead: frames emulated past the real one, shown, then undone.
+	// Nothing from a speculative frame may leave the machine (audio,
+	// presentation, files, console output, the disc's access profile)
+	uint32_t run_ahead = 0;
+	bool speculative = false;
+	std::vector<uint8_t> run_ahead_state;
+
+	// Nothing is shown or heard at all, see SetHeadless()
+	bool headless = false;
+
+	void run_frame(bool present);
+
+	// Pad state as last set, what a movie records
+	Movie::Input pads = {};
+	bool analog_pads[2] = {};
+
+	void apply_pads();
+	std::string disc_path;
+
+	enum class MovieMode
+	{
+		None,
+		Starting,	// Recording begins with the next frame
+		Recording,
+		Playing,
+	};
+
+	Movie movie;
+	MovieMode movie_mode = MovieMode::None;
+	std::string movie_path;
+	uint32_t movie_frame = 0;
+	uint32_t movie_keyframes = 0;
+
+	void start_recording();
+	void movie_begin_frame();
+	void insert_disc(const std::string& path);
+	void set_speculative(bool on);
+
+	void do_state(StateStream& s);
 public:
+	// Save state file format; device layouts are versioned separately, see
+	// StateStream::section()
+	static constexpr uint32_t STATE_VERSION = 2;
+
 	System(std::string biosPath);
+	~System();
+
+	void InsertDisc(std::string discPath);
+
+	// Takes ownership of the sink
+	void SetAudioSink(AudioSink* sink);
+
+	// Never opens a window, plays audio or writes memory card files.
+	// Presenting goes through SDL, which wants the main thread, so every
+	// other instance has to be headless. Headless machines also decode MDEC
+	// bursts on their own thread, as dozens of them each with a pool would
+	// only fight over the cores
+	void SetHeadless(bool on);
+
+	// MDEC worker threads, see MDEC::set_workers()
+	void SetMdecWorkers(size_t threads);
+
+	// Ordered dithering of 15-bit MDEC output, see MDEC::set_dithering()
+	void SetMdecDithering(bool on);
+
+	// CPU::Feature mask; switches the CPU to the matching run loop
+	void SetCpuFeatures(uint32_t features);
+
+	// Runs the BIOS only up to the shell, then side-loads the EXE, or the
+	// disc's boot executable (from SYSTEM.CNF) if exe is empty
+	void FastBoot(std::string exe = "");
+
+	// Directory for warm boot snapshots, used by FastBoot()
+	void SetWarmBootCache(std::string dir) {warm_boot_dir = dir;}
+
+	// Complete machine state, appended to out. Loading a truncated or
+	// mismatched state fails and leaves the machine as it was
+	void SaveState(std::vector<uint8_t>& out);
+	bool LoadState(const std::vector<uint8_t>& in);
+	bool LoadState(const uint8_t* data, size_t size);
+
+	// Save state files, tied to the BIOS they were saved with
+	bool SaveStateFile(std::string path);
+	bool LoadStateFile(std::string path);
+
+	// Keeps a state per frame, within budget bytes of history (0 turns it
+	// off); Rewind() goes back up to frames frames and returns how many
+	void EnableRewind(size_t budget);
+	size_t Rewind(size_t frames);
+
+	// Shows the frame this many frames ahead of the emulated one, hiding
+	// that much internal input lag
+	void SetRunAhead(uint32_t frames) {run_ahead = frames;}
+
+	// Pad state as seen by the game, buttons active high in wire order,
+	// sticks 0x80 centered. Goes to both the JOY port and the HLE pad driver
+	void SetPad(int port, bool connected, uint16_t buttons);
+	void SetPadAxes(int port, uint8_t rx, uint8_t ry, uint8_t lx, uint8_t ly);
+	void SetAnalogPad(int port, bool analog);
+
+	// Memory card file for slot 0 or 1, created if missing
+	bool InsertCard(int port, std::string path);
+
+	// Writes size bytes at a RAM or scratchpad address; false if the range
+	// isn't entirely plain memory
+	bool PatchMemory(uint32_t addr, const uint8_t* data, uint32_t size);
+	uint64_t RamHash();
+	uint32_t GetPc();
+
+	// Call in a forked child: stops all output and drops what relies on the
+	// parent's threads, rewind and run-ahead
+	void AfterFork();
+
+	// Input movies. Recording starts at the next frame boundary (after a
+	// pending fast boot), playback restores the movie's start state. Pad and
+	// disc changes from outside are ignored while playing
+	void RecordMovie(std::string path, uint32_t keyframe_interval = 600);
+	bool PlayMovie(std::string path);
+	void StopMovie();
+
+	// Jumps to a frame of the movie being played back, from the nearest
+	// keyframe; false if the movie doesn't go that far
+	bool SeekMovie(uint32_t frame);
+	uint32_t GetMovieFrame() const {return movie_frame;}
+
+	// BIOS functions to run natively, see BiosHle::configure()
+	bool ConfigureHle(std::string spec);
 
 	void Clock();
 	void Dump();
@@ -119,3 +119,14 @@ void Timers::write(uint32_t addr, uint16_t data)
 		break;
 	}
 }
+
+void Timers::do_state(StateStream& s)
+{
+	s.section("TIMR", 1);
+
+	s.value(timer_value);
+	s.value(timer_modes);
+	s.value(timer_target);
+	s.value(timer_paused);
+	s.value(timer_irq_occured);
+}
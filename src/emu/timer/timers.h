@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <util/state.h>
 
 class Bus;
 
@@ -70,4 +71,6 @@ public:
 
 	uint16_t read(uint32_t addr);
 	void write(uint32_t addr, uint16_t data);
+
+	void do_state(StateStream& s);
 };
\ No newline at end of file
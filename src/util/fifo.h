@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+// Fixed-capacity ring buffer, used for the small hardware FIFOs so pushing
+// and popping never allocates.
+template<typename T, size_t N>
+class Fifo
+{
+	static_assert((N & (N - 1)) == 0, "Fifo capacity must be a power of two");
+private:
+	T data[N] = {};
+	size_t head = 0, tail = 0;
+public:
+	bool empty() const {return head == tail;}
+	bool full() const {return size() == N;}
+	size_t size() const {return tail - head;}
+	static constexpr size_t capacity() {return N;}
+
+	void clear() {head = tail = 0;}
+
+	bool push(const T& value)
+	{
+		if (full())
+			return false;
+		data[tail++ & (N - 1)] = value;
+		return true;
+	}
+
+	T& front() {return data[head & (N - 1)];}
+	const T& front() const {return data[head & (N - 1)];}
+
+	T pop()
+	{
+		assert(!empty());
+		T ret = front();
+		head++;
+		return ret;
+	}
+};
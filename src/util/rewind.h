@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <util/xor_delta.h>
+
+// Rewind history of whole machine states, one per frame. Only the newest
+// state is kept as is; every older one is stored as the XOR of it and its
+// successor, so stepping back is undoing deltas newest first and the oldest
+// can be dropped whenever the memory budget runs out.
+//
+// Consecutive frames differ in a few KiB of RAM and VRAM at most, so the
+// deltas (see XorDelta) are almost entirely zero and pack down to little.
+class RewindBuffer
+{
+private:
+	std::vector<uint8_t> newest;
+	std::deque<std::vector<uint8_t>> deltas;	// Oldest first
+	size_t budget;
+	size_t used = 0;
+public:
+	// Memory budget for the deltas, in bytes
+	explicit RewindBuffer(size_t budget) : budget(budget) {}
+
+	// Adds the newest state. Takes state's contents and hands back a buffer
+	// to reuse for the next one
+	void push(std::vector<uint8_t>& state)
+	{
+		if (!newest.empty())
+		{
+			std::vector<uint8_t> delta;
+			XorDelta::encode(newest, state, delta);
+			delta.shrink_to_fit();
+
+			used += delta.size();
+			deltas.push_back(std::move(delta));
+
+			while (used > budget && !deltas.empty())
+			{
+				used -= deltas.front().size();
+				deltas.pop_front();
+			}
+		}
+
+		newest.swap(state);
+	}
+
+	// Steps back up to frames states, dropping everything newer; returns
+	// how many it went back
+	size_t rewind(size_t frames)
+	{
+		frames = std::min(frames, deltas.size());
+
+		for (size_t i = 0; i < frames; i++)
+		{
+			XorDelta::apply(deltas.back(), newest);
+			used -= deltas.back().size();
+			deltas.pop_back();
+		}
+
+		return frames;
+	}
+
+	const std::vector<uint8_t>& current() const {return newest;}
+
+	// How many frames back the history goes
+	size_t frames() const {return deltas.size();}
+	size_t memory() const {return used;}
+
+	void clear()
+	{
+		newest.clear();
+		deltas.clear();
+		used = 0;
+	}
+};
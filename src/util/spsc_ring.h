@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Lock-free ring for exactly one producer thread and one consumer thread.
+// Both sides move whole runs of elements and never wait on each other: the
+// producer writes what fits and reports how much that was.
+template<typename T, size_t N>
+class SpscRing
+{
+	static_assert((N & (N - 1)) == 0, "SpscRing capacity must be a power of two");
+private:
+	T data[N];
+	alignas(64) std::atomic<size_t> head = 0;	// Consumer position
+	alignas(64) std::atomic<size_t> tail = 0;	// Producer position
+public:
+	size_t write(const T* src, size_t count)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_acquire);
+
+		count = std::min(count, N - (t - h));
+
+		size_t first = std::min(count, N - (t & (N - 1)));
+		std::memcpy(&data[t & (N - 1)], src, first * sizeof(T));
+		std::memcpy(&data[0], src + first, (count - first) * sizeof(T));
+
+		tail.store(t + count, std::memory_order_release);
+		return count;
+	}
+
+	size_t read(T* dst, size_t count)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_acquire);
+
+		count = std::min(count, t - h);
+
+		size_t first = std::min(count, N - (h & (N - 1)));
+		std::memcpy(dst, &data[h & (N - 1)], first * sizeof(T));
+		std::memcpy(dst + first, &data[0], (count - first) * sizeof(T));
+
+		head.store(h + count, std::memory_order_release);
+		return count;
+	}
+
+	size_t size() const
+	{
+		return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+	}
+
+	static constexpr size_t capacity() {return N;}
+};
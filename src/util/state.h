@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <type_traits>
+
+// Flat binary machine state. Every device describes its state once, in a
+// do_state(StateStream&) that saves or loads depending on the stream's
+// direction, so the two can't drift apart. Values are copied as raw bytes:
+// states are only meant to be loaded by the same build on the same host.
+//
+// Each device's state starts with a section() carrying a tag and a layout
+// version, bumped whenever that device's do_state changes, so an old or
+// foreign state is rejected instead of being misread.
+class StateStream
+{
+private:
+	std::vector<uint8_t>* out = nullptr;
+	const uint8_t* in = nullptr;
+	size_t in_size = 0;
+	size_t pos = 0;
+	bool failed = false;
+	const char* current = "";
+	const char* failed_in = nullptr;
+
+	void fail()
+	{
+		if (!failed)
+			failed_in = current;
+		failed = true;
+	}
+public:
+	// Appends to out
+	explicit StateStream(std::vector<uint8_t>& out) : out(&out) {}
+	StateStream(const uint8_t* in, size_t size) : in(in), in_size(size) {}
+
+	bool is_loading() const {return in != nullptr;}
+
+	// False once a load has run past the end of the data or hit a section
+	// that doesn't match
+	bool ok() const {return !failed;}
+	const char* failed_section() const {return failed_in ? failed_in : "";}
+	size_t position() const {return out ? out->size() : pos;}
+
+	void bytes(void* data, size_t size)
+	{
+		if (out)
+		{
+			size_t start = out->size();
+			out->resize(start + size);
+			std::memcpy(out->data() + start, data, size);
+			return;
+		}
+
+		if (failed || size > in_size - pos)
+		{
+			fail();
+			return;
+		}
+
+		std::memcpy(data, in + pos, size);
+		pos += size;
+	}
+
+	template<typename T>
+	void value(T& v)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		bytes(&v, sizeof(T));
+	}
+
+	template<typename T>
+	void vector(std::vector<T>& v)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+
+		uint32_t size = v.size();
+		value(size);
+
+		if (is_loading())
+		{
+			if (failed || (size_t)size * sizeof(T) > in_size - pos)
+			{
+				fail();
+				return;
+			}
+			v.resize(size);
+		}
+
+		bytes(v.data(), (size_t)size * sizeof(T));
+	}
+
+	// Fails a load whose values don't hold together, e.g. an index past the
+	// end of its buffer, which the device would otherwise trust
+	void check(bool valid)
+	{
+		if (is_loading() && !valid)
+			fail();
+	}
+
+	// Four character tag, e.g. "GPU "
+	void section(const char (&tag)[5], uint32_t version)
+	{
+		uint32_t id, saved_id, saved_version = version;
+		std::memcpy(&id, tag, 4);
+		saved_id = id;
+
+		current = tag;
+		value(saved_id);
+		value(saved_version);
+
+		if (saved_id != id || saved_version != version)
+			fail();
+	}
+};
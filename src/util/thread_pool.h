@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for splitting one batch of independent items
+// across cores. parallel_for() blocks until every item is done; the calling
+// thread works on items too, so a pool with no workers runs them inline.
+class ThreadPool
+{
+private:
+	struct Job
+	{
+		std::function<void(size_t)> func;
+		size_t count;
+		std::atomic<size_t> next = 0;
+		std::atomic<size_t> completed = 0;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake, done;
+
+	// Workers keep their own reference, so one waking up late for an
+	// already finished job just finds nothing left to take
+	std::shared_ptr<Job> job;
+	uint64_t generation = 0;
+	bool stop = false;
+
+	void run_items(Job& job)
+	{
+		size_t finished = 0;
+
+		for (;;)
+		{
+			size_t index = job.next.fetch_add(1, std::memory_order_relaxed);
+			if (index >= job.count)
+				break;
+
+			job.func(index);
+			finished++;
+		}
+
+		if (finished && job.completed.fetch_add(finished, std::memory_order_acq_rel) + finished == job.count)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			done.notify_all();
+		}
+	}
+
+	void worker_loop()
+	{
+		uint64_t seen = 0;
+
+		for (;;)
+		{
+			std::shared_ptr<Job> current;
+
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] {return stop || generation != seen;});
+
+				if (stop)
+					return;
+
+				seen = generation;
+				current = job;
+			}
+
+			run_items(*current);
+		}
+	}
+public:
+	ThreadPool(size_t threads)
+	{
+		for (size_t i = 0; i < threads; i++)
+			workers.emplace_back(&ThreadPool::worker_loop, this);
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wake.notify_all();
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	size_t size() const {return workers.size();}
+
+	void parallel_for(size_t count, std::function<void(size_t)> func)
+	{
+		auto current = std::make_shared<Job>();
+		current->func = std::move(func);
+		current->count = count;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			job = current;
+			generation++;
+		}
+		wake.notify_all();
+
+		run_items(*current);
+
+		std::unique_lock<std::mutex> guard(lock);
+		done.wait(guard, [&] {return current->completed.load(std::memory_order_acquire) == count;});
+	}
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+// XOR delta between two byte buffers, such as machine states. Where the
+// buffers mostly agree the XOR is almost entirely zero, so it is packed as
+// runs of zero and literal 64-bit words; zero runs are skipped four words
+// at a time, which the compiler turns into vector compares.
+class XorDelta
+{
+private:
+	struct DeltaHeader
+	{
+		uint64_t size;		// Of a
+		uint64_t words;
+	};
+
+	static uint64_t load(const uint8_t* data, size_t size, size_t word)
+	{
+		uint64_t v = 0;
+		size_t offset = word * 8;
+
+		if (offset + 8 <= size)
+			std::memcpy(&v, data + offset, 8);
+		else if (offset < size)
+			std::memcpy(&v, data + offset, size - offset);
+
+		return v;
+	}
+
+	static void put_varint(std::vector<uint8_t>& out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(v | 0x80);
+			v >>= 7;
+		}
+		out.push_back(v);
+	}
+
+	static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v)
+	{
+		v = 0;
+
+		for (int shift = 0; p < end && shift < 64; shift += 7)
+		{
+			v |= (uint64_t)(*p & 0x7F) << shift;
+			if (!(*p++ & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+public:
+	// Delta that turns b back into a; the two may differ in size
+	static void encode(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, std::vector<uint8_t>& out)
+	{
+		DeltaHeader header;
+		header.size = a.size();
+		header.words = (std::max(a.size(), b.size()) + 7) / 8;
+
+		out.resize(sizeof(header));
+		std::memcpy(out.data(), &header, sizeof(header));
+
+		// Words both states have in full take the fast path
+		size_t full = std::min(a.size(), b.size()) / 8;
+		const uint8_t* pa = a.data();
+		const uint8_t* pb = b.data();
+
+		auto word = [&](size_t i)
+		{
+			if (i < full)
+			{
+				uint64_t wa, wb;
+				std::memcpy(&wa, pa + i * 8, 8);
+				std::memcpy(&wb, pb + i * 8, 8);
+				return wa ^ wb;
+			}
+			return load(pa, a.size(), i) ^ load(pb, b.size(), i);
+		};
+
+		auto block_zero = [&](size_t i)
+		{
+			uint64_t wa[4], wb[4];
+			std::memcpy(wa, pa + i * 8, 32);
+			std::memcpy(wb, pb + i * 8, 32);
+			return ((wa[0] ^ wb[0]) | (wa[1] ^ wb[1]) | (wa[2] ^ wb[2]) | (wa[3] ^ wb[3])) == 0;
+		};
+
+		size_t i = 0;
+		while (i < header.words)
+		{
+			size_t zero_start = i;
+			while (i + 4 <= full && block_zero(i))
+				i += 4;
+			while (i < header.words && word(i) == 0)
+				i++;
+
+			size_t literal_start = i;
+			while (i < header.words && word(i) != 0)
+				i++;
+
+			put_varint(out, literal_start - zero_start);
+			put_varint(out, i - literal_start);
+
+			size_t pos = out.size();
+			out.resize(pos + (i - literal_start) * 8);
+
+			for (size_t j = literal_start; j < i; j++, pos += 8)
+			{
+				uint64_t v = word(j);
+				std::memcpy(out.data() + pos, &v, 8);
+			}
+		}
+	}
+
+	// Whether apply() would succeed on a b of b_size bytes: the delta is
+	// well formed, stays within its words and a is at most max_size bytes
+	static bool check(const std::vector<uint8_t>& delta, size_t b_size, size_t max_size = SIZE_MAX)
+	{
+		DeltaHeader header;
+
+		if (delta.size() < sizeof(header))
+			return false;
+
+		std::memcpy(&header, delta.data(), sizeof(header));
+
+		if (header.size > max_size || header.words != (std::max<uint64_t>(header.size, b_size) + 7) / 8)
+			return false;
+
+		const uint8_t* p = delta.data() + sizeof(header);
+		const uint8_t* end = delta.data() + delta.size();
+		uint64_t left = header.words;
+
+		while (p < end)
+		{
+			uint64_t zeros, literals;
+
+			if (!get_varint(p, end, zeros) || !get_varint(p, end, literals))
+				return false;
+			if (zeros > left || literals > left - zeros || literals > (uint64_t)(end - p) / 8)
+				return false;
+
+			left -= zeros + literals;
+			p += literals * 8;
+		}
+
+		return true;
+	}
+
+	// Turns b into a, given encode(a, b). Fails, leaving b alone, if check()
+	// does
+	static bool apply(const std::vector<uint8_t>& delta, std::vector<uint8_t>& b, size_t max_size = SIZE_MAX)
+	{
+		if (!check(delta, b.size(), max_size))
+			return false;
+
+		DeltaHeader header;
+		std::memcpy(&header, delta.data(), sizeof(header));
+
+		const uint8_t* p = delta.data() + sizeof(header);
+		const uint8_t* end = delta.data() + delta.size();
+
+		b.resize(header.words * 8);
+		uint8_t* out = b.data();
+
+		while (p < end)
+		{
+			uint64_t zeros, literals;
+			get_varint(p, end, zeros);
+			get_varint(p, end, literals);
+
+			out += zeros * 8;
+
+			for (size_t j = 0; j < literals; j++, out += 8, p += 8)
+			{
+				uint64_t v, x;
+				std::memcpy(&v, out, 8);
+				std::memcpy(&x, p, 8);
+				v ^= x;
+				std::memcpy(out, &v, 8);
+			}
+		}
+
+		b.resize(header.size);
+		return true;
+	}
+};